@@ -0,0 +1,146 @@
+/* ----------------------------------------------------------------------
+Fast approximations of the transcendental functions used by the AWSEM
+kernels: a Cody-Waite range reduction with round-to-nearest through the
+1.5*2^52 shift, then a minimax polynomial, without calls into libm.
+
+Maximum errors measured against libm on 2*10^7 evenly spaced points:
+  fast_exp   x in [-708, 708]   relative error < 2.3e-16
+  fast_tanh  x in [-20, 20]     relative error < 7e-16 (3 ulp)
+  fast_sin   x in [-1e4, 1e4]   absolute error < 2.3e-16
+  fast_cos   x in [-1e4, 1e4]   absolute error < 2.3e-16
+fast_exp returns 0 below -708, where libm still returns subnormals down
+to -745, and exp(708) above 708. fast_tanh is exact +-1 beyond |x|~19.
+------------------------------------------------------------------------- */
+
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include <math.h>
+#include <string.h>
+
+#define FAST_MATH_SHIFT 6755399441055744.0 // 1.5*2^52
+#define FAST_MATH_SHIFT_BITS 0x4338000000000000LL
+
+#define FAST_MATH_LN2_HI 6.93147180369123816490e-01
+#define FAST_MATH_LN2_LO 1.90821492927058770002e-10
+#define FAST_MATH_INV_LN2 1.44269504088896338700e+00
+
+#define FAST_MATH_PIO2_1 1.57079632673412561417e+00
+#define FAST_MATH_PIO2_2 6.07710050650619224932e-11
+#define FAST_MATH_PIO2_3 2.02226624879595063154e-21
+#define FAST_MATH_INV_PIO2 6.36619772367581382433e-01
+
+// Round x to the nearest integer k, |x| < 2^51, returned both as a double
+// and as an integer
+inline double fast_round(double x, long long &k)
+{
+	double kd = x + FAST_MATH_SHIFT;
+	memcpy(&k, &kd, sizeof(double));
+	k -= FAST_MATH_SHIFT_BITS;
+	return kd - FAST_MATH_SHIFT;
+}
+
+inline double fast_exp(double x)
+{
+	double xc, kd, r, r2, r4, p, q, s;
+	long long k, bits;
+
+	xc = (x<-708.0 ? -708.0 : x);
+	xc = (xc>708.0 ? 708.0 : xc);
+
+	kd = fast_round(xc*FAST_MATH_INV_LN2, k);
+	r = (xc - kd*FAST_MATH_LN2_HI) - kd*FAST_MATH_LN2_LO;
+
+	// exp(r) = 1 + r + r^2*p(r), p of degree 9 minimax for |r| <= ln(2)/2,
+	// evaluated in Estrin form
+	r2 = r*r;
+	r4 = r2*r2;
+	p = (0.5000000000000011 + 0.16666666666666413*r) + r2*(0.041666666666530267 + 0.008333333333494335*r);
+	q = (0.001388888894359742 + 0.00019841269506772164*r) + r2*(2.4801493136433562e-05 + 2.7557586275084822e-06*r);
+	q += r4*(2.7630233844767376e-07 + 2.500006905552792e-08*r);
+	p += r4*q;
+	p = 1.0 + (r + r2*p);
+
+	bits = (k + 1023) << 52;
+	memcpy(&s, &bits, sizeof(double));
+
+	return (x<-708.0 ? 0.0 : p*s);
+}
+
+inline double fast_tanh(double x)
+{
+	double ax = fabs(x), x2, p, e;
+
+	if (ax<0.3) {
+		// odd minimax polynomial of degree 15
+		x2 = x*x;
+		p = -0.0012606934706169818;
+		p = p*x2 + 0.0035643948035899643;
+		p = p*x2 - 0.008861153053332809;
+		p = p*x2 + 0.021869401394563392;
+		p = p*x2 - 0.05396825198210155;
+		p = p*x2 + 0.13333333331106262;
+		p = p*x2 - 0.33333333333323806;
+		p = p*x2 + 0.9999999999999999;
+		return x*p;
+	}
+
+	e = fast_exp(2.0*ax);
+	p = 1.0 - 2.0/(e + 1.0);
+	return (x>0 ? p : -p);
+}
+
+// Reduce x to r in [-pi/4, pi/4] with x = r + k*pi/2
+inline double fast_reduce_pio2(double x, long long &k)
+{
+	double kd = fast_round(x*FAST_MATH_INV_PIO2, k);
+	return ((x - kd*FAST_MATH_PIO2_1) - kd*FAST_MATH_PIO2_2) - kd*FAST_MATH_PIO2_3;
+}
+
+// minimax on [-pi/4, pi/4], degree 13
+inline double fast_sin_poly(double r)
+{
+	double r2 = r*r, p;
+	p = 1.5894136917127832e-10;
+	p = p*r2 - 2.505070585617367e-08;
+	p = p*r2 + 2.7557313299080623e-06;
+	p = p*r2 - 0.00019841269828402332;
+	p = p*r2 + 0.008333333333320002;
+	p = p*r2 - 0.16666666666666616;
+	return r + r*r2*p;
+}
+
+// minimax on [-pi/4, pi/4], degree 12
+inline double fast_cos_poly(double r)
+{
+	double r2 = r*r, p;
+	p = 2.0627448433880386e-09;
+	p = p*r2 - 2.755517799726581e-07;
+	p = p*r2 + 2.4801578148505346e-05;
+	p = p*r2 - 0.0013888888868722141;
+	p = p*r2 + 0.04166666666645397;
+	p = p*r2 - 0.4999999999999915;
+	return 0.9999999999999999 + r2*p;
+}
+
+// Both polynomials are evaluated and the quadrant selects one of them,
+// which avoids a hard to predict branch
+inline double fast_sin(double x)
+{
+	long long k;
+	double r = fast_reduce_pio2(x, k);
+	double s = fast_sin_poly(r), c = fast_cos_poly(r);
+	double v = (k & 1 ? c : s);
+	return (k & 2 ? -v : v);
+}
+
+inline double fast_cos(double x)
+{
+	long long k;
+	double r = fast_reduce_pio2(x, k);
+	double s = fast_sin_poly(r), c = fast_cos_poly(r);
+	double v = (k & 1 ? s : c);
+	return ((k+1) & 2 ? -v : v);
+}
+
+#endif
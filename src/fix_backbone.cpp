@@ -32,10 +32,22 @@
 #include "comm.h"
 #include "timer.h"
 #include <fstream>
+#include <map>
+#include <string>
 #include <time.h>
 #include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 using std::ifstream;
+using std::map;
+using std::string;
 
 #define delta 0.00001
 #define delta_water_xi 1e-8
@@ -44,6 +56,9 @@ using std::ifstream;
 #define pap_delta 1e-12
 #define vfm_small 0.0001
 #define pair_flag 1
+#define DELTA_ACTIVE 4096
+#define MEMB_TANH_SAT 20.0 // tanh(x) is 1 in double precision beyond this
+#define DELTA_FM_LIST 16384
 
 using namespace LAMMPS_NS;
 using namespace FixConst;
@@ -53,6 +68,41 @@ using namespace FixConst;
 // {"ALA", "ARG", "ASN", "ASP", "CYS", "GLN", "GLU", "GLY", "HIS", "ILE", "LEU", "LYS", "MET", "PHE", "PRO", "SER", "THR", "TRP", "TYR", "VAL"};
 // {"A", "R", "N", "D", "C", "Q", "E", "G", "H", "I", "L", "K", "M", "F", "P", "S", "T", "W", "Y", "V"};
 int se_map[] = {0, 0, 4, 3, 6, 13, 7, 8, 9, 0, 11, 10, 12, 2, 0, 14, 5, 1, 15, 16, 0, 19, 17, 0, 18, 0};
+
+// Energy term names in EnergyTerms order, as in the energy.log header
+const char *energy_term_names[] = {"Total", "Chain", "Shake", "Chi", "Rama", "Excluded", "DSSP", "P_AP",
+                                   "Water", "Burial", "Helix", "AMH-Go", "Frag_Mem", "Vec_FM",
+                                   "Contact_Restraints", "Membrane", "SSB", "Electro."};
+
+// Binary FM table (fm_table.bin): this header, one int per (i, j, atom pair)
+// table holding its slot in the data block or -1 if empty (padded to 8
+// bytes), then tb_size TBV values per slot. The checksum covers everything
+// after the header.
+#define FM_TABLE_MAGIC "AWSEMFMT"
+#define FM_TABLE_VERSION 1
+
+struct FMTableHeader {
+  char magic[8];
+  int version, n, tb_size, tb_nbrs, ntables, pad;
+  double tb_rmin, tb_dr;
+  unsigned long long checksum;
+};
+
+// 64-bit FNV-1a hash, continued from h
+static unsigned long long fm_table_hash(const void *data, size_t len, unsigned long long h)
+{
+  const unsigned char *p = (const unsigned char *) data;
+  for (size_t i=0;i<len;++i) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+// Atom types of the four atom pair tables (CA-CA, CA-CB, CB-CA, CB-CB)
+static const int fm_table_iatom[4] = {Fragment_Memory::FM_CA, Fragment_Memory::FM_CA, Fragment_Memory::FM_CB, Fragment_Memory::FM_CB};
+static const int fm_table_jatom[4] = {Fragment_Memory::FM_CA, Fragment_Memory::FM_CB, Fragment_Memory::FM_CA, Fragment_Memory::FM_CB};
+
 char one_letter_code[] = {'A', 'R', 'N', 'D', 'C', 'Q', 'E', 'G', 'H', 'I', 'L', 'K', 'M', 'F', 'P', 'S', 'T', 'W', 'Y', 'V'};
 
 // Four letter classes
@@ -120,23 +170,116 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
   frag_frust_flag = tert_frust_flag = nmer_frust_flag = optimization_flag = burial_optimization_flag = 0;
   cont_rest_flag = 0;
   huckel_flag = debyehuckel_optimization_flag = 0;
+  dh_cutoff_flag = 0;
+  n_dh_res = 0;
+  dh_res = NULL;
+  n_dh_pairs = max_dh_pairs = 0;
+  dh_pairs = NULL;
+  n_cont_rest = n_cr_list = 0;
+  cr_first = cr_list = NULL;
+  cr_pars = NULL;
+  memb_table_flag = 0;
+  memb_resort = 1;
+  n_memb_kernel = 0;
+  memb_kernel = NULL;
+  memb_tb_z = memb_tb_u = NULL;
   shuffler_flag = 0;
   mutate_sequence_flag = 0;
   monte_carlo_seq_opt_flag = 0;
   fm_use_table_flag = fm_read_table_flag = 0;
+  fm_table_map = NULL;
+  fm_table_map_size = 0;
+  fm_tb_range_error = 0;
+  fm_table_data = NULL;
+  fm_compact_flag = 0;
+  shm_flag = 0;
+  shm_reading = false;
+  shm_me = shm_node = 0;
+  shm_nprocs = shm_nnodes = 1;
+  shm_comm = shm_leader_comm = MPI_COMM_NULL;
+  n_shm_win = 0;
+  fmc_row = fmc_col = fmc_slot = NULL;
+  fmc_e = fmc_d = NULL;
+  fmc_err = NULL;
   n_frag_mems = 0;
   n_rama_par = n_rama_p_par = 0;
+  rama_table_flag = rama_table_n = n_rama_table = 0;
+  rama_table = NULL;
   pair_list_cutoff = 0.0;
 
+  nthreads = 1;
+  thr_nmax = 0;
+  thr_f = NULL;
+  thr_energy = NULL;
+
+  fast_math_flag = 0;
+  fast_math_validate_every = 0;
+  fast_math_on = false;
+
+  ghost_comm_flag = 0;
+  dens_nmax = 0;
+  comm_stage = comm_nvals = 0;
+  atom_dens = NULL;
+
+  list = NULL;
+
+  n_active = max_active = 0;
+  active_pairs = NULL;
+  rebuild_active_pairs = true;
+
+  n_dssp_pairs = max_dssp_pairs = n_helix_pairs = max_helix_pairs = 0;
+  n_pap_pairs = max_pap_pairs = 0;
+  dssp_pairs = helix_pairs = pap_pairs = NULL;
+
+  fm_list_n = fm_list_max = 0;
+  fm_list_start = fm_list_j = NULL;
+  fm_list_sites = NULL;
+  fm_list_rf = fm_list_inv2sigsq = fm_list_eps = NULL;
+  fm_list_dirty = true;
+
+  amh_go_npairs = 0;
+  amh_go_first = amh_go_site = NULL;
+  amh_go_rn = amh_go_sigma_sq = amh_go_gm = amh_go_dE = NULL;
+  amh_go_near = NULL;
+
   epsilon = 1.0; // general energy scale
   p = 2; // for excluded volume
 
-  int i, j;
+  int i, j, k, nlines, ilevel, ierr;
 
   for (i=0;i<12;i++) ssweight[i] = false;
 
   for (i=0;i<TIME_N;i++) ctime[i] = 0.0;
 
+  // switches of every energy term, cleared per rRESPA level by respa_select_terms()
+  respa_flag = 0;
+  respa_ilevel = -1;
+  cache_stamp = 0;
+  for (i=0;i<nEnergyTerms;++i) {
+    respa_level[i] = respa_term_level[i] = -1;
+    respa_switch[i][0] = respa_switch[i][1] = respa_switch[i][2] = NULL;
+  }
+  respa_switch[ET_CHAIN][0] = &chain_flag;
+  respa_switch[ET_SHAKE][0] = &shake_flag;
+  respa_switch[ET_CHI][0] = &chi_flag;
+  respa_switch[ET_RAMA][0] = &rama_flag;
+  respa_switch[ET_VEXCLUDED][0] = &excluded_flag;
+  respa_switch[ET_VEXCLUDED][1] = &p_excluded_flag;
+  respa_switch[ET_VEXCLUDED][2] = &r6_excluded_flag;
+  respa_switch[ET_DSSP][0] = &dssp_hdrgn_flag;
+  respa_switch[ET_PAP][0] = &p_ap_flag;
+  respa_switch[ET_WATER][0] = &water_flag;
+  respa_switch[ET_BURIAL][0] = &burial_flag;
+  respa_switch[ET_HELIX][0] = &helix_flag;
+  respa_switch[ET_AMHGO][0] = &amh_go_flag;
+  respa_switch[ET_FRAGMEM][0] = &frag_mem_flag;
+  respa_switch[ET_FRAGMEM][1] = &frag_mem_tb_flag;
+  respa_switch[ET_VFRAGMEM][0] = &vec_frag_mem_flag;
+  respa_switch[ET_CONT_REST][0] = &cont_rest_flag;
+  respa_switch[ET_MEMB][0] = &memb_flag;
+  respa_switch[ET_SSB][0] = &ssb_flag;
+  respa_switch[ET_DH][0] = &huckel_flag;
+
   // backbone geometry coefficients
   an = 0.4831806; bn = 0.7032820; cn = -0.1864262;
   ap = 0.4436538; bp = 0.2352006; cp = 0.3211455;
@@ -161,7 +304,7 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
   group2bit = group->bitmask[igroup2];
   group3bit = group->bitmask[igroup3];
 
-  char varsection[100];
+  char varsection[100], term_name[100];
   ifstream in(arg[5]);
   if (!in) error->all(FLERR,"Coefficient file was not found!");
   while (!in.eof()) {
@@ -220,6 +363,11 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
         phiw[j+i_rp] *= sigma[j+i_rp];
         psiw[j+i_rp] *= sigma[j+i_rp];
       }
+    } else if (strcmp(varsection, "[Rama_Table]")==0) {
+      rama_table_flag = 1;
+      if (comm->me==0) print_log("Rama_Table flag on\n");
+      in >> rama_table_n;
+      if (rama_table_n<4) error->all(FLERR,"Rama_Table needs at least 4 grid points per angle");
     } else if (strcmp(varsection, "[SSWeight]")==0) {
       ssweight_flag = 1;
       if (comm->me==0) print_log("SSWeight flag on\n");
@@ -318,6 +466,10 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
       in >> frag_table_well_width;
       in >> fm_use_table_flag;
       in >> fm_sigma_exp;
+    } else if (strcmp(varsection, "[Fragment_Memory_Compact_Table]")==0) {
+      fm_compact_flag = 1;
+      if (comm->me==0) print_log("Fragment_Memory_Compact_Table flag on\n");
+      in >> fmc_dr;
     } else if (strcmp(varsection, "[Contact_Restraints]")==0) {
       cont_rest_flag = 1;
       if (comm->me==0) print_log("Contact_Restraints flag on\n");
@@ -356,6 +508,10 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
       for (i=0;i<3;++i)
         for (j=0;j<4;++j)
           in >> g_memb[i][j];
+    } else if (strcmp(varsection, "[Membrane_Table]")==0) {
+      memb_table_flag = 1;
+      if (comm->me==0) print_log("Membrane_Table flag on\n");
+      in >> memb_tb_dr;
     } else if (strcmp(varsection, "[Fragment_Frustratometer]")==0) {
       // The fragment frustratometer requires the fragment memory potential to be active
       if (!frag_mem_flag && !frag_mem_tb_flag) error->all(FLERR,"Cannot run Fragment_Frustratometer without Fragment_Memory or Fragment_Memory_Table.");
@@ -475,6 +631,10 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
         if (logfile) fprintf(logfile, "Debye-Huckel Screening Length = %8.6f Angstroms\n", screening_length);
       }
       in >> debye_huckel_min_sep;
+    } else if (strcmp(varsection, "[DebyeHuckel_Cutoff]")==0) {
+      dh_cutoff_flag = 1;
+      if (comm->me==0) print_log("DebyeHuckel_Cutoff flag on\n");
+      in >> dh_cutoff_factor;
     } else if (strcmp(varsection, "[DebyeHuckel_Optimization]")==0) {
       debyehuckel_optimization_flag = 1;
       if (comm->me==0) print_log("DebyeHuckel_Optimization flag on\n");
@@ -485,6 +645,51 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
       if ( shuffler_flag == 1 ) {
 	      if (comm->me==0) print_log("Shuffler flag on\n");
       }
+    } else if (strcmp(varsection, "[OpenMP]")==0) {
+      in >> nthreads;
+#if defined(_OPENMP)
+      if (nthreads<=0) nthreads = omp_get_max_threads();
+      if (comm->me==0) {
+        if (screen) fprintf(screen, "OpenMP flag on: %d threads\n", nthreads);
+        if (logfile) fprintf(logfile, "OpenMP flag on: %d threads\n", nthreads);
+      }
+#else
+      if (comm->me==0) print_log("OpenMP: fix backbone was compiled without OpenMP support, running single-threaded\n");
+      nthreads = 1;
+#endif
+    } else if (strcmp(varsection, "[FastMath]")==0) {
+      in >> fast_math_flag;
+      if (fast_math_flag==2) {
+        in >> fast_math_validate_every;
+        if (fast_math_validate_every<=0) error->all(FLERR,"FastMath validation period must be positive");
+      }
+      fast_math_on = (fast_math_flag!=0);
+      if (comm->me==0) {
+        if (screen) fprintf(screen, "FastMath flag on: %d\n", fast_math_flag);
+        if (logfile) fprintf(logfile, "FastMath flag on: %d\n", fast_math_flag);
+      }
+    } else if (strcmp(varsection, "[Respa_Levels]")==0) {
+      respa_flag = 1;
+      if (comm->me==0) print_log("Respa_Levels flag on\n");
+      in >> nlines;
+      for (j=0;j<nlines;++j) {
+        in >> term_name >> ilevel;
+        for (k=1;k<nEnergyTerms;++k)
+          if (strcmp(term_name, energy_term_names[k])==0) break;
+        if (k==nEnergyTerms) error->all(FLERR,"Respa_Levels: unknown energy term");
+        if (ilevel<1) error->all(FLERR,"Respa_Levels: rRESPA levels start at 1");
+        respa_level[k] = ilevel-1;
+      }
+    } else if (strcmp(varsection, "[Shared_Memory]")==0) {
+      shm_flag = 1;
+      if (comm->me==0) print_log("Shared_Memory flag on\n");
+    } else if (strcmp(varsection, "[Ghost_Comm]")==0) {
+      in >> ghost_comm_flag;
+      if (ghost_comm_flag) {
+        if (comm->me==0) print_log("Ghost_Comm flag on\n");
+        comm_forward = 2;
+        comm_reverse = 2;
+      }
     } else if (strcmp(varsection, "[Mutate_Sequence]")==0) {
       in >> mutate_sequence_flag;
       in >> mutate_sequence_sequences_file_name;
@@ -496,8 +701,30 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
     varsection[0]='\0'; // Clear buffer
   }
   in.close();
+
+  // AMH-Go sums the per-atom Ei of ghost atoms onto their owners
+  if (amh_go_flag && comm_forward<1) comm_forward = comm_reverse = 1;
+
   if (comm->me==0) print_log("\n");
 
+  // Ranks sharing a node keep one copy of the read-only fragment data
+  if (shm_flag) {
+    MPI_Comm_split_type(world, MPI_COMM_TYPE_SHARED, comm->me, MPI_INFO_NULL, &shm_comm);
+    MPI_Comm_rank(shm_comm, &shm_me);
+    MPI_Comm_size(shm_comm, &shm_nprocs);
+    MPI_Comm_split(world, (shm_me==0 ? 0 : MPI_UNDEFINED), comm->me, &shm_leader_comm);
+    if (shm_me==0) {
+      MPI_Comm_rank(shm_leader_comm, &shm_node);
+      MPI_Comm_size(shm_leader_comm, &shm_nnodes);
+    }
+    MPI_Bcast(&shm_node, 1, MPI_INT, 0, shm_comm);
+    MPI_Bcast(&shm_nnodes, 1, MPI_INT, 0, shm_comm);
+    if (comm->me==0) {
+      if (screen) fprintf(screen, "Shared_Memory: %d nodes\n", shm_nnodes);
+      if (logfile) fprintf(logfile, "Shared_Memory: %d nodes\n", shm_nnodes);
+    }
+  }
+
   // Scale all term strengths by epsilon to streamline calculations
   k_chain[0] *= epsilon;
   k_chain[1] *= epsilon;
@@ -513,8 +740,32 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
   k_cont_rest *= epsilon;
 
   for (int j=0;j<n_rama_par;j++) w[j] *= k_rama;
+
+  // Constants for the single-exponential burial switching functions. Every
+  // exponent is kept below 300 so that their products stay finite.
+  burial_exp_max_arg = 300.0;
+  if (burial_flag) {
+    for (i=0;i<3;++i) {
+      if (fabs(2.0*burial_kappa*burial_ro_min[i])>burial_exp_max_arg || fabs(2.0*burial_kappa*burial_ro_max[i])>burial_exp_max_arg)
+        burial_exp_max_arg = -1.0; // always fall back to tanh
+    }
+    for (i=0;i<3;++i) {
+      burial_exp_ro_min[i] = (burial_exp_max_arg>0 ? exp(-2.0*burial_kappa*burial_ro_min[i]) : 0.0);
+      burial_exp_ro_max[i] = (burial_exp_max_arg>0 ? exp(2.0*burial_kappa*burial_ro_max[i]) : 0.0);
+    }
+  }
   for (int j=0;j<n_rama_p_par;j++) w[j+i_rp] *= k_rama;
 
+  // Thread-private force and energy accumulators, reduced once per step
+  if (nthreads>1) {
+    thr_f = new double**[nthreads];
+    thr_energy = new double*[nthreads];
+    for (i=0;i<nthreads;++i) {
+      thr_f[i] = NULL;
+      thr_energy[i] = new double[nEnergyTerms];
+    }
+  }
+
   // Do senity check to make sure that e.g. water potential is on when needed by other function
 
   force_flag = 0;
@@ -603,6 +854,8 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
     in_ssw.close();
   }
 
+  if (rama_flag && rama_table_flag) build_rama_table();
+
   // Read Contact Restraints potential file and construct mapping arrays
   if (cont_rest_flag) {
     read_contact_restraints_file();
@@ -617,6 +870,11 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
       if (in_memb_zim.eof()) error->all(FLERR,"Membrane potential parameter file format error");
     }
     in_memb_zim.close();
+
+    if (memb_table_flag) {
+      if (memb_tb_dr<=0.0 || k_bin<=0.0) error->all(FLERR,"Membrane_Table: table spacing and k_bin must be positive");
+      setup_membrane_table();
+    }
   }
 
 
@@ -700,32 +958,59 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
     if (amh_go_gamma->error==amh_go_gamma->ERR_GAMMA) error->all(FLERR,"AMH_Go: Incorrect entery in gamma file");
     if (amh_go_gamma->error==amh_go_gamma->ERR_G_CLASS) error->all(FLERR,"AMH_Go: Wrong sequance separation class tag");
     if (amh_go_gamma->error==amh_go_gamma->ERR_ASSIGN) error->all(FLERR,"AMH_Go: Cannot build gamma array");
+    if (amh_go_gamma->fourResTypes()) error->all(FLERR,"AMH_Go: Gamma cannot depend on memory residue types");
 
     char amhgo_mem_file[] = "amh-go.gro";
-    m_amh_go = new Fragment_Memory(0, 0, n, 1.0, amhgo_mem_file);
-    if (m_amh_go->error==m_amh_go->ERR_FILE) error->all(FLERR,"Cannot read file amh-go.gro");
-    if (m_amh_go->error==m_amh_go->ERR_ATOM_COUNT) error->all(FLERR,"AMH_Go: Wrong atom count in memory structure file");
-    if (m_amh_go->error==m_amh_go->ERR_RES) error->all(FLERR,"AMH_Go: Unknown residue");
+    if (shm_flag) {
+      // the node leader reads the structure, the other ranks map its copy
+      m_amh_go = NULL;
+      ierr = Fragment_Memory::ERR_NONE;
+      if (shm_me==0) {
+        m_amh_go = new Fragment_Memory(0, 0, n, 1.0, amhgo_mem_file);
+        ierr = m_amh_go->error;
+      }
+    } else {
+      m_amh_go = new Fragment_Memory(0, 0, n, 1.0, amhgo_mem_file);
+      ierr = m_amh_go->error;
+    }
+    // the ranks, or the node leaders, read on their own, so agree on the
+    // error before error->all()
+    MPI_Allreduce(MPI_IN_PLACE, &ierr, 1, MPI_INT, MPI_MAX, world);
+    if (shm_flag && ierr==Fragment_Memory::ERR_NONE) share_mems(&m_amh_go, 1);
+    if (ierr==Fragment_Memory::ERR_FILE) error->all(FLERR,"Cannot read file amh-go.gro");
+    if (ierr==Fragment_Memory::ERR_ATOM_COUNT) error->all(FLERR,"AMH_Go: Wrong atom count in memory structure file");
+    if (ierr==Fragment_Memory::ERR_RES) error->all(FLERR,"AMH_Go: Unknown residue");
+
+    // censoring and DCA native distance tables are only needed to build the native pair list
+    int **censored = NULL;
+    double **rn_caca = NULL, **rn_cbcb = NULL, **rn_cacb = NULL;
 
     // if frustration censoring flag is 1, read in frustration censored interactions
     if (frustration_censoring_flag == 1) {
+      memory->create(censored,n,n,"backbone:frustration_censoring_map");
+      for (i=0;i<n;++i)
+        for (j=0;j<n;++j) censored[i][j] = 0;
       std::ifstream infile("frustration_censored_contacts.dat");
       while(infile >> i >> j) {
-	frustration_censoring_map[i-1][j-1] = 1;
+	if (i<1 || i>n || j<1 || j>n) error->all(FLERR,"frustration_censored_contacts.dat: residue index out of range");
+	censored[i-1][j-1] = 1;
       }
     }
 
     //if frustration censoring is 2, read in rnative distances for DCA predicted Go
     if (frustration_censoring_flag == 2) {
+      memory->create(rn_caca,n,n,"backbone:r_nativeCACA");
+      memory->create(rn_cbcb,n,n,"backbone:r_nativeCBCB");
+      memory->create(rn_cacb,n,n,"backbone:r_nativeCACB");
       std::ifstream in_rnativeCACA("go_rnativeCACA.dat");
       std::ifstream in_rnativeCBCB("go_rnativeCBCB.dat");
       std::ifstream in_rnativeCACB("go_rnativeCACB.dat");
       if (!in_rnativeCACA || !in_rnativeCACB || !in_rnativeCBCB) error->all(FLERR,"Go native distance file can't be read");
       for (i=0;i<n;++i) {
         for (j=0;j<n;++j) {
-          in_rnativeCACA >> r_nativeCACA[i][j];
-          in_rnativeCBCB >> r_nativeCBCB[i][j];
-          in_rnativeCACB >> r_nativeCACB[i][j];
+          in_rnativeCACA >> rn_caca[i][j];
+          in_rnativeCBCB >> rn_cbcb[i][j];
+          in_rnativeCACB >> rn_cacb[i][j];
         }
         if (in_rnativeCACA.eof() || in_rnativeCBCB.eof() || in_rnativeCACB.eof()) error->all(FLERR,"go_rnative*.dat file format error");
       }
@@ -738,12 +1023,27 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
     // this equivalent to having exp[-drsq/2*sigma_sq]=10^-6
     amh_go_pl_cutoff = amh_go_rc + pow(n, 0.15) + neighbor->skin;
 
-    // Calculate normalization factor for AMH-GO potential
-    compute_amhgo_normalization();
+    // Build the native pair list and the normalization factor for AMH-GO potential
+    setup_amh_go_pairs(censored, rn_caca, rn_cbcb, rn_cacb);
+
+    memory->destroy(censored);
+    memory->destroy(rn_caca);
+    memory->destroy(rn_cbcb);
+    memory->destroy(rn_cacb);
   }
 
 
-  if (fm_use_table_flag && file_exists("fm_table.energy") && file_exists("fm_table.force")) fm_read_table_flag = 1;
+  if (fm_compact_flag) {
+    if (!frag_mem_tb_flag) error->all(FLERR,"Fragment_Memory_Compact_Table requires Fragment_Memory_Table");
+    if (fmc_dr<=0.0) error->all(FLERR,"Fragment_Memory_Compact_Table: grid spacing must be positive");
+    fmc_size = (int)((tb_rmax-tb_rmin)/fmc_dr)+2;
+    // the compact table is always computed and never read from or written to files
+    if (fm_use_table_flag && comm->me==0) print_log("Compact FM table: ignoring FM table files\n");
+    fm_use_table_flag = 0;
+  }
+
+  if (fm_use_table_flag==2 && file_exists("fm_table.bin")) fm_read_table_flag = 1;
+  else if (fm_use_table_flag==1 && file_exists("fm_table.energy") && file_exists("fm_table.force")) fm_read_table_flag = 1;
   else fm_read_table_flag = 0;
 
   if (frag_mem_flag || frag_mem_tb_flag) {
@@ -759,7 +1059,8 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
 
       // read frag_mems_file and create a list of the fragments
       if (comm->me==0) print_log("Reading fragments...\n");
-      frag_mems = read_mems(frag_mems_file, n_frag_mems);
+      if (shm_flag) frag_mems = read_mems_shared(frag_mems_file, n_frag_mems);
+      else frag_mems = read_mems(frag_mems_file, n_frag_mems);
 
       // alocate frag_mem_map and ilen_fm_map
       ilen_fm_map = new int[n]; // Number of fragments for residue i
@@ -801,7 +1102,8 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
 
     if (comm->me==0) print_log("Reading decoy fragments...\n");
     // create a decoy memory array by reading in the appropriate file
-    decoy_mems = read_mems(decoy_mems_file, n_decoy_mems); // n_decoy_mems is set equal to the number of decoys in the read_mems function
+    if (shm_flag) decoy_mems = read_mems_shared(decoy_mems_file, n_decoy_mems);
+    else decoy_mems = read_mems(decoy_mems_file, n_decoy_mems); // n_decoy_mems is set equal to the number of decoys in the read_mems function
     // because the number of decoy calculations is set by the size of the decoy list in "read" mode, we need to initialize the variable here
     if (frag_frust_read_flag) {
       num_decoy_calcs = n_decoy_mems+1; // add one so that the "native" energy can occupy the 0 index
@@ -1001,13 +1303,20 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
     else
       tb_nbrs = n - fm_gamma->minSep();
 
-    fm_table = new TBV*[4*n*tb_nbrs];
+    if (fm_compact_flag) {
+      fm_table = NULL;
+    } else {
+      fm_table = new TBV*[4*n*tb_nbrs];
 
-    for (i=0; i<4*n*tb_nbrs; ++i) {
-      fm_table[i] = NULL;
+      for (i=0; i<4*n*tb_nbrs; ++i) {
+	fm_table[i] = NULL;
+      }
     }
 
-    if (fm_read_table_flag) {
+    if (fm_read_table_flag && fm_use_table_flag==2) {
+      if (comm->me==0) print_log("Mapping pre-computed binary FM table...\n");
+      map_fragment_memory_table();
+    } else if (fm_read_table_flag) {
       if (comm->me==0) print_log("Reading pre-computed FM table...\n");
       read_fragment_memory_table();
     } else {
@@ -1056,7 +1365,13 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
   if (helix_flag) pair_list_cutoff = MAX(pair_list_cutoff, calc_exp_helix_cutoff());
   if (helix_flag) pair_list_cutoff = MAX(pair_list_cutoff, helix_cutoff); // Potentially can be removed
   if (cont_rest_flag) pair_list_cutoff = MAX(pair_list_cutoff, sqrt(cr_glob_cutoff_sq));
-  if (huckel_flag) pair_list_cutoff = MAX(pair_list_cutoff, 2.0*screening_length/k_screening);
+  if (huckel_flag) {
+    if (dh_cutoff_flag) {
+      if (k_screening<=0.0 || dh_cutoff_factor<=0.0) error->all(FLERR,"DebyeHuckel_Cutoff: needs screening on and a positive cutoff");
+      dh_cutoff = dh_cutoff_factor*screening_length/k_screening;
+      pair_list_cutoff = MAX(pair_list_cutoff, dh_cutoff);
+    } else pair_list_cutoff = MAX(pair_list_cutoff, 2.0*screening_length/k_screening);
+  }
   if (ssb_flag) {
     cut = 0.0;
     if (ssb_rad_cor) 
@@ -1065,6 +1380,23 @@ FixBackbone::FixBackbone(LAMMPS *lmp, int narg, char **arg) :
     pair_list_cutoff = MAX(pair_list_cutoff, cut);
   }
 //  pair_list_cutoff += neighbor->skin;
+
+  // With [DebyeHuckel_Cutoff] Debye-Huckel is truncated at dh_cutoff and
+  // shifted so that energy and force vanish there. Without it the pairs are
+  // those whose CA atoms are within the neighbor list cutoff, as with the
+  // CA-CA neighbor list, see build_dh_list()
+  if (huckel_flag) {
+    dh_e_rc = dh_f_rc = 0.0;
+    if (dh_cutoff_flag) {
+      dh_cutoff_sq = dh_cutoff*dh_cutoff;
+      dh_e_rc = exp(-k_screening*dh_cutoff/screening_length)/dh_cutoff;
+      dh_f_rc = dh_e_rc*(1.0/dh_cutoff + k_screening/screening_length);
+      if (comm->me==0) {
+        if (screen) fprintf(screen, "Debye-Huckel cutoff %.4f\n", dh_cutoff);
+        if (logfile) fprintf(logfile, "Debye-Huckel cutoff %.4f\n", dh_cutoff);
+      }
+    }
+  }
   if (comm->me==0) {
     if (screen) fprintf(screen, "Fix backbone Pair List cutoff %.4f\n", pair_list_cutoff);
     if (logfile) fprintf(logfile, "Fix backbone Pair List cutoff %.4f\n", pair_list_cutoff);
@@ -1105,26 +1437,19 @@ double FixBackbone::calc_exp_helix_cutoff()
 
 void FixBackbone::read_contact_restraints_file() 
 {
-  ContactRestraintsPar *cr_pars=NULL;
-  int i, i1, i2, j1, j2;
+  int i, k, i1, i2, j1, j2;
   double ww, r0, r0_max;
-  int n_cont_rest;
-  int *n_t = new int[n];
 
   int cur_size = 0, block_size = 100;
   n_cont_rest = 0;
 
-  cr_map_n = new int[n];
-  cr_map = new ContactRestraintsPar*[n];
-  for (i=0;i<n;++i) cr_map_n[i] = 0;
-
   ifstream in_cl(cr_file);
   if (!in_cl) error->all(FLERR,"File for Contact Restraints potential doesn't exist");
   r0_max = 0.0;
   while (in_cl >> i1 >> i2 >> ww >> r0) {
     if (in_cl.eof()) error->all(FLERR,"Contact Restraints potential parameter file format error");
     if (n_cont_rest==cur_size) {
-        cur_size += block_size;
+        cur_size += MAX(block_size, cur_size);
         cr_pars = (ContactRestraintsPar *)realloc(cr_pars, cur_size * sizeof(ContactRestraintsPar));
         if (!cr_pars) 
           error->all(FLERR,"Memory allocation failed while reading Contact Restraints potential file");
@@ -1136,7 +1461,6 @@ void FixBackbone::read_contact_restraints_file()
     ww *= k_cont_rest;
     cr_pars[n_cont_rest] = ContactRestraintsPar(j1, j2, ww, r0);
     if (r0>r0_max) r0_max = r0;
-    cr_map_n[j1]++;
     n_cont_rest++;
   }
   in_cl.close();
@@ -1151,33 +1475,32 @@ void FixBackbone::read_contact_restraints_file()
     if (logfile) fprintf(logfile, "Contact Restraints potential global cutoff %.4f\n", r0_max + cr_dr_cutoff);
   }
 
-  for (i=0;i<n;++i) {
-    n_t[i] = 0;
-    if (cr_map_n[i]>0) cr_map[i] = new ContactRestraintsPar[cr_map_n[i]];
-    else cr_map[i] = NULL;
-  }
-
+  // Sort by (i1,i2) and keep one restraint per residue pair, as the
+  // lookup from the pair loop used to
+  if (n_cont_rest>1)
+    qsort(cr_pars,n_cont_rest,sizeof(ContactRestraintsPar), cmp_cr_pars);
+  k = 0;
   for (i=0;i<n_cont_rest;++i) {
-    i1 = cr_pars[i].i1;
-    cr_map[i1][n_t[i1]] = cr_pars[i];
-    n_t[i1]++;
+    if (k>0 && cr_pars[i].i1==cr_pars[k-1].i1 && cr_pars[i].i2==cr_pars[k-1].i2) continue;
+    cr_pars[k++] = cr_pars[i];
   }
+  n_cont_rest = k;
 
-  // Sort each residue map by i2
-  for (i=0;i<n;++i) {
-    if (cr_map_n[i]>1)
-      qsort(cr_map[i],cr_map_n[i],sizeof(ContactRestraintsPar), cmp_cr_map_i2);
-  }
+  cr_first = new int[n+1];
+  for (i=0;i<=n;++i) cr_first[i] = 0;
+  for (i=0;i<n_cont_rest;++i) cr_first[cr_pars[i].i1+1]++;
+  for (i=0;i<n;++i) cr_first[i+1] += cr_first[i];
 
-  free(cr_pars);
-  delete [] n_t;
+  cr_list = new int[MAX(n_cont_rest,1)];
 }
 
-int FixBackbone::cmp_cr_map_i2(const void *a, const void *b)
+int FixBackbone::cmp_cr_pars(const void *a, const void *b)
 {
   const struct ContactRestraintsPar *ia = (const struct ContactRestraintsPar *)a;
   const struct ContactRestraintsPar *ib = (const struct ContactRestraintsPar *)b;
 
+  if (ia->i1>ib->i1) return 1;
+  if (ia->i1<ib->i1) return -1;
   if (ia->i2>ib->i2) return 1;
   if (ia->i2<ib->i2) return -1;
   return 0;
@@ -1189,7 +1512,7 @@ void FixBackbone::final_log_output()
   int me,nprocs;
   double time, tmp;
 
-  char txt_timer[][20] = {"Chain", "Shake", "Chi", "Rama", "Vexcluded", "DSSP", "PAP", "Water", "Burial", "Helix", "AHM-Go", "Frag_Mem", "Vec_FM", "Membrane", "SSB", "DH", "Frust_Analysis", "Pair", "Pair_Double_Loop1", "Pair_Single_Loop", "Pair_Double_Loop2", "Pair_Double_Loop3", "Total"};
+  char txt_timer[][25] = {"Chain", "Shake", "Chi", "Rama", "Vexcluded", "DSSP", "PAP", "Water", "Burial", "Helix", "AHM-Go", "Frag_Mem", "Vec_FM", "Membrane", "SSB", "DH", "Frust_Analysis", "Pair", "Pair_Double_Loop1", "Pair_Single_Loop", "Pair_Double_Loop2", "Pair_Double_Loop3", "Threaded_Residue_Loop", "Total"};
 
   MPI_Comm_rank(world,&me);
   MPI_Comm_size(world,&nprocs);
@@ -1227,23 +1550,15 @@ FixBackbone::~FixBackbone()
   int i;
 
   if (allocated) {
-    for (i=0;i<n;i++) {
-      delete [] xca[i];
-      delete [] xcb[i];
-      delete [] xo[i];
-      delete [] xn[i];
-      delete [] xcp[i];
-      delete [] xh[i];
-    }
+    memory->sfree(site_arena);
 
     for (i=0;i<12;i++) delete [] aps[i];
+    if (rama_table) delete [] rama_table;
     
     if (cont_rest_flag) {
-      for (i=0;i<n;++i) {
-        delete [] cr_map[i];
-      }
-      delete [] cr_map_n;
-      delete [] cr_map;
+      free(cr_pars);
+      delete [] cr_first;
+      delete [] cr_list;
     }
 
     delete [] alpha_carbons;
@@ -1251,6 +1566,7 @@ FixBackbone::~FixBackbone()
     delete [] oxygens;
     delete [] res_no;
     delete [] res_no_l;
+    delete [] res_atom_map;
     delete [] res_info;
     delete [] chain_no;
     delete [] xca;
@@ -1262,6 +1578,9 @@ FixBackbone::~FixBackbone()
     delete [] se;
     delete [] mcso_se;
     delete [] z_res;
+    delete [] memb_kernel;
+    delete [] memb_tb_z;
+    delete [] memb_tb_u;
 
     if (p_ap_flag) {
       delete p_ap;
@@ -1269,32 +1588,16 @@ FixBackbone::~FixBackbone()
     delete R;
 
     if (amh_go_flag) {
-      for (i=0;i<3*n;i++) {
-	delete [] amh_go_force[i];
-      }
-
-      delete [] amh_go_force;
-      delete [] amh_go_force_map;
-
       delete m_amh_go;
       delete amh_go_gamma;
-      if (frustration_censoring_flag == 1) {
-        for (i=0;i<n;i++) {
-          delete [] frustration_censoring_map[i];
-        }
-        delete [] frustration_censoring_map;
-      }
 
-      if (frustration_censoring_flag == 2) {
-        for (i=0;i<n;i++) {
-          delete [] r_nativeCACA[i];
-          delete [] r_nativeCBCB[i];
-          delete [] r_nativeCACB[i];
-        }
-        delete [] r_nativeCACA;
-        delete [] r_nativeCBCB;
-        delete [] r_nativeCACB;
-      }
+      memory->destroy(amh_go_first);
+      memory->destroy(amh_go_site);
+      memory->destroy(amh_go_rn);
+      memory->destroy(amh_go_sigma_sq);
+      memory->destroy(amh_go_gm);
+      memory->destroy(amh_go_dE);
+      memory->destroy(amh_go_near);
     }
 
     if (frag_mem_flag || frag_mem_tb_flag) {
@@ -1311,10 +1614,25 @@ FixBackbone::~FixBackbone()
     }
   }
 
-  if (frag_mem_tb_flag) {
-    for (i=0; i<4*n*tb_nbrs; ++i) {
-      if (fm_table[i])
-	delete [] fm_table[i];
+  if (frag_mem_tb_flag && fm_compact_flag) {
+    delete [] fmc_row;
+    delete [] fmc_col;
+    delete [] fmc_slot;
+    if (!shm_flag) {
+      delete [] fmc_e;
+      delete [] fmc_d;
+      delete [] fmc_err;
+    }
+  } else if (frag_mem_tb_flag) {
+    if (fm_table_map) {
+      munmap(fm_table_map, fm_table_map_size);
+    } else if (fm_table_data) {
+      if (!shm_flag) delete [] fm_table_data;
+    } else {
+      for (i=0; i<4*n*tb_nbrs; ++i) {
+	if (fm_table[i])
+	  delete [] fm_table[i];
+      }
     }
     delete [] fm_table;
   }
@@ -1392,6 +1710,8 @@ FixBackbone::~FixBackbone()
 
   if (huckel_flag) {
     delete[] charge_on_residue;
+    delete[] dh_res;
+    memory->sfree(dh_pairs);
   }
 
   if (comm->me==0) {
@@ -1425,10 +1745,41 @@ FixBackbone::~FixBackbone()
     delete [] b_water_xi;
     delete [] burial_force;
     delete [] b_burial_force;
+    delete [] fm_sigma_sq_sep;
+    delete [] amh_go_sigma_sq_sep;
 
     delete [] loc_water_xi;
     delete [] water_xi;
   }
+
+  if (nthreads>1) {
+    for (i=0;i<nthreads;++i) {
+      memory->destroy(thr_f[i]);
+      delete [] thr_energy[i];
+    }
+    delete [] thr_f;
+    delete [] thr_energy;
+  }
+
+  memory->destroy(atom_dens);
+  memory->sfree(active_pairs);
+  memory->sfree(dssp_pairs);
+  memory->sfree(helix_pairs);
+  memory->sfree(pap_pairs);
+
+  delete [] fm_list_start;
+  memory->destroy(fm_list_j);
+  memory->destroy(fm_list_sites);
+  memory->destroy(fm_list_rf);
+  memory->destroy(fm_list_inv2sigsq);
+  memory->destroy(fm_list_eps);
+
+  // shared segments go last, after every view into them was deleted
+  if (shm_flag) {
+    for (i=0;i<n_shm_win;++i) MPI_Win_free(&shm_win[i]);
+    if (shm_leader_comm!=MPI_COMM_NULL) MPI_Comm_free(&shm_leader_comm);
+    MPI_Comm_free(&shm_comm);
+  }
 }
 
 void FixBackbone::allocate()
@@ -1440,11 +1791,13 @@ void FixBackbone::allocate()
   oxygens = new int[n];
   res_no = new int[n];
   res_no_l = new int[n];
+  res_atom_map = new int[3*n];
   res_info = new int[n];
   chain_no = new int[n];
   se = new char[n+2];
   mcso_se = new char[n+2];
   z_res = new int[n+2];
+  memb_kernel = new int[n];
   // Add dynamic allocation of other seq arrays
 
   xca = new double*[n];
@@ -1456,34 +1809,42 @@ void FixBackbone::allocate()
 
   if (huckel_flag) {
     charge_on_residue = new double[n];
+    dh_res = new int[n];
   }
 
   if (water_flag) {
     water_par = WPV(water_kappa, water_kappa_sigma, treshold, n_wells, well_flag, well_r_min, well_r_max);
-    well = new cWell<double, FixBackbone>(n, n, n_wells, water_par, &ntimestep, this);
+    well = new cWell<double, FixBackbone>(n, n, n_wells, water_par, &cache_stamp, this);
   }
 
   if (helix_flag) {
     helix_par = WPV(helix_kappa, helix_kappa_sigma, helix_treshold, n_helix_wells, helix_well_flag, helix_well_r_min, helix_well_r_max);
-    helix_well = new cWell<double, FixBackbone>(n, n, n_helix_wells, helix_par, &ntimestep, this);
+    helix_well = new cWell<double, FixBackbone>(n, n, n_helix_wells, helix_par, &cache_stamp, this);
   }
 
   if (p_ap_flag) {
-    p_ap = new cP_AP<double, FixBackbone>(n, n, &ntimestep, this);
+    p_ap = new cP_AP<double, FixBackbone>(n, n, &cache_stamp, this);
   }
 
-  R = new cR<double, FixBackbone>(n, n, &ntimestep, this);
+  R = new cR<double, FixBackbone>(n, n, &cache_stamp, this);
+
+  // All six site arrays share one aligned arena: each site type is a packed
+  // [n][3] block padded to a cache line, and xca[i] etc. point into it
+  site_stride = 3*n;
+  if (site_stride%8!=0) site_stride += 8 - site_stride%8;
+  site_arena = (double *) memory->smalloc((bigint)nSites*site_stride*sizeof(double),"backbone:site_arena");
+  for (i = 0; i < nSites*site_stride; ++i) site_arena[i] = 0.0;
 
   for (i = 0; i < n; ++i) {
     // Ca, Cb and O coordinates
-    xca[i] = new double [3];
-    xcb[i] = new double [3];
-    xo[i] = new double [3];
+    xca[i] = site_arena + SITE_CA*site_stride + 3*i;
+    xcb[i] = site_arena + SITE_CB*site_stride + 3*i;
+    xo[i] = site_arena + SITE_O*site_stride + 3*i;
 
     // Nitrogen and C prime coordinates
-    xn[i] = new double [3];
-    xcp[i] = new double [3];
-    xh[i] = new double [3];
+    xn[i] = site_arena + SITE_N*site_stride + 3*i;
+    xcp[i] = site_arena + SITE_CP*site_stride + 3*i;
+    xh[i] = site_arena + SITE_H*site_stride + 3*i;
 
     if (huckel_flag) {
       charge_on_residue[i] = 0.0;
@@ -1505,35 +1866,7 @@ void FixBackbone::allocate()
   xh[0][2] = 0;
 
   if (amh_go_flag) {
-    amh_go_force = new double*[3*n];
-    amh_go_force_map = new int[3*n];
-    for (int i=0;i<3*n;i++) {
-      amh_go_force[i] = new double[3];
-    }
     amh_go_norm = new double[nch];
-
-    // if frustration censoring is on, allocate the frustration_censoring_map table
-    if (frustration_censoring_flag == 1){
-      frustration_censoring_map = new int*[n];
-      for (int i=0;i<n;i++) {
-        frustration_censoring_map[i] = new int[n];
-        for (int j=0;j<n;j++) {
-          frustration_censoring_map[i][j] = 0;
-        }
-      }
-    }
-
-    //if DCA-Go mode is on, allocate the r_native matrices
-    if (frustration_censoring_flag == 2){
-      r_nativeCACA = new double*[n];
-      r_nativeCBCB = new double*[n];
-      r_nativeCACB = new double*[n];
-      for (int i=0;i<n;i++) {
-        r_nativeCACA[i] = new double[n];
-        r_nativeCBCB[i] = new double[n];
-        r_nativeCACB[i] = new double[n];
-      }
-    }
   }
 
   loc_water_ro = new double[n];
@@ -1558,6 +1891,14 @@ void FixBackbone::allocate()
   burial_force = new double[n];
   b_burial_force = new bool[n];
 
+  // Gaussian widths only depend on the sequence separation
+  fm_sigma_sq_sep = new double[n];
+  amh_go_sigma_sq_sep = new double[n];
+  for (i=0;i<n;++i) {
+    fm_sigma_sq_sep[i] = pow(i, 2*fm_sigma_exp);
+    amh_go_sigma_sq_sep[i] = pow(i, 0.3);
+  }
+
 //  for (int i_well=0;i_well<n_wells;++i_well) {
 //    loc_water_xi[i_well] = new double[n];
 //    water_xi[i_well] = new double[n];
@@ -1582,6 +1923,11 @@ inline bool FixBackbone::isLast(int index)
   return false;
 }
 
+inline bool FixBackbone::isOuterLevel()
+{
+  return (respa_ilevel<0 || respa_ilevel==nlevels_respa-1);
+}
+
 int FixBackbone::Tag(int index) {
   if (index==-1) return -1;
   return atom->tag[index];
@@ -1595,48 +1941,46 @@ inline void FixBackbone::Construct_Computational_Arrays()
   tagint *mol_tag = atom->molecule;
   tagint *res_tag = atom->residue;
 
-  int i;
+  int i, j, k, amin, *jm;
+  int bits[3] = {groupbit, group2bit, group3bit};
+  int max_tag[3] = {0, 0, 0};
+
   for (i=0; i<n; ++i){
   	res_no_l[i] =-1;
         res_info[i] = OFF;
 	chain_no[i] = -1;
   }
 
-  // Creating index arrays for Alpha_Carbons, Beta_Atoms and Oxygens
-  nn = 0;
-  int last = 0;
-  for (i = 0; i < n; ++i) {
-    int min[3] = {-1, -1, -1}, jm[3] = {-1, -1, -1}, amin = -1;
-    for (int j = 0; j < nall; ++j) {
-      if (i==0 && res_tag[j]<=0 && (mask[j] & groupbit || mask[j] & group2bit || mask[j] & group3bit) )
-	error->all(FLERR,"Molecular tag must be positive in fix backbone");
-
-      if ( (mask[j] & groupbit) && res_tag[j]>last ) {
-	if (res_tag[j]<min[0] || min[0]==-1) {
-	  min[0] = res_tag[j];
-	  jm[0] = j;
-	}
-      }
-      if ( (mask[j] & group2bit) && res_tag[j]>last ) {
-	if (res_tag[j]<min[1] || min[1]==-1) {
-	  min[1] = res_tag[j];
-	  jm[1] = j;
-	}
-      }
-      if ( (mask[j] & group3bit) && res_tag[j]>last ) {
-	if (res_tag[j]<min[2] || min[2]==-1) {
-	  min[2] = res_tag[j];
-	  jm[2] = j;
-	}
+  // Bucket CA, CB and O atoms by residue tag in a single pass over local and ghost atoms.
+  // The first (lowest index) atom of each tag is kept, so local atoms win over ghost images.
+  for (i=0; i<3*n; ++i) res_atom_map[i] = -1;
+
+  for (j = 0; j < nall; ++j) {
+    if ( !(mask[j] & groupbit || mask[j] & group2bit || mask[j] & group3bit) ) continue;
+
+    if (res_tag[j]<=0)
+      error->all(FLERR,"Molecular tag must be positive in fix backbone");
+    if (res_tag[j]>n)
+      error->all(FLERR,"Residue tag is out of range");
+
+    jm = res_atom_map + 3*(res_tag[j]-1);
+    for (k=0; k<3; ++k) {
+      if (mask[j] & bits[k]) {
+        if (jm[k]==-1) jm[k] = j;
+        if (res_tag[j]>max_tag[k]) max_tag[k] = res_tag[j];
       }
     }
+  }
 
-    amin = MIN(min[0], MIN(min[1], min[2]));
-    if (amin==-1) break;
+  // Creating index arrays for Alpha_Carbons, Beta_Atoms and Oxygens
+  nn = 0;
+  for (i = 0; i < n; ++i) {
+    jm = res_atom_map + 3*i;
+    if (jm[0]==-1 && jm[1]==-1 && jm[2]==-1) continue;
 
-    if (min[0]!=amin) jm[0] = -1;
-    if (min[1]!=amin) jm[1] = -1;
-    if (min[2]!=amin) jm[2] = -1;
+    // stop once one of the groups has no atoms left at or beyond this residue
+    amin = i+1;
+    if (amin>max_tag[0] || amin>max_tag[1] || amin>max_tag[2]) break;
 
     alpha_carbons[nn] = jm[0];
     beta_atoms[nn] = jm[1];
@@ -1661,7 +2005,6 @@ inline void FixBackbone::Construct_Computational_Arrays()
     if ( res_no[nn]<ch_pos[chain_no[nn]-1] || res_no[nn]>ch_pos[chain_no[nn]-1]+ch_len[chain_no[nn]-1]-1 )
 	error->all(FLERR,"Residue tag is out of range");
 
-    last = amin;
     nn++;
   }
 
@@ -1799,19 +2142,24 @@ void FixBackbone::init()
   avec = dynamic_cast<AtomVecAWSEM*>(atom->style_match("awsemmd"));
   if (!avec) error->all(FLERR,"Fix backbone requires atom style awsemmd");
 
-  if (utils::strmatch(update->integrate_style,"^respa"))
+  if (utils::strmatch(update->integrate_style,"^respa")) {
     nlevels_respa = (dynamic_cast<Respa *>(update->integrate))->nlevels;
 
+    for (int k=0;k<nEnergyTerms;++k) {
+      if (respa_level[k]>=nlevels_respa) error->all(FLERR,"Respa_Levels: level exceeds the number of rRESPA levels");
+      respa_term_level[k] = (respa_level[k]<0 ? nlevels_respa-1 : respa_level[k]);
+      for (int l=0;l<3;++l) respa_switch_on[k][l] = (respa_switch[k][l] ? *respa_switch[k][l] : false);
+    }
+
+    // burial uses the water densities computed with the water term
+    if (water_flag && burial_flag && respa_term_level[ET_WATER]!=respa_term_level[ET_BURIAL])
+      error->all(FLERR,"Respa_Levels: Water and Burial must be on the same rRESPA level");
+  }
+
   auto req = neighbor->add_request(this, NeighConst::REQ_DEFAULT);
   req->set_id(1);
   req->set_cutoff(pair_list_cutoff);
 
-  if (amh_go_flag) {
-    auto reqfull = neighbor->add_request(this, NeighConst::REQ_FULL);
-    reqfull->set_id(2);
-    reqfull->set_cutoff(pair_list_cutoff);
-  }
-
     double cutghost;            // as computed by Neighbor and Comm
     if (force->pair)
       cutghost = MAX(force->pair->cutforce+neighbor->skin,comm->cutghostuser);
@@ -1827,7 +2175,6 @@ void FixBackbone::init()
 void FixBackbone::init_list(int id, NeighList *ptr)
 {
   if (id == 1) list = ptr;
-  else if (id == 2) listfull = ptr;
 }
 
 /* ---------------------------------------------------------------------- */
@@ -1837,9 +2184,13 @@ void FixBackbone::setup(int vflag)
   if (utils::strmatch(update->integrate_style, "^verlet"))
     pre_force(vflag);
   else {
-    (dynamic_cast<Respa *>(update->integrate))->copy_flevel_f(nlevels_respa-1);
-    pre_force_respa(vflag,nlevels_respa-1,0);
-    (dynamic_cast<Respa *>(update->integrate))->copy_f_flevel(nlevels_respa-1);
+    Respa *respa = dynamic_cast<Respa *>(update->integrate);
+    for (int ilevel=0;ilevel<nlevels_respa;++ilevel) {
+      if (!respa_flag && ilevel!=nlevels_respa-1) continue;
+      respa->copy_flevel_f(ilevel);
+      pre_force_respa(vflag,ilevel,0);
+      respa->copy_f_flevel(ilevel);
+    }
   }
 }
 
@@ -1877,6 +2228,193 @@ void FixBackbone::setup_pre_force_respa(int vflag, int ilevel)
 void FixBackbone::post_neighbor()
 {
   Construct_Computational_Arrays();
+
+  // cR and cP_AP are keyed by local residue indices, which change here
+  if (p_ap_flag) p_ap->reset();
+  R->reset();
+
+  rebuild_active_pairs = true;
+  memb_resort = 1;
+
+  if (huckel_flag) build_dh_list();
+  if (cont_rest_flag) build_cr_list();
+  if (amh_go_flag) build_amh_go_near();
+  if (chi_flag || frag_mem_flag || vec_frag_mem_flag || frag_mem_tb_flag) check_residue_partners();
+}
+
+/* ---------------------------------------------------------------------- */
+
+// Compact the density atom pairs (CB, or CA for glycine) of the neighbor
+// list that take part in the water, burial and helix density terms.
+// compute_pair() refreshes their distances and well values once per step
+// and streams this buffer instead of re-filtering the neighbor list.
+void FixBackbone::build_active_pairs()
+{
+  int i, j, ii, jj, jnum, ires, jres;
+  int *jlist;
+  tagint *molecule = atom->molecule;
+  tagint *residue = atom->residue;
+  ActivePair *ap;
+
+  rebuild_active_pairs = false;
+  n_active = 0;
+  if (!list) return;
+
+  for (ii = 0; ii < list->inum; ii++) {
+    i = list->ilist[ii];
+    if (!isDensityAtom(i)) continue;
+    ires = residue[i]-1;
+
+    jlist = list->firstneigh[i];
+    jnum = list->numneigh[i];
+
+    for (jj = 0; jj < jnum; jj++) {
+      j = jlist[jj] & NEIGHMASK;
+      if (!isDensityAtom(j)) continue;
+      jres = residue[j]-1;
+
+      if (molecule[i]==molecule[j] && abs(ires-jres)<=1) continue;
+
+      if (n_active==max_active) {
+        max_active += DELTA_ACTIVE;
+        active_pairs = (ActivePair *) memory->srealloc(active_pairs,max_active*sizeof(ActivePair),"backbone:active_pairs");
+      }
+
+      ap = &active_pairs[n_active++];
+      ap->i = i;
+      ap->j = j;
+      ap->ires = ires;
+      ap->jres = jres;
+      ap->contact = (molecule[i]!=molecule[j] || abs(ires-jres)>=contact_cutoff);
+    }
+  }
+}
+
+void FixBackbone::add_hbond_pair(HBondPair *&pairs, int &npairs, int &maxpairs, int i, int j)
+{
+  if (npairs==maxpairs) {
+    maxpairs += DELTA_ACTIVE;
+    pairs = (HBondPair *) memory->srealloc(pairs,maxpairs*sizeof(HBondPair),"backbone:hbond_pairs");
+  }
+  pairs[npairs].i = i;
+  pairs[npairs].j = j;
+  npairs++;
+}
+
+// Collect the O(i)-N(j) pairs that can come within the DSSP or helix cutoff
+// before the next reneighboring. The DSSP candidates are the O-CA pairs of
+// the neighbor list that pass the sequence and atom checks of compute_pair(),
+// the helix candidates the i->i+helix_i_diff pairs of local oxygens. The
+// P_AP candidates are the CA-CA pairs of the neighbor list.
+void FixBackbone::build_hbond_pairs()
+{
+  int i, j, k, ii, jj, jnum, a, d, il, jl, kl, ires, jres;
+  int *jlist;
+  int *mask = atom->mask;
+  int nlocal = atom->nlocal;
+  tagint *molecule = atom->molecule;
+  tagint *residue = atom->residue;
+  double dx[3], pad, cutsq;
+
+  n_dssp_pairs = n_helix_pairs = n_pap_pairs = 0;
+  if (!list) return;
+
+  // O moves by at most skin/2 between reneighborings and N, a combination
+  // of CA(i-1), CA(i) and O(i-1), by at most (|an|+|bn|+|cn|)*skin/2
+  pad = 0.5*neighbor->skin*(1.0 + fabs(an) + fabs(bn) + fabs(cn));
+
+  if (dssp_hdrgn_flag) {
+    cutsq = (dssp_hdrgn_cut+pad)*(dssp_hdrgn_cut+pad);
+
+    for (ii = 0; ii < list->inum; ii++) {
+      i = list->ilist[ii];
+      if ( !(mask[i]&groupbit || mask[i]&group3bit) ) continue;
+
+      jlist = list->firstneigh[i];
+      jnum = list->numneigh[i];
+
+      for (jj = 0; jj < jnum; jj++) {
+        j = jlist[jj] & NEIGHMASK;
+
+        // either atom can be the O acceptor a, the other the CA of donor d
+        for (k=0;k<2;++k) {
+          a = (k==0 ? i : j);
+          d = (k==0 ? j : i);
+          if ( !(mask[a]&group3bit && mask[d]&groupbit) ) continue;
+
+          ires = residue[a]-1;
+          jres = residue[d]-1;
+          il = res_no_l[ires];
+          jl = res_no_l[jres];
+
+          if ( molecule[a]==molecule[d] && abs(jres-ires)<=2 ) continue;
+          if ( se[jres]=='P' || isLast(il) || isFirst(jl) ) continue;
+
+          kl = (jres>0 ? res_no_l[jres-1] : -1);
+          if (kl==-1 || oxygens[kl]==-1 || alpha_carbons[kl]==-1) continue;
+
+          dx[0] = xo[il][0] - xn[jl][0];
+          dx[1] = xo[il][1] - xn[jl][1];
+          dx[2] = xo[il][2] - xn[jl][2];
+
+          if (dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2] < cutsq)
+            add_hbond_pair(dssp_pairs, n_dssp_pairs, max_dssp_pairs, il, jl);
+        }
+      }
+    }
+  }
+
+  if (helix_flag) {
+    cutsq = (helix_cutoff+pad)*(helix_cutoff+pad);
+
+    for (i = 0; i < nlocal; i++) {
+      if ( !(mask[i]&group3bit) ) continue;
+
+      ires = residue[i]-1;
+      il = res_no_l[ires];
+      if (ires+helix_i_diff>=n || res_no_l[ires+helix_i_diff]==-1) continue;
+      jl = res_no_l[ires+helix_i_diff];
+
+      if (molecule[i]==chain_no[jl] && (res_info[jl]==LOCAL || res_info[jl]==GHOST) && (res_info[jl-1]==LOCAL || res_info[jl-1]==GHOST) && res_no[jl-1]-1==ires+helix_i_diff-1) {
+
+        dx[0] = xo[il][0] - xn[jl][0];
+        dx[1] = xo[il][1] - xn[jl][1];
+        dx[2] = xo[il][2] - xn[jl][2];
+
+        if (dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2] < cutsq)
+          add_hbond_pair(helix_pairs, n_helix_pairs, max_helix_pairs, il, jl);
+      }
+    }
+  }
+
+  if (p_ap_flag) {
+    cutsq = pow(sqrt(pap_cutoff_sq)+neighbor->skin, 2);
+
+    for (ii = 0; ii < list->inum; ii++) {
+      i = list->ilist[ii];
+      if ( !(mask[i]&groupbit) ) continue;
+
+      jlist = list->firstneigh[i];
+      jnum = list->numneigh[i];
+
+      for (jj = 0; jj < jnum; jj++) {
+        j = jlist[jj] & NEIGHMASK;
+        if ( !(mask[j]&groupbit) ) continue;
+
+        ires = residue[i]-1;
+        jres = residue[j]-1;
+        il = res_no_l[MIN(ires,jres)];
+        jl = res_no_l[MAX(ires,jres)];
+
+        dx[0] = xca[il][0] - xca[jl][0];
+        dx[1] = xca[il][1] - xca[jl][1];
+        dx[2] = xca[il][2] - xca[jl][2];
+
+        if (dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2] < cutsq)
+          add_hbond_pair(pap_pairs, n_pap_pairs, max_pap_pairs, il, jl);
+      }
+    }
+  }
 }
 
 /* ---------------------------------------------------------------------- */
@@ -1963,19 +2501,32 @@ inline bool FixBackbone::file_exists (const char *name) {
     return f.good();
 }
 
+// Read a memory file, either a text .mem file or a library compiled by
+// tools/frag_mem_tools/compile_frag_library. Each structure file referenced
+// by a text .mem file is parsed only once.
 Fragment_Memory **FixBackbone::read_mems(char *mems_file, int &n_mems)
 {
   int file_state, nstr;
   int tpos, fpos, len;
   double weight;
-  char ln[500], *line, *str[10];
+  char ln[500], *line, *str[10], magic[8];
   FILE *file;
   Fragment_Memory **mems_array = NULL;
+  Fragment_Structure *fs;
+  map<string, Fragment_Structure *> fs_cache;
+  map<string, Fragment_Structure *>::iterator it;
 
   enum File_States{FS_NONE=0, FS_TARGET, FS_MEMS};
 
   file = fopen(mems_file,"r");
-  if (!file) error->all(FLERR,"Fragment_Memory: Error opening mem file");
+  if (!file) read_error(FLERR,"Fragment_Memory: Error opening mem file");
+
+  if (fread(magic, sizeof(char), 8, file)==8 && memcmp(magic, FM_LIBRARY_MAGIC, 8)==0) {
+    mems_array = read_mems_library(file, n_mems);
+    fclose(file);
+    return mems_array;
+  }
+  rewind(file);
 
   n_mems = 0;
   file_state = FS_NONE;
@@ -1995,27 +2546,35 @@ Fragment_Memory **FixBackbone::read_mems(char *mems_file, int &n_mems)
         if (nstr>5) break;
         str[nstr] = strtok(NULL," \t\n");
       }
-      if (nstr!=5) error->all(FLERR,"Fragment_Memory: Error reading mem file");
+      if (nstr!=5) read_error(FLERR,"Fragment_Memory: Error reading mem file");
 
       tpos = atoi(str[1])-1;
       fpos = atoi(str[2])-1;
       len = atoi(str[3]);
       weight = atof(str[4]);
 
+      it = fs_cache.find(str[0]);
+      if (it!=fs_cache.end()) {
+        fs = it->second;
+      } else {
+        fs = new Fragment_Structure(str[0]);
+        fs_cache[str[0]] = fs;
+      }
+
       n_mems++;
       mems_array = (Fragment_Memory **) memory->srealloc(mems_array,n_mems*sizeof(Fragment_Memory *),"modify:mems_array");
-      mems_array[n_mems-1] = new Fragment_Memory(tpos, fpos, len, weight, str[0], vec_frag_mem_flag);
+      mems_array[n_mems-1] = new Fragment_Memory(tpos, fpos, len, weight, fs, str[0], vec_frag_mem_flag);
 
       if (mems_array[n_mems-1]->error!=Fragment_Memory::ERR_NONE) {
         if (comm->me==0) {
           if (screen) fprintf(screen, "Error reading %s file!\n", str[0]);
           if (logfile) fprintf(logfile, "Error reading %s file!\n", str[0]);
         }
-        error->all(FLERR,"read_mems: Fragment_Memory: Error reading memory fragment");
+        read_error(FLERR,"read_mems: Fragment_Memory: Error reading memory fragment");
       }
-      if (mems_array[n_mems-1]->error==Fragment_Memory::ERR_FILE) error->all(FLERR,"Fragment_Memory: Cannot read the file");
-      if (mems_array[n_mems-1]->error==Fragment_Memory::ERR_ATOM_COUNT) error->all(FLERR,"Fragment_Memory: Wrong atom count in memory structure file");
-      if (mems_array[n_mems-1]->error==Fragment_Memory::ERR_RES) error->all(FLERR,"Fragment_Memory: Unknown residue");
+      if (mems_array[n_mems-1]->error==Fragment_Memory::ERR_FILE) read_error(FLERR,"Fragment_Memory: Cannot read the file");
+      if (mems_array[n_mems-1]->error==Fragment_Memory::ERR_ATOM_COUNT) read_error(FLERR,"Fragment_Memory: Wrong atom count in memory structure file");
+      if (mems_array[n_mems-1]->error==Fragment_Memory::ERR_RES) read_error(FLERR,"Fragment_Memory: Unknown residue");
 
       if (mems_array[n_mems-1]->pos+mems_array[n_mems-1]->len>n) {
         if (comm->me==0) {
@@ -2023,7 +2582,7 @@ Fragment_Memory **FixBackbone::read_mems(char *mems_file, int &n_mems)
           if (logfile) fprintf(logfile, "Error reading %s file!\n", str[0]);
         }
         fprintf(stderr, "pos %d len %d n %d\n", mems_array[n_mems-1]->pos, mems_array[n_mems-1]->len, n);
-      	error->all(FLERR,"read_mems: Fragment_Memory: Incorrectly defined memory fragment");
+      	read_error(FLERR,"read_mems: Fragment_Memory: Incorrectly defined memory fragment");
       }
 
       break;
@@ -2038,56 +2597,343 @@ Fragment_Memory **FixBackbone::read_mems(char *mems_file, int &n_mems)
 
   fclose(file);
 
+  for (it=fs_cache.begin();it!=fs_cache.end();++it) delete it->second;
+
   return mems_array;
 }
 
-inline void FixBackbone::timerBegin()
+// With Shared_Memory only the node leaders read fragment files, so errors
+// must not wait for the other ranks
+void FixBackbone::read_error(const char *file, int line, const char *str)
 {
-  // uncomment if want synchronized timing
-  // MPI_Barrier(world);
-  previous_time = MPI_Wtime();
+  if (shm_reading) error->one(file, line, str);
+  error->all(file, line, str);
 }
 
-inline void FixBackbone::timerEnd(int which)
+// The node leader reads the memories and every rank of the node, the leader
+// included, builds views of one copy in a shared segment
+Fragment_Memory **FixBackbone::read_mems_shared(char *mems_file, int &n_mems)
 {
-  // uncomment if want synchronized timing
-  // MPI_Barrier(world);
-  double current_time = MPI_Wtime();
-  ctime[which] += current_time - previous_time;
-  previous_time = current_time;
-}
+  Fragment_Memory **mems_array = NULL;
 
-/* ---------------------------------------------------------------------- */
+  if (shm_me==0) {
+    shm_reading = true;
+    mems_array = read_mems(mems_file, n_mems);
+    shm_reading = false;
+  }
+  MPI_Bcast(&n_mems, 1, MPI_INT, 0, shm_comm);
+  if (shm_me!=0)
+    mems_array = (Fragment_Memory **) memory->smalloc(MAX(n_mems,1)*sizeof(Fragment_Memory *),"modify:mems_array");
 
-void FixBackbone::compute_chain_potential(int i)
-{
-  double dx[3], r, dr, force;
+  share_mems(mems_array, n_mems);
 
-  int i_resno = res_no[i]-1;
-  int ip1, im1;
-  int im1_resno;
+  return mems_array;
+}
 
-  // N(i) - Cb(i)
-  tagint *res_tag = atom->residue;
-  if (!isFirst(i) && se[i_resno]!='G') {
-    im1 = res_no_l[i_resno-1];
-    im1_resno = res_no[im1]-1;
-    if (im1!=-1 && (res_info[im1]==LOCAL || res_info[im1]==GHOST)){
-      dx[0] = xn[i][0] - xcb[i][0];
-      dx[1] = xn[i][1] - xcb[i][1];
-      dx[2] = xn[i][2] - xcb[i][2];
-      r = sqrt(dx[0]*dx[0]+dx[1]*dx[1]+dx[2]*dx[2]);
-      dr = r - r_ncb0;
-      force = 2*k_chain[0]*dr/r;
+// Replace the node leader's memories by views of a shared copy; on the other
+// ranks the entries of mems are filled in
+void FixBackbone::share_mems(Fragment_Memory **mems, int n_mems)
+{
+  int i, iwin;
+  size_t nbytes, offset;
+  char *image;
 
-      energy[ET_CHAIN] += k_chain[0]*dr*dr;
+  nbytes = 0;
+  if (shm_me==0)
+    for (i=0;i<n_mems;++i) nbytes += mems[i]->image_size();
 
-      f[alpha_carbons[im1]][0] -= an*dx[0]*force;
-      f[alpha_carbons[im1]][1] -= an*dx[1]*force;
-      f[alpha_carbons[im1]][2] -= an*dx[2]*force;
+  image = (char *) shm_allocate(nbytes, iwin);
 
-      f[oxygens[im1]][0] -= cn*dx[0]*force;
-      f[oxygens[im1]][1] -= cn*dx[1]*force;
+  if (shm_me==0) {
+    offset = 0;
+    for (i=0;i<n_mems;++i) {
+      mems[i]->write_image(image+offset);
+      offset += mems[i]->image_size();
+      delete mems[i];
+    }
+  }
+  shm_sync(iwin);
+
+  offset = 0;
+  for (i=0;i<n_mems;++i) {
+    mems[i] = new Fragment_Memory(image+offset);
+    offset += mems[i]->image_size();
+  }
+}
+
+// Allocate a segment shared by the ranks of a node. Only the node leader
+// provides memory, the other ranks map the leader's part. Returns the window
+// index in iwin; the segment is released in the destructor.
+void *FixBackbone::shm_allocate(size_t nbytes, int &iwin)
+{
+  int disp_unit;
+  MPI_Aint size;
+  void *base;
+
+  if (n_shm_win==MAX_SHM_WIN) error->all(FLERR,"Shared_Memory: too many shared segments");
+
+  iwin = n_shm_win++;
+  MPI_Win_allocate_shared((shm_me==0 ? (MPI_Aint)nbytes : 0), 8, MPI_INFO_NULL, shm_comm, &base, &shm_win[iwin]);
+  MPI_Win_shared_query(shm_win[iwin], 0, &size, &disp_unit, &base);
+  MPI_Win_fence(0, shm_win[iwin]);
+
+  return base;
+}
+
+// Make the writes of all node ranks to segment iwin visible to each other
+void FixBackbone::shm_sync(int iwin)
+{
+  MPI_Win_fence(0, shm_win[iwin]);
+}
+
+// Load a compiled fragment library in one sequential pass; the magic has
+// already been read from file
+Fragment_Memory **FixBackbone::read_mems_library(FILE *file, int &n_mems)
+{
+  int i, hdr[3];
+  Fragment_Memory **mems_array;
+
+  if (fread(hdr, sizeof(int), 3, file)!=3) read_error(FLERR,"Fragment_Memory: Error reading fragment library header");
+  if (hdr[0]!=FM_LIBRARY_VERSION) read_error(FLERR,"Fragment_Memory: Unsupported fragment library version");
+  if (vec_frag_mem_flag && !hdr[2]) read_error(FLERR,"Fragment_Memory: Fragment library was compiled without vector fragment memory data");
+
+  n_mems = hdr[1];
+  mems_array = (Fragment_Memory **) memory->smalloc(MAX(n_mems,1)*sizeof(Fragment_Memory *),"modify:mems_array");
+
+  for (i=0;i<n_mems;++i) {
+    mems_array[i] = new Fragment_Memory(file);
+    if (mems_array[i]->error!=Fragment_Memory::ERR_NONE) read_error(FLERR,"Fragment_Memory: Error reading fragment library");
+
+    if (mems_array[i]->pos+mems_array[i]->len>n) {
+      if (comm->me==0) {
+        if (screen) fprintf(screen, "Error reading memory %d of the fragment library!\n", i+1);
+        if (logfile) fprintf(logfile, "Error reading memory %d of the fragment library!\n", i+1);
+      }
+      read_error(FLERR,"read_mems: Fragment_Memory: Incorrectly defined memory fragment");
+    }
+  }
+
+  return mems_array;
+}
+
+inline void FixBackbone::timerBegin()
+{
+#if defined(_OPENMP)
+  // per-term timers are not tracked inside threaded loops
+  if (omp_in_parallel()) return;
+#endif
+  // uncomment if want synchronized timing
+  // MPI_Barrier(world);
+  previous_time = MPI_Wtime();
+}
+
+inline void FixBackbone::timerEnd(int which)
+{
+#if defined(_OPENMP)
+  if (omp_in_parallel()) return;
+#endif
+  // uncomment if want synchronized timing
+  // MPI_Barrier(world);
+  double current_time = MPI_Wtime();
+  ctime[which] += current_time - previous_time;
+  previous_time = current_time;
+}
+
+// Force and energy arrays the current thread should accumulate into.
+// Outside of an active parallel region these are atom->f and energy.
+inline double **FixBackbone::force_buffer()
+{
+#if defined(_OPENMP)
+  if (omp_in_parallel()) return thr_f[omp_get_thread_num()];
+#endif
+  return f;
+}
+
+inline double *FixBackbone::energy_buffer()
+{
+#if defined(_OPENMP)
+  if (omp_in_parallel()) return thr_energy[omp_get_thread_num()];
+#endif
+  return energy;
+}
+
+inline double FixBackbone::math_exp(double x)
+{
+  return (fast_math_on ? fast_exp(x) : exp(x));
+}
+
+inline double FixBackbone::math_tanh(double x)
+{
+  return (fast_math_on ? fast_tanh(x) : tanh(x));
+}
+
+inline double FixBackbone::math_sin(double x)
+{
+  return (fast_math_on ? fast_sin(x) : sin(x));
+}
+
+inline double FixBackbone::math_cos(double x)
+{
+  return (fast_math_on ? fast_cos(x) : cos(x));
+}
+
+void FixBackbone::thr_zero()
+{
+  int nall = atom->nlocal + atom->nghost;
+
+  if (atom->nmax>thr_nmax) {
+    thr_nmax = atom->nmax;
+    for (int t=0;t<nthreads;++t) memory->grow(thr_f[t],thr_nmax,3,"backbone:thr_f");
+  }
+
+  // each thread clears its own buffer so the pages are first touched locally
+#if defined(_OPENMP)
+#pragma omp parallel num_threads(nthreads)
+#endif
+  {
+#if defined(_OPENMP)
+    int t = omp_get_thread_num();
+#else
+    int t = 0;
+#endif
+    for (int i=0;i<nall;++i) thr_f[t][i][0] = thr_f[t][i][1] = thr_f[t][i][2] = 0.0;
+    for (int i=0;i<nEnergyTerms;++i) thr_energy[t][i] = 0.0;
+  }
+}
+
+void FixBackbone::thr_reduce()
+{
+  int i, t;
+  int nall = atom->nlocal + atom->nghost;
+
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(nthreads) private(t) schedule(static)
+#endif
+  for (i=0;i<nall;++i) {
+    for (t=0;t<nthreads;++t) {
+      f[i][0] += thr_f[t][i][0];
+      f[i][1] += thr_f[t][i][1];
+      f[i][2] += thr_f[t][i][2];
+    }
+  }
+
+  for (t=0;t<nthreads;++t)
+    for (i=0;i<nEnergyTerms;++i) energy[i] += thr_energy[t][i];
+}
+
+// Slot a density contribution of atom i (residue ires) is summed into:
+// per-atom in ghost comm mode, otherwise the rank-local per-residue array
+inline double *FixBackbone::dens_slot(int i, int ires, int which, double *loc)
+{
+  if (ghost_comm_flag) return &atom_dens[i][which];
+  return &loc[ires];
+}
+
+// CB atoms, or CA atoms of glycines, carry the residue densities
+inline bool FixBackbone::isDensityAtom(int i)
+{
+  int ires = atom->residue[i]-1;
+  return (atom->mask[i]&group2bit && se[ires]!='G') || (atom->mask[i]&groupbit && se[ires]=='G');
+}
+
+void FixBackbone::dens_grow()
+{
+  if (atom->nmax>dens_nmax) {
+    dens_nmax = atom->nmax;
+    memory->grow(atom_dens,dens_nmax,nDens,"backbone:atom_dens");
+  }
+}
+
+void FixBackbone::dens_zero()
+{
+  int i, k;
+  int nall = atom->nlocal + atom->nghost;
+
+  dens_grow();
+
+  for (i=0;i<nall;++i)
+    for (k=0;k<nDens;++k) atom_dens[i][k] = 0.0;
+}
+
+// Sum ghost contributions of columns [first,first+count) onto their owners
+void FixBackbone::dens_reverse_comm(int first, int count)
+{
+  comm_stage = first;
+  comm_nvals = count;
+  comm->reverse_comm(this,count);
+}
+
+// Copy owned values of columns [first,first+count) to all ghost images
+void FixBackbone::dens_forward_comm(int first, int count)
+{
+  comm_stage = first;
+  comm_nvals = count;
+  comm->forward_comm(this,count);
+}
+
+int FixBackbone::pack_forward_comm(int n, int *list, double *buf, int /*pbc_flag*/, int * /*pbc*/)
+{
+  int i, k, m = 0;
+  for (i=0;i<n;++i)
+    for (k=0;k<comm_nvals;++k) buf[m++] = atom_dens[list[i]][comm_stage+k];
+  return m;
+}
+
+void FixBackbone::unpack_forward_comm(int n, int first, double *buf)
+{
+  int i, k, m = 0;
+  for (i=first;i<first+n;++i)
+    for (k=0;k<comm_nvals;++k) atom_dens[i][comm_stage+k] = buf[m++];
+}
+
+int FixBackbone::pack_reverse_comm(int n, int first, double *buf)
+{
+  int i, k, m = 0;
+  for (i=first;i<first+n;++i)
+    for (k=0;k<comm_nvals;++k) buf[m++] = atom_dens[i][comm_stage+k];
+  return m;
+}
+
+void FixBackbone::unpack_reverse_comm(int n, int *list, double *buf)
+{
+  int i, k, m = 0;
+  for (i=0;i<n;++i)
+    for (k=0;k<comm_nvals;++k) atom_dens[list[i]][comm_stage+k] += buf[m++];
+}
+
+/* ---------------------------------------------------------------------- */
+
+void FixBackbone::compute_chain_potential(int i)
+{
+  double **f = force_buffer();
+  double *energy = energy_buffer();
+  double dx[3], r, dr, force;
+
+  int i_resno = res_no[i]-1;
+  int ip1, im1;
+  int im1_resno;
+
+  // N(i) - Cb(i)
+  tagint *res_tag = atom->residue;
+  if (!isFirst(i) && se[i_resno]!='G') {
+    im1 = res_no_l[i_resno-1];
+    im1_resno = res_no[im1]-1;
+    if (im1!=-1 && (res_info[im1]==LOCAL || res_info[im1]==GHOST)){
+      dx[0] = xn[i][0] - xcb[i][0];
+      dx[1] = xn[i][1] - xcb[i][1];
+      dx[2] = xn[i][2] - xcb[i][2];
+      r = sqrt(dx[0]*dx[0]+dx[1]*dx[1]+dx[2]*dx[2]);
+      dr = r - r_ncb0;
+      force = 2*k_chain[0]*dr/r;
+
+      energy[ET_CHAIN] += k_chain[0]*dr*dr;
+
+      f[alpha_carbons[im1]][0] -= an*dx[0]*force;
+      f[alpha_carbons[im1]][1] -= an*dx[1]*force;
+      f[alpha_carbons[im1]][2] -= an*dx[2]*force;
+
+      f[oxygens[im1]][0] -= cn*dx[0]*force;
+      f[oxygens[im1]][1] -= cn*dx[1]*force;
       f[oxygens[im1]][2] -= cn*dx[2]*force;
 
       f[alpha_carbons[i]][0] -= bn*dx[0]*force;
@@ -2171,6 +3017,8 @@ void FixBackbone::compute_chain_potential(int i)
 
 void FixBackbone::compute_shake(int i)
 {
+  double **f = force_buffer();
+  double *energy = energy_buffer();
   double dx[3], r, dr, force;
 
   // r_sh1 = r_Ca(i) - rCa(i+1)
@@ -2238,6 +3086,8 @@ void FixBackbone::compute_shake(int i)
 
 void FixBackbone::compute_chi_potential(int i)
 {
+  double **f = force_buffer();
+  double *energy = energy_buffer();
   double dx[3], r, dr, force;
   double a[3], b[3], c[3], arvsq, brvsq, crvsq;
   double axb[3], cxa[3], bxc[3], aprl[3], bprl[3], cprl[3];
@@ -2295,34 +3145,25 @@ void FixBackbone::compute_chi_potential(int i)
 
   energy[ET_CHI] += k_chi*dchi*dchi;
 
+  // the neighbor residues are checked by check_residue_partners()
   if (!isFirst(i)) {
     im1 = res_no_l[i_resno-1];
-    if(im1==-1){
-	fprintf(stderr,"im1=-1!\n");
-        error->all(FLERR,"Chi: Missing atom! Increase pair cutoff and neighbor skin or check system integrity!");
-    }
-    else {
-	    f[alpha_carbons[im1]][0] -= -an*bprl[0]*force;
-	    f[alpha_carbons[im1]][1] -= -an*bprl[1]*force;
-	    f[alpha_carbons[im1]][2] -= -an*bprl[2]*force;
 
-	    f[oxygens[im1]][0] -= -cn*bprl[0]*force;
-	    f[oxygens[im1]][1] -= -cn*bprl[1]*force;
-	    f[oxygens[im1]][2] -= -cn*bprl[2]*force;
-    }
+    f[alpha_carbons[im1]][0] -= -an*bprl[0]*force;
+    f[alpha_carbons[im1]][1] -= -an*bprl[1]*force;
+    f[alpha_carbons[im1]][2] -= -an*bprl[2]*force;
+
+    f[oxygens[im1]][0] -= -cn*bprl[0]*force;
+    f[oxygens[im1]][1] -= -cn*bprl[1]*force;
+    f[oxygens[im1]][2] -= -cn*bprl[2]*force;
   }
 
   if (!isLast(i)) {
     ip1 = res_no_l[i_resno+1];
-    if(ip1==-1){
-	fprintf(stderr,"ip1=-1!\n");
-        error->all(FLERR,"Chi: Missing atom! Increase pair cutoff and neighbor skin or check system integrity!");
-    }
-    else {
+
     f[alpha_carbons[ip1]][0] -= bp*aprl[0]*force;
     f[alpha_carbons[ip1]][1] -= bp*aprl[1]*force;
     f[alpha_carbons[ip1]][2] -= bp*aprl[2]*force;
-    }
   }
 
   f[alpha_carbons[i]][0] -= (cprl[0] + (1-bn)*bprl[0] + (ap-1)*aprl[0])*force;
@@ -2338,7 +3179,7 @@ void FixBackbone::compute_chi_potential(int i)
   f[beta_atoms[i]][2] -= -cprl[2]*force;
 }
 
-void FixBackbone::calcDihedralAndSlopes(int i, double& angle, int iAng)
+void FixBackbone::calcDihedralAndSlopes(int i, double& angle, int iAng, double y_slope[][nAtoms][3], double x_slope[][nAtoms][3])
 {
   double a[3], b[3], c[3];
   double bxa[3], cxa[3], cxb[3];
@@ -2452,8 +3293,9 @@ void FixBackbone::calcDihedralAndSlopes(int i, double& angle, int iAng)
   }
 }
 
-void FixBackbone::compute_rama_force(int i, double *force1)
+void FixBackbone::compute_rama_force(int i, double *force1, double y_slope[][nAtoms][3], double x_slope[][nAtoms][3])
 {
+  double **f = force_buffer();
   int ia;
 
   int i_resno = res_no[i]-1;
@@ -2505,18 +3347,113 @@ void FixBackbone::compute_rama_force(int i, double *force1)
   }
 }
 
+// Tabulate the Rama potential of every parameter class on a periodic
+// rama_table_n x rama_table_n grid over [-pi, pi). The derivatives are
+// analytic, so the bicubic Hermite interpolant is C1 continuous.
+void FixBackbone::build_rama_table()
+{
+  int j, t, ia, ib, k, nsize;
+  double h, phi, psi, c1, c2, g1, g2, V, *node;
+
+  n_rama_table = 2;
+  for (j=0;j<12;++j) rama_table_ssw[j] = (ssweight[j] ? n_rama_table++ : -1);
+
+  nsize = 4*n_rama_table*rama_table_n*rama_table_n;
+  rama_table = new double[nsize];
+  for (k=0;k<nsize;++k) rama_table[k] = 0.0;
+
+  h = 2.0*M_PI/rama_table_n;
+  for (j=0;j<12;++j) {
+    if (j<n_rama_par) t = 0;
+    else if (rama_p_flag && j>=i_rp && j<i_rp+n_rama_p_par) t = 1;
+    else continue;
+    if (ssweight[j]) t = rama_table_ssw[j];
+
+    for (ia=0;ia<rama_table_n;++ia) {
+      phi = -M_PI + ia*h;
+      c1 = cos(phi + phi0[j]) - 1.0;
+      g1 = 2.0*phiw[j]*c1*sin(phi + phi0[j]);
+      for (ib=0;ib<rama_table_n;++ib) {
+        psi = -M_PI + ib*h;
+        c2 = cos(psi + psi0[j]) - 1.0;
+        g2 = 2.0*psiw[j]*c2*sin(psi + psi0[j]);
+        V = w[j]*exp( - phiw[j]*c1*c1 - psiw[j]*c2*c2 );
+
+        node = rama_table + 4*((t*rama_table_n + ia)*rama_table_n + ib);
+        node[0] += V;
+        node[1] += V*g1;
+        node[2] += V*g2;
+        node[3] += V*g1*g2;
+      }
+    }
+  }
+
+  if (comm->me==0) {
+    if (screen) fprintf(screen, "Rama_Table: %d tables of %d x %d points\n", n_rama_table, rama_table_n, rama_table_n);
+    if (logfile) fprintf(logfile, "Rama_Table: %d tables of %d x %d points\n", n_rama_table, rama_table_n, rama_table_n);
+  }
+}
+
+// Add weight*V(phi, psi) of table t to V and weight*dV/d(phi, psi) to dV
+inline void FixBackbone::rama_table_eval(int t, double weight, double phi, double psi, double &V, double *dV)
+{
+  int ia, ib, a, b, nt = rama_table_n;
+  double h = 2.0*M_PI/nt, x, y, u, v, *node;
+  double A[2][2], dA[2][2], B[2][2], dB[2][2];
+
+  x = (phi + M_PI)/h;
+  y = (psi + M_PI)/h;
+  ia = (int)floor(x);
+  ib = (int)floor(y);
+  u = x - ia;
+  v = y - ib;
+  ia = (ia%nt + nt)%nt;
+  ib = (ib%nt + nt)%nt;
+
+  // Hermite basis: A[0][a] multiplies the value and A[1][a] the slope at
+  // corner a; slopes and derivatives are scaled by the grid spacing
+  A[0][0] = (1.0 + 2.0*u)*(1.0 - u)*(1.0 - u);
+  A[0][1] = 1.0 - A[0][0];
+  A[1][0] = h*u*(1.0 - u)*(1.0 - u);
+  A[1][1] = h*u*u*(u - 1.0);
+  dA[0][0] = 6.0*u*(u - 1.0)/h;
+  dA[0][1] = -dA[0][0];
+  dA[1][0] = (3.0*u - 1.0)*(u - 1.0);
+  dA[1][1] = u*(3.0*u - 2.0);
+
+  B[0][0] = (1.0 + 2.0*v)*(1.0 - v)*(1.0 - v);
+  B[0][1] = 1.0 - B[0][0];
+  B[1][0] = h*v*(1.0 - v)*(1.0 - v);
+  B[1][1] = h*v*v*(v - 1.0);
+  dB[0][0] = 6.0*v*(v - 1.0)/h;
+  dB[0][1] = -dB[0][0];
+  dB[1][0] = (3.0*v - 1.0)*(v - 1.0);
+  dB[1][1] = v*(3.0*v - 2.0);
+
+  for (a=0;a<2;++a) {
+    for (b=0;b<2;++b) {
+      node = rama_table + 4*((t*nt + (ia+a)%nt)*nt + (ib+b)%nt);
+      V += weight*(A[0][a]*B[0][b]*node[0] + A[1][a]*B[0][b]*node[1] + A[0][a]*B[1][b]*node[2] + A[1][a]*B[1][b]*node[3]);
+      dV[PHI] += weight*(dA[0][a]*B[0][b]*node[0] + dA[1][a]*B[0][b]*node[1] + dA[0][a]*B[1][b]*node[2] + dA[1][a]*B[1][b]*node[3]);
+      dV[PSI] += weight*(A[0][a]*dB[0][b]*node[0] + A[1][a]*dB[0][b]*node[1] + A[0][a]*dB[1][b]*node[2] + A[1][a]*dB[1][b]*node[3]);
+    }
+  }
+}
+
 void FixBackbone::compute_rama_potential(int i)
 {
+  double *energy = energy_buffer();
   double V, phi, psi;
   double force, force1[nAngles];
   double cos_phi, cos_psi, phiw_cos_phi, psiw_cos_psi;
+  double y_slope[nAngles][nAtoms][3], x_slope[nAngles][nAtoms][3];
   int jStart, nEnd;
   int j, ia, l;
 
   int i_resno = res_no[i]-1;
 
-  calcDihedralAndSlopes(i, phi, PHI);
-  calcDihedralAndSlopes(i, psi, PSI);
+  calcDihedralAndSlopes(i, phi, PHI, y_slope, x_slope);
+  calcDihedralAndSlopes(i, psi, PSI, y_slope, x_slope);
 
   jStart = 0;
   nEnd = n_rama_par;
@@ -2525,23 +3462,37 @@ void FixBackbone::compute_rama_potential(int i)
     nEnd = i_rp + n_rama_p_par;
   }
 
+  if (rama_table_flag) {
+    V = 0.0;
+    force1[PHI] = force1[PSI] = 0.0;
+    rama_table_eval((jStart==0 ? 0 : 1), 1.0, phi, psi, V, force1);
+    for (j=jStart;j<nEnd;j++) {
+      if (ssweight[j] && aps[j][i_resno]!=0.0)
+        rama_table_eval(rama_table_ssw[j], aps[j][i_resno], phi, psi, V, force1);
+    }
+
+    energy[ET_RAMA] += -V;
+    compute_rama_force(i, force1, y_slope, x_slope);
+    return;
+  }
+
   for (j=jStart;j<nEnd;j++) {
     if (ssweight[j] && aps[j][i_resno]==0.0) continue;
 
-    cos_phi = cos(phi + phi0[j]) - 1.0;
-    cos_psi = cos(psi + psi0[j]) - 1.0;
+    cos_phi = math_cos(phi + phi0[j]) - 1.0;
+    cos_psi = math_cos(psi + psi0[j]) - 1.0;
     phiw_cos_phi = phiw[j]*cos_phi;
     psiw_cos_psi = psiw[j]*cos_psi;
 
-    V = w[j]*exp( - cos_phi*phiw_cos_phi  - cos_psi*psiw_cos_psi );
+    V = w[j]*math_exp( - cos_phi*phiw_cos_phi  - cos_psi*psiw_cos_psi );
     if (ssweight[j]) V *= aps[j][i_resno];
 
     force = 2.0*V;
-    force1[PHI] = force*phiw_cos_phi*sin(phi + phi0[j]);
-    force1[PSI] = force*psiw_cos_psi*sin(psi + psi0[j]);
+    force1[PHI] = force*phiw_cos_phi*math_sin(phi + phi0[j]);
+    force1[PSI] = force*psiw_cos_psi*math_sin(psi + psi0[j]);
 
     energy[ET_RAMA] += -V;
-    compute_rama_force(i, force1);
+    compute_rama_force(i, force1, y_slope, x_slope);
   }
 }
 
@@ -2899,8 +3850,36 @@ inline double FixBackbone::get_burial_gamma(int i_resno, int ires_type, int loca
   }
 }
 
+// All six burial switching functions tanh(kappa*(ro-ro_min[k])) and
+// tanh(kappa*(ro_max[k]-ro)) from a single exponential, using
+// tanh(x) = (e^2x - 1)/(e^2x + 1) with exp(-2*kappa*ro_min[k]) and
+// exp(2*kappa*ro_max[k]) precomputed in the constructor
+inline void FixBackbone::compute_burial_tanh(double ro, double t[3][2])
+{
+  int k;
+  double e, a, b;
+
+  if (fabs(2.0*burial_kappa*ro)>burial_exp_max_arg) {
+    for (k=0;k<3;++k) {
+      t[k][0] = math_tanh( burial_kappa*(ro - burial_ro_min[k]) );
+      t[k][1] = math_tanh( burial_kappa*(burial_ro_max[k] - ro) );
+    }
+    return;
+  }
+
+  e = math_exp(2.0*burial_kappa*ro);
+  for (k=0;k<3;++k) {
+    a = e*burial_exp_ro_min[k];
+    b = burial_exp_ro_max[k];
+    t[k][0] = (a - 1.0)/(a + 1.0);
+    t[k][1] = (b - e)/(b + e);
+  }
+}
+
 void FixBackbone::compute_dssp_hdrgn(int i, int j)
 {
+  double **f = force_buffer();
+  double *energy = energy_buffer();
   if (R->rNO(i,j)>dssp_hdrgn_cut) return;
 
   bool i_repulsive = true, i_AP = true, i_P = true, i_theta[4] = {true, true, true, true}, missing = false;
@@ -3016,7 +3995,7 @@ void FixBackbone::compute_dssp_hdrgn(int i, int j)
     if (r_nu[0] > dssp_nu_cut1_sq) {
       r_nu[0] = sqrt(r_nu[0]);
 
-      th = tanh(pref[0]*(r_nu[0] - d_nu0));
+      th = math_tanh(pref[0]*(r_nu[0] - d_nu0));
       nu[0] = 0.5*(1.0 + th);
 
       prdnu[0] = pref[0]*nu[0]*(1.0 - th)/r_nu[0];
@@ -3037,7 +4016,7 @@ void FixBackbone::compute_dssp_hdrgn(int i, int j)
     if (r_nu[1] > dssp_nu_cut2_sq) {
       r_nu[1] = sqrt(r_nu[1]);
 
-      th = tanh(pref[1]*(r_nu[1] - d_nu0));
+      th = math_tanh(pref[1]*(r_nu[1] - d_nu0));
       nu[1] = 0.5*(1.0 + th);
 
       prdnu[1] = pref[1]*nu[1]*(1.0 - th)/r_nu[1];
@@ -3109,7 +4088,7 @@ void FixBackbone::compute_dssp_hdrgn(int i, int j)
     if (i_theta[k]) {
       dR_NO_sigma = (R_NO[k] - NO_zero)*sigma_NO_sqinv;
       dR_HO_sigma = (R_HO[k] - HO_zero)*sigma_HO_sqinv;
-      theta[k] = exp( - 0.5*( (R_NO[k] - NO_zero)*dR_NO_sigma + (R_HO[k] - HO_zero)*dR_HO_sigma ) );
+      theta[k] = math_exp( - 0.5*( (R_NO[k] - NO_zero)*dR_NO_sigma + (R_HO[k] - HO_zero)*dR_HO_sigma ) );
 
       prd_theta[k][0] = - dR_NO_sigma/R_NO[k];
       prd_theta[k][1] = - dR_HO_sigma/R_HO[k];
@@ -3276,13 +4255,9 @@ void FixBackbone::compute_dssp_hdrgn(int i, int j)
   }
 }
 
-void FixBackbone::compute_P_AP_potential(int i, int j)
+// Medium and long range antiparallel and parallel classes of the pair i<j
+void FixBackbone::P_AP_pair_types(int i, int j, bool &i_AP_med, bool &i_AP_long, bool &i_P)
 {
-  if (p_ap->nu(i, j)<pap_delta) return;
-
-  double K, force[2], dx[2][3];
-  bool i_AP_med, i_AP_long, i_P, missing;
-
   int i_resno = res_no[i]-1;
   int j_resno = res_no[j]-1;
 
@@ -3297,6 +4272,18 @@ void FixBackbone::compute_P_AP_potential(int i, int j)
   i_AP_long  = (i_chno==j_chno && i_resno<i_ch_end-(i_med_max+2*i_diff_P_AP+1) && j_resno>=i_resno+(i_med_max+2*i_diff_P_AP+1) && j_resno<j_ch_end) || (i_chno!=j_chno && i+i_diff_P_AP<nn && j-i_diff_P_AP>=0 && (chain_no[i+i_diff_P_AP]-1)==i_chno && (chain_no[j-i_diff_P_AP]-1)==j_chno);
 
   i_P = (i_chno==j_chno && i_resno<i_ch_end-(i_med_max+1+i_diff_P_AP) && j_resno>=i_resno+(i_med_max+1) && j_resno<i_ch_end-i_diff_P_AP) || (i_chno!=j_chno && i+i_diff_P_AP<nn && j+i_diff_P_AP<nn && (chain_no[i+i_diff_P_AP]-1)==i_chno && (chain_no[j+i_diff_P_AP]-1)==j_chno);
+}
+
+// Serial part of the P_AP term of pair i<j: check for missing partner atoms
+// and fill the p_ap entries that compute_P_AP_potential() reads, so that
+// it can run in threads against a read-only cache
+void FixBackbone::prepare_P_AP(int i, int j)
+{
+  bool i_AP_med, i_AP_long, i_P, missing;
+
+  if (p_ap->nu(i, j)<pap_delta) return;
+
+  P_AP_pair_types(i, j, i_AP_med, i_AP_long, i_P);
 
   // Check for missing atoms
   missing = false;
@@ -3307,6 +4294,25 @@ void FixBackbone::compute_P_AP_potential(int i, int j)
     error->all(FLERR,"P_AP: Missing atom! Increase pair cutoff and neighbor skin or check system integrity!");
   }
 
+  if (i_AP_med || i_AP_long) p_ap->nu(i+i_diff_P_AP, j-i_diff_P_AP);
+  if (i_P) p_ap->nu(i+i_diff_P_AP, j+i_diff_P_AP);
+}
+
+// Call prepare_P_AP() on the pair first
+void FixBackbone::compute_P_AP_potential(int i, int j)
+{
+  double **f = force_buffer();
+  double *energy = energy_buffer();
+  if (p_ap->nu(i, j)<pap_delta) return;
+
+  double K, force[2], dx[2][3];
+  bool i_AP_med, i_AP_long, i_P;
+
+  int i_resno = res_no[i]-1;
+  int j_resno = res_no[j]-1;
+
+  P_AP_pair_types(i, j, i_AP_med, i_AP_long, i_P);
+
   if (i_AP_med || i_AP_long) {
     if (n_rama_par>0 && aps[n_rama_par-1][i_resno]==1.0 && aps[n_rama_par-1][j_resno]==1.0) {
       K = (i_AP_med ? k_P_AP[0] : 0.0) + (i_AP_long ? k_P_AP[1]*k_betapred_P_AP : 0.0);
@@ -3518,12 +4524,7 @@ void FixBackbone::compute_burial_potential(int i)
     error->all(FLERR,"Burial: Missing atom! Increase pair cutoff and neighbor skin or check system integrity!");
   }
 
-  t[0][0] = tanh( burial_kappa*(well->ro(i) - burial_ro_min[0]) );
-  t[0][1] = tanh( burial_kappa*(burial_ro_max[0] - well->ro(i)) );
-  t[1][0] = tanh( burial_kappa*(well->ro(i) - burial_ro_min[1]) );
-  t[1][1] = tanh( burial_kappa*(burial_ro_max[1] - well->ro(i)) );
-  t[2][0] = tanh( burial_kappa*(well->ro(i) - burial_ro_min[2]) );
-  t[2][1] = tanh( burial_kappa*(burial_ro_max[2] - well->ro(i)) );
+  compute_burial_tanh(well->ro(i), t);
 
   burial_gamma_0 = get_burial_gamma(i_resno, ires_type, 0);
   burial_gamma_1 = get_burial_gamma(i_resno, ires_type, 1);
@@ -3753,7 +4754,7 @@ void FixBackbone::compute_helix_dtheta_pair(int i, int j)
   dR_NO_sigma = dR_NO*helix_sigma_NO_sqinv;
   dR_HO_sigma = dR_HO*helix_sigma_HO_sqinv;
 
-  pair_theta = -k_helix*prob_sum*exp( - 0.5*(dR_NO*dR_NO_sigma + dR_HO*dR_HO_sigma) );
+  pair_theta = -k_helix*prob_sum*math_exp( - 0.5*(dR_NO*dR_NO_sigma + dR_HO*dR_HO_sigma) );
 
   prd_pair_theta[0] = - dR_NO_sigma/R_NO;
   prd_pair_theta[1] = - dR_HO_sigma/R_HO;
@@ -3763,6 +4764,16 @@ void FixBackbone::compute_helix_dtheta_pair(int i, int j)
   loc_helix_xi_1[i_resno] = (helix_gamma_w - helix_gamma_p)*pair_theta*helix_sigma_h_prd[i_resno]*helix_sigma_h[j_resno];
   loc_helix_xi_2[i_resno] = (helix_gamma_w - helix_gamma_p)*pair_theta*helix_sigma_h[i_resno]*helix_sigma_h_prd[j_resno];
 
+  if (ghost_comm_flag) {
+    // helix_xi_2[i_resno] is only ever read for residue j_resno = i_resno + helix_i_diff,
+    // so it is accumulated on the density atom of residue j instead
+    int id = (se[i_resno]=='G' ? alpha_carbons[i] : beta_atoms[i]);
+    int jd = (se[j_resno]=='G' ? alpha_carbons[j] : beta_atoms[j]);
+    if (id==-1 || jd==-1) error->all(FLERR,"Helix: Missing density atom! Increase pair cutoff and neighbor skin or check system integrity!");
+    atom_dens[id][DENS_HELIX_XI] += loc_helix_xi_1[i_resno];
+    atom_dens[jd][DENS_HELIX_XI] += loc_helix_xi_2[i_resno];
+  }
+
   V = sigma_gamma*pair_theta;
 
   energy[ET_HELIX] += V;
@@ -3784,204 +4795,271 @@ void FixBackbone::compute_helix_dtheta_pair(int i, int j)
   f[oxygens[i]][2] -= V*(prd_pair_theta[0]*xNO[2] + prd_pair_theta[1]*xHO[2]);
 }
 
-void FixBackbone::compute_amhgo_normalization()
+// Native distance of atom iatom of residue i to atom jatom of residue j as
+// seen from site i, either from amh-go.gro or from the DCA Go distance files
+inline double FixBackbone::amh_go_rnative(int i, int iatom, int j, int jatom, double **rn_caca, double **rn_cbcb, double **rn_cacb)
+{
+  if (frustration_censoring_flag == 2) {
+    if (iatom==Fragment_Memory::FM_CA && jatom==Fragment_Memory::FM_CA) return rn_caca[i][j];
+    else if (iatom==Fragment_Memory::FM_CB && jatom==Fragment_Memory::FM_CB) return rn_cbcb[i][j];
+    else return rn_cacb[i][j];
+  }
+  return m_amh_go->Rf(i, iatom, j, jatom);
+}
+
+void FixBackbone::setup_amh_go_pairs(int **censored, double **rn_caca, double **rn_cbcb, double **rn_cacb)
 {
-  // compute normalization constant for the amhgo potential
-  // the constant is called "a" and is given in Eqn. 8 in
+  // Native pairs are stored once, under the lower of their two sites
+  // s = 2*residue + atom - FM_CA, in CSR form: amh_go_first[s]..amh_go_first[s+1]-1
+  // hold the partner sites t>s with rnative < amh_go_rc, and their Gaussian
+  // width. The native distance and gamma are kept for both directions,
+  // [2*k] as seen from s and [2*k+1] from t, since the DCA Go distance
+  // files need not be symmetric; a direction beyond amh_go_rc gets a zero
+  // gamma. Censored pairs and pairs closer in sequence than minSep() within
+  // a chain are left out, and Glycines have no CB site.
+
+  // The normalization constant "a" is given in Eqn. 8 in
   // Eastwood and Wolynes 2000 "Role of explicitly..."
   // a = 1/(8N) \sum_i abs(\sum_(j in native contact) gamma_ij)^p
+  // censoring is not applied to it and minSep() holds between chains too
 
-  int i, j, ich, jch, ires0, iresn, jres0, jresn, iatom, jatom;
-  int ires_type, jres_type;
-  double amhgo_gamma, rnative;
+  int i, j, k, ich, is, js, iatom, jatom, ires_type, jres_type, nmax, iresn;
+  int *chain;
+  double amhgo_gamma, amhgo_gamma_ji, rnative, rnative_ji;
   double normi;
 
-  // Loop over chains
+  chain = new int[n];
+  for (ich=0;ich<nch;++ich)
+    for (i=ch_pos[ich]-1;i<ch_pos[ich]+ch_len[ich]-1;++i) chain[i] = ich;
+
+  memory->create(amh_go_first,2*n+1,"backbone:amh_go_first");
+  amh_go_npairs = nmax = 0;
+
   amh_go_norm[0] = 0.0; //BinZhang
-  for (ich=0;ich<nch;++ich) {
-    ires0 = ch_pos[ich]-1;
-    iresn = ch_pos[ich]+ch_len[ich]-1;
+  for (i=0;i<n;++i) {
+    ires_type = se_map[se[i]-'A'];
+
+    for (iatom=Fragment_Memory::FM_CA; iatom<=Fragment_Memory::FM_CB; ++iatom) {
+      is = 2*i + iatom-Fragment_Memory::FM_CA;
+      amh_go_first[is] = amh_go_npairs;
+      if (iatom==Fragment_Memory::FM_CB && se[i]=='G') continue;
+
+      normi = 0.0;
+      for (j=0;j<n;++j) {
+	jres_type = se_map[se[j]-'A'];
+
+	for (jatom=Fragment_Memory::FM_CA; jatom<=Fragment_Memory::FM_CB - (se[j]=='G' ? 1 : 0); ++jatom) {
+	  js = 2*j + jatom-Fragment_Memory::FM_CA;
+	  rnative = amh_go_rnative(i, iatom, j, jatom, rn_caca, rn_cbcb, rn_cacb);
+	  amhgo_gamma = amh_go_gamma->gammaLookup(ires_type, jres_type, i, j);
+
+	  // site i sums the gammas of its own direction over every j, the
+	  // lower and the higher sites alike
+	  if (rnative<amh_go_rc && abs(i-j)>=amh_go_gamma->minSep()) normi += amhgo_gamma;
+
+	  if (js<=is) continue;
+	  rnative_ji = amh_go_rnative(j, jatom, i, iatom, rn_caca, rn_cbcb, rn_cacb);
+	  if (rnative>=amh_go_rc && rnative_ji>=amh_go_rc) continue;
+	  amhgo_gamma_ji = amh_go_gamma->gammaLookup(jres_type, ires_type, j, i);
+
+	  // Aram: Do not check for minSep between chains
+	  if (abs(i-j)<amh_go_gamma->minSep() && chain[i]==chain[j]) continue;
+
+	  // test to see if the interactions between i and j are censored
+	  if (frustration_censoring_flag == 1 && (censored[i][j] == 1 || censored[j][i] == 1)) continue;
+
+	  if (amh_go_npairs==nmax) {
+	    nmax += DELTA_FM_LIST;
+	    memory->grow(amh_go_site,nmax,"backbone:amh_go_site");
+	    memory->grow(amh_go_sigma_sq,nmax,"backbone:amh_go_sigma_sq");
+	    memory->grow(amh_go_rn,2*nmax,"backbone:amh_go_rn");
+	    memory->grow(amh_go_gm,2*nmax,"backbone:amh_go_gm");
+	  }
+	  k = amh_go_npairs++;
+	  amh_go_site[k] = js;
+	  amh_go_sigma_sq[k] = amh_go_sigma_sq_sep[abs(i-j)];
+	  amh_go_rn[2*k] = rnative;
+	  amh_go_rn[2*k+1] = rnative_ji;
+	  amh_go_gm[2*k] = (rnative<amh_go_rc ? amhgo_gamma : 0.0);
+	  amh_go_gm[2*k+1] = (rnative_ji<amh_go_rc ? amhgo_gamma_ji : 0.0);
+	}
 
-    // Double loop over all residue pairs
-    for (i=ires0;i<iresn;++i) {
-      ires_type = se_map[se[i]-'A'];
+	// the running sum is added once at the end of every chain of j
+	if (j==n-1 || chain[j+1]!=chain[j]) {
+	  //amh_go_norm[ich] += pow(fabs(normi), amh_go_p);
+	  amh_go_norm[0] += pow(fabs(normi), amh_go_p); //BinZhang; do not use per chain normalization
+	}
+      }
+    }
+  }
+  amh_go_first[2*n] = amh_go_npairs;
+  delete [] chain;
+
+  // per direction dEij/(r dr) of the last evaluation, reused by the force pass
+  memory->create(amh_go_dE,2*amh_go_npairs+2,"backbone:amh_go_dE");
+  memory->create(amh_go_near,amh_go_npairs+1,"backbone:amh_go_near");
 
-      for (iatom=Fragment_Memory::FM_CA; iatom<=Fragment_Memory::FM_CB - (se[i]=='G' ? 1 : 0); ++iatom) {
-	normi = 0.0;
+  // end of the last chain
+  iresn = ch_pos[nch-1]+ch_len[nch-1]-1;
+
+  //amh_go_norm[ich] /= 8*resn;
+  amh_go_norm[0] /= 8*iresn;     // BinZhang
+  if (comm->me==0) {
+    if (screen) fprintf(screen, "amhgo: %d, %12.6f, %d native pairs\n", iresn, amh_go_norm[0], amh_go_npairs);
+    if (logfile) fprintf(logfile, "amhgo: %d, %12.6f, %d native pairs\n", iresn, amh_go_norm[0], amh_go_npairs);
+  }
+}
 
-       for (jch=0;jch<nch;++jch) {
-        jres0 = ch_pos[jch]-1;
-        jresn = ch_pos[jch]+ch_len[jch]-1;
+// Flag the native pairs of my lower sites whose partner was within the
+// neighbor list cutoff at this reneighboring, i.e. the pairs the full
+// neighbor list of compute_amh_go_model() used to provide
+void FixBackbone::build_amh_go_near()
+{
+  int i, j, k, ires, iatom, is, js;
+  double dx[3], cutsq;
+  double **x = atom->x;
+  int nlocal = atom->nlocal;
 
-	for (j=jres0;j<jresn;++j) {
-	  jres_type = se_map[se[j]-'A'];
+  cutsq = (pair_list_cutoff+neighbor->skin)*(pair_list_cutoff+neighbor->skin);
 
-	  for (jatom=Fragment_Memory::FM_CA; jatom<=Fragment_Memory::FM_CB - (se[j]=='G' ? 1 : 0); ++jatom) {
+  for (ires=0;ires<n;++ires) {
+    for (iatom=0;iatom<2;++iatom) {
+      is = 2*ires + iatom;
+      i = res_atom_map[3*ires+iatom];
 
-	    if (abs(i-j)<amh_go_gamma->minSep()) continue;
+      for (k=amh_go_first[is];k<amh_go_first[is+1];++k) {
+	amh_go_near[k] = 0;
+	if (i==-1 || i>=nlocal) continue;
 
-	    // if frustration censoring is on, check to see if interaction is censored
-	    // if (frustration_censoring_flag == 1){
-	    //   if (frustration_censoring_map[i][j] == 1 || frustration_censoring_map[j][i] == 1) continue;
-	    // }
+	js = amh_go_site[k];
+	j = res_atom_map[3*(js/2) + js%2];
+	if (j==-1) continue;
 
-            // if using dca predicted Go contacts read in rnative from file
-	    if (frustration_censoring_flag == 2) {
-              if (iatom==Fragment_Memory::FM_CA && jatom==Fragment_Memory::FM_CA) rnative = r_nativeCACA[i][j];
-              else if (iatom==Fragment_Memory::FM_CB && jatom==Fragment_Memory::FM_CB) rnative = r_nativeCBCB[i][j];
-              else rnative = r_nativeCACB[i][j];
-            }
-            else rnative = m_amh_go->Rf(i, iatom, j, jatom);
+	dx[0] = x[i][0] - x[j][0];
+	dx[1] = x[i][1] - x[j][1];
+	dx[2] = x[i][2] - x[j][2];
 
-	    if (rnative<amh_go_rc) {
-	      amhgo_gamma = amh_go_gamma->getGamma(ires_type, jres_type, i, j);
-	      normi +=amhgo_gamma;
-	    }
-	  }
-	}
-	//amh_go_norm[ich] += pow(fabs(normi), amh_go_p);
-	amh_go_norm[0] += pow(fabs(normi), amh_go_p); //BinZhang; do not use per chain normalization
-       }
+	amh_go_near[k] = (dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2] < cutsq);
       }
     }
-    //amh_go_norm[ich] /= 8*resn;
-  }
-  amh_go_norm[0] /= 8*iresn;     // BinZhang
-  if (comm->me==0) {
-    if (screen) fprintf(screen, "amhgo: %d, %12.6f,\n", iresn, amh_go_norm[0]);
-    if (logfile) fprintf(logfile, "amhgo: %d, %12.6f,\n", iresn, amh_go_norm[0]);
   }
 }
 
+// Each native pair is evaluated once, by the owner of its lower site. The
+// first pass sums Eij into the per-atom Ei of both partners, ghost
+// contributions are reverse-communicated to their owners and the totals
+// copied back to ghosts. The second pass applies the nonadditive
+// p*Ei^(p-1) factors of both partners to the stored pair derivatives.
 void FixBackbone::compute_amh_go_model()
 {
-  int i, j, k, ii, jj, inum, jnum, iatom, jatom, ires_type, jres_type;
-  tagint ires, jres, imol, jmol;
-  int *ilist,*jlist,*numneigh,**firstneigh;
-  double xi[3], xj[3], dx[3], r, dr, drsq, rnative, amhgo_sigma_sq, amhgo_gamma;
-  double Eij, Ei=0.0, E=0.0, force, factor;
+  int i, j, k, ires, jres, is, js, iatom, pass;
+  double dx[3], r, dr, drsq, amhgo_sigma_sq, *dE;
+  double Eij, Eji, Ei, E=0.0, force, factor_i, factor_j;
 
   int nlocal = atom->nlocal;
   int nall = nlocal + atom->nghost;
-  int *mask = atom->mask;
 
-  int nforces; // Number of atoms' forces in the buffer
+  dens_grow();
+  for (i=0;i<nall;++i) atom_dens[i][DENS_AMHGO_EI] = 0.0;
 
-  inum = listfull->inum;
-  ilist = listfull->ilist;
-  numneigh = listfull->numneigh;
-  firstneigh = listfull->firstneigh;
+  for (pass=0;pass<2;++pass) {
+    // loop over the pairs of my C-Alpha and C-Beta atoms
+    for (ires=0;ires<n;++ires) {
+      for (iatom=0;iatom<2;++iatom) {
+	is = 2*ires + iatom;
+	if (amh_go_first[is]==amh_go_first[is+1]) continue;
+	i = res_atom_map[3*ires+iatom];
+	if (i==-1 || i>=nlocal) continue;
 
-  // loop over neighbors of my atoms
-  for (ii = 0; ii < inum; ii++) {
-    i = ilist[ii];
-    ires = atom->residue[i];
-    imol = atom->molecule[i];
-    ires_type = se_map[se[ires-1]-'A'];
-
-    // atom i is either C-Alpha or C-Bata and is LOCAL
-    if ( (mask[i]&groupbit || (mask[i]&group2bit && se[ires-1]!='G') ) && i<nlocal ) {
-      xi[0] = x[i][0];
-      xi[1] = x[i][1];
-      xi[2] = x[i][2];
-
-      if (domain->xperiodic) xi[0] += prd[0]*((image[i] & 1023) - 512);
-      if (domain->yperiodic) xi[1] += prd[1]*((image[i] >> 10 & 1023) - 512);
-      if (domain->zperiodic) xi[2] += prd[2]*((image[i] >> 20) - 512);
-
-      jlist = firstneigh[i];
-      jnum = numneigh[i];
-
-      nforces = 1;
-      amh_go_force_map[0] = i;
-      amh_go_force[0][0] = amh_go_force[0][1] = amh_go_force[0][2] = 0.0;
-
-      Ei = 0.0;
-      for (jj = 0; jj < jnum; jj++) {
-        j = jlist[jj];
-        jres = atom->residue[j];
-        jmol = atom->molecule[j];
-        jres_type = se_map[se[jres-1]-'A'];
-
-	// test to see if the interactions between ires and jres are censored
-	if (frustration_censoring_flag == 1){
-	  if (frustration_censoring_map[ires-1][jres-1] == 1 || frustration_censoring_map[jres-1][ires-1] == 1){
-	    continue;
-	  }
-	}
-
-        // atom j is either C-Alpha or C-Bata
-        // BinZhang; Use AmhGo for interchain as well
-        //if ( (mask[j]&groupbit || (mask[j]&group2bit && se[jres-1]!='G') ) && abs(ires-jres)>=amh_go_gamma->minSep() && imol==jmol ) {
-        //if ( (mask[j]&groupbit || (mask[j]&group2bit && se[jres-1]!='G') ) && abs(ires-jres)>=amh_go_gamma->minSep() ) {
-        // Aram: Do not check for minSep between chains
-        if ( (mask[j]&groupbit || (mask[j]&group2bit && se[jres-1]!='G') ) && (abs(ires-jres)>=amh_go_gamma->minSep() || imol!=jmol) ) {
-          xj[0] = x[j][0];
-          xj[1] = x[j][1];
-          xj[2] = x[j][2];
+	//BinZhang
+	//factor = -0.5*k_amh_go*amh_go_p*pow(Ei, amh_go_p-1)/amh_go_norm[imol-1];
+	if (pass==1) factor_i = -0.5*k_amh_go*amh_go_p*pow(atom_dens[i][DENS_AMHGO_EI], amh_go_p-1)/amh_go_norm[0];
 
-          if (domain->xperiodic) xj[0] += prd[0]*((image[j] & 1023) - 512);
-          if (domain->yperiodic) xj[1] += prd[1]*((image[j] >> 10 & 1023) - 512);
-          if (domain->zperiodic) xj[2] += prd[2]*((image[j] >> 20) - 512);
+	for (k=amh_go_first[is];k<amh_go_first[is+1];++k) {
+	  // partners beyond the neighbor list cutoff do not interact
+	  if (!amh_go_near[k]) continue;
 
-          if (mask[i]&groupbit) iatom = Fragment_Memory::FM_CA; else iatom = Fragment_Memory::FM_CB;
-          if (mask[j]&groupbit) jatom = Fragment_Memory::FM_CA; else jatom = Fragment_Memory::FM_CB;
+	  js = amh_go_site[k];
+	  jres = js/2;
+	  j = res_atom_map[3*jres + js%2];
 
-          // if using dca predicted Go contacts read in rnative from file
-          if (frustration_censoring_flag == 2) {
-            if (iatom==Fragment_Memory::FM_CA && jatom==Fragment_Memory::FM_CA) rnative = r_nativeCACA[ires-1][jres-1];
-            else if (iatom==Fragment_Memory::FM_CB && jatom==Fragment_Memory::FM_CB) rnative = r_nativeCBCB[ires-1][jres-1];
-            else rnative = r_nativeCACB[ires-1][jres-1];
-          }
-          else rnative = m_amh_go->Rf(ires-1, iatom, jres-1, jatom);
+	  dx[0] = x[i][0] - x[j][0];
+	  dx[1] = x[i][1] - x[j][1];
+	  dx[2] = x[i][2] - x[j][2];
 
-          if (rnative<amh_go_rc) {
-            dx[0] = xi[0] - xj[0];
-            dx[1] = xi[1] - xj[1];
-            dx[2] = xi[2] - xj[2];
+	  if (domain->xperiodic) dx[0] += prd[0]*(((image[i] & 1023) - 512) - ((image[j] & 1023) - 512));
+	  if (domain->yperiodic) dx[1] += prd[1]*(((image[i] >> 10 & 1023) - 512) - ((image[j] >> 10 & 1023) - 512));
+	  if (domain->zperiodic) dx[2] += prd[2]*(((image[i] >> 20) - 512) - ((image[j] >> 20) - 512));
 
-            r = sqrt(dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2]);
-            dr = r - rnative;
-            drsq = dr*dr;
+	  dE = amh_go_dE + 2*k;
 
-            amhgo_sigma_sq = pow(abs(ires-jres), 0.3);
+	  if (pass==1) {
+	    if (dE[0]==0.0 && dE[1]==0.0) continue;
 
-            // drsq < 12*Log[10]*sigma_sq ~= 27.6*sigma_sq
-            // this equivalent to having exp[-drsq/2*sigma_sq]=10^-6
-            if (drsq<27.6*amhgo_sigma_sq) {
+	    force = 0.0;
+	    if (dE[0]!=0.0) force += factor_i*dE[0];
+	    if (dE[1]!=0.0) {
+	      factor_j = -0.5*k_amh_go*amh_go_p*pow(atom_dens[j][DENS_AMHGO_EI], amh_go_p-1)/amh_go_norm[0];
+	      force += factor_j*dE[1];
+	    }
 
-              amhgo_gamma = amh_go_gamma->getGamma(ires_type, jres_type, ires-1, jres-1);
-              if (amh_go_gamma->error==amh_go_gamma->ERR_CALL) error->all(FLERR,"AMH-Go: Wrong call of getGamma() function");
+	    f[i][0] += force*dx[0];
+	    f[i][1] += force*dx[1];
+	    f[i][2] += force*dx[2];
 
-              Eij = amhgo_gamma*exp(-drsq/(2.0*amhgo_sigma_sq));
+	    f[j][0] -= force*dx[0];
+	    f[j][1] -= force*dx[1];
+	    f[j][2] -= force*dx[2];
+	    continue;
+	  }
 
-              force = Eij*dr/(amhgo_sigma_sq*r);
+	  dE[0] = dE[1] = 0.0;
+	  Eij = Eji = 0.0;
+	  r = sqrt(dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2]);
+	  amhgo_sigma_sq = amh_go_sigma_sq[k];
 
-              amh_go_force[0][0] += force*dx[0];
-              amh_go_force[0][1] += force*dx[1];
-              amh_go_force[0][2] += force*dx[2];
+	  // [0] is the pair as seen from i, [1] as seen from j
+	  dr = r - amh_go_rn[2*k];
+	  drsq = dr*dr;
 
-              amh_go_force[nforces][0] = -force*dx[0];
-              amh_go_force[nforces][1] = -force*dx[1];
-              amh_go_force[nforces][2] = -force*dx[2];
+	  // drsq < 12*Log[10]*sigma_sq ~= 27.6*sigma_sq
+	  // this equivalent to having exp[-drsq/2*sigma_sq]=10^-6
+	  if (amh_go_gm[2*k]!=0.0 && drsq<27.6*amhgo_sigma_sq) {
+	    Eij = amh_go_gm[2*k]*math_exp(-drsq/(2.0*amhgo_sigma_sq));
+	    dE[0] = Eij*dr/(amhgo_sigma_sq*r);
+	  }
 
-              amh_go_force_map[nforces] = j;
-              nforces++;
+	  if (amh_go_rn[2*k+1]==amh_go_rn[2*k] && amh_go_gm[2*k+1]==amh_go_gm[2*k]) {
+	    Eji = Eij;
+	    dE[1] = dE[0];
+	  } else {
+	    dr = r - amh_go_rn[2*k+1];
+	    drsq = dr*dr;
+	    if (amh_go_gm[2*k+1]!=0.0 && drsq<27.6*amhgo_sigma_sq) {
+	      Eji = amh_go_gm[2*k+1]*math_exp(-drsq/(2.0*amhgo_sigma_sq));
+	      dE[1] = Eji*dr/(amhgo_sigma_sq*r);
+	    }
+	  }
 
-              Ei += Eij;
-            }
-          }
-        }
+	  atom_dens[i][DENS_AMHGO_EI] += Eij;
+	  atom_dens[j][DENS_AMHGO_EI] += Eji;
+	}
       }
+    }
 
-      //BinZhang
-      //factor = -0.5*k_amh_go*amh_go_p*pow(Ei, amh_go_p-1)/amh_go_norm[imol-1];
-      factor = -0.5*k_amh_go*amh_go_p*pow(Ei, amh_go_p-1)/amh_go_norm[0];
-      for (k=0;k<nforces;k++) {
-        f[amh_go_force_map[k]][0] += factor*amh_go_force[k][0];
-        f[amh_go_force_map[k]][1] += factor*amh_go_force[k][1];
-        f[amh_go_force_map[k]][2] += factor*amh_go_force[k][2];
-      }
+    if (pass==0) {
+      dens_reverse_comm(DENS_AMHGO_EI, 1);
+      dens_forward_comm(DENS_AMHGO_EI, 1);
+    }
+  }
+
+  // every local C-Alpha and non-Glycine C-Beta holds its complete Ei
+  for (ires=0;ires<n;++ires) {
+    for (iatom=0;iatom<2;++iatom) {
+      if (iatom==1 && se[ires]=='G') continue;
+      i = res_atom_map[3*ires+iatom];
+      if (i==-1 || i>=nlocal) continue;
+      Ei = atom_dens[i][DENS_AMHGO_EI];
 
       //E += -0.5*k_amh_go*pow(Ei, amh_go_p)/amh_go_norm[imol-1];
       E += -0.5*k_amh_go*pow(Ei, amh_go_p)/amh_go_norm[0];
@@ -3993,6 +5071,8 @@ void FixBackbone::compute_amh_go_model()
 
 void FixBackbone::compute_vector_fragment_memory_potential(int i)
 {
+  double **f = force_buffer();
+  double *energy = energy_buffer();
   int j, js, je, i_fm;
   int i_resno, j_resno, ires_type, jres_type;
   double vi[3], vj[3], vmi, vmj, vmsqi, vmsqj, vp, vpn, gc, gf, dg;
@@ -4010,14 +5090,11 @@ void FixBackbone::compute_vector_fragment_memory_potential(int i)
     js = i+fm_gamma->minSep();
     je = frag->pos+frag->len-1;
     if (fm_gamma->maxSep()!=-1) je = MIN(je, i+fm_gamma->maxSep());
-    if (je>=n || res_no[je]-res_no[i]!=je-i) error->all(FLERR,"Missing residues in memory potential");
 
     for (j=js;j<=je;++j) {
       j_resno = res_no[j]-1;
       jres_type = se_map[se[j_resno]-'A'];
 
-      if (chain_no[i]!=chain_no[j]) error->all(FLERR,"Fragment Memory: Interaction between residues of different chains");
-
       if (se[i_resno]!='G' && se[j_resno]!='G' && frag->getSe(i_resno)!='G' && frag->getSe(j_resno)!='G') {
 	    vi[0] = xcb[i][0] - xca[i][0];
 	    vi[1] = xcb[i][1] - xca[i][1];
@@ -4037,12 +5114,10 @@ void FixBackbone::compute_vector_fragment_memory_potential(int i)
 	    gc = acos(vpn);
 
 	    gf = frag->VMf(i_resno, j_resno);
-	    if (frag->error==frag->ERR_CALL || frag->error==frag->ERR_VFM_GLY)
-	      error->all(FLERR,"Vector_Fragment_Memory: Wrong call of VMf() function");
 
 	    dg = gc - gf;
 
-	    V = -epsilon_k_weight*exp(-dg*dg/(2*vfm_sigma_sq));
+	    V = -epsilon_k_weight*math_exp(-dg*dg/(2*vfm_sigma_sq));
 
 	    energy[ET_VFRAGMEM] += V;
 
@@ -4076,257 +5151,734 @@ void FixBackbone::compute_vector_fragment_memory_potential(int i)
   }
 }
 
-void FixBackbone::compute_fragment_memory_potential(int i)
+// Flatten every fragment memory interaction into per-residue ranges of
+// (j, sites, rf, 1/(2*sigma^2), epsilon*k*weight*gamma). Depends on the
+// sequence only, so it is rebuilt after shuffling or mutation.
+void FixBackbone::build_fm_list()
 {
-  int j, js, je, i_fm, k, iatom[4], jatom[4], iatom_type[4], jatom_type[4];
-  int i_first_res, i_last_res, i_resno, j_resno, ires_type, jres_type;
-  double *xi[4], *xj[4], dx[3], r, rf, dr, drsq, V, force;
-  double fm_sigma_sq, frag_mem_gamma, epsilon_k_weight, epsilon_k_weight_gamma;
+  int i_resno, j_resno, i_fm, k, js, je, ich, ires_type, jres_type;
+  int itype[4], jtype[4];
+  double rf, frag_mem_gamma, epsilon_k_weight, eps;
   Fragment_Memory *frag;
 
-  iatom_type[0] = Fragment_Memory::FM_CA;
-  iatom_type[1] = Fragment_Memory::FM_CA;
-  iatom_type[2] = Fragment_Memory::FM_CB;
-  iatom_type[3] = Fragment_Memory::FM_CB;
+  itype[0] = itype[1] = Fragment_Memory::FM_CA;
+  itype[2] = itype[3] = Fragment_Memory::FM_CB;
+  jtype[0] = jtype[2] = Fragment_Memory::FM_CA;
+  jtype[1] = jtype[3] = Fragment_Memory::FM_CB;
 
-  jatom_type[0] = Fragment_Memory::FM_CA;
-  jatom_type[1] = Fragment_Memory::FM_CB;
-  jatom_type[2] = Fragment_Memory::FM_CA;
-  jatom_type[3] = Fragment_Memory::FM_CB;
+  if (!fm_list_start) fm_list_start = new int[n+1];
 
-  xi[0] = xca[i];
-  xi[1] = xca[i];
-  xi[2] = xcb[i];
-  xi[3] = xcb[i];
+  fm_list_n = 0;
+  for (i_resno=0;i_resno<n;++i_resno) {
+    fm_list_start[i_resno] = fm_list_n;
+    ires_type = se_map[se[i_resno]-'A'];
 
-  iatom[0] = alpha_carbons[i];
-  iatom[1] = alpha_carbons[i];
-  iatom[2] = beta_atoms[i];
-  iatom[3] = beta_atoms[i];
+    for (ich=0;ich<nch;++ich)
+      if (i_resno>=ch_pos[ich]-1 && i_resno<ch_pos[ich]-1+ch_len[ich]) break;
 
-  i_resno = res_no[i]-1;
-  ires_type = se_map[se[i_resno]-'A'];
+    for (i_fm=0; i_fm<ilen_fm_map[i_resno]; ++i_fm) {
+      frag = frag_mems[ frag_mem_map[i_resno][i_fm] ];
 
-  for (i_fm=0; i_fm<ilen_fm_map[i_resno]; ++i_fm) {
-    frag = frag_mems[ frag_mem_map[i_resno][i_fm] ];
+      epsilon_k_weight = epsilon*k_frag_mem*frag->weight;
 
-    epsilon_k_weight = epsilon*k_frag_mem*frag->weight;
+      js = i_resno+fm_gamma->minSep();
+      je = frag->pos+frag->len-1;
+      if (fm_gamma->maxSep()!=-1) je = MIN(je, i_resno+fm_gamma->maxSep());
+      if (je>=n) error->all(FLERR,"Missing residues in memory potential");
+      if (ich<nch && je>ch_pos[ich]-2+ch_len[ich]) error->all(FLERR,"Fragment Memory: Interaction between residues of different chains");
 
-    js = i+fm_gamma->minSep();
-    je = frag->pos+frag->len-1;
-    if (fm_gamma->maxSep()!=-1) je = MIN(je, i+fm_gamma->maxSep());
-    if (je>=n || res_no[je]-res_no[i]!=je-i) error->all(FLERR,"Missing residues in memory potential");
+      for (j_resno=js;j_resno<=je;++j_resno) {
+        jres_type = se_map[se[j_resno]-'A'];
 
-    for (j=js;j<=je;++j) {
-      j_resno = res_no[j]-1;
-      jres_type = se_map[se[j_resno]-'A'];
+        if (!fm_gamma->fourResTypes()) {
+          frag_mem_gamma = fm_gamma->gammaLookup(ires_type, jres_type, i_resno, j_resno);
+        } else {
+          frag_mem_gamma = fm_gamma->gammaLookup(ires_type, jres_type, frag->resType(i_resno), frag->resType(j_resno), i_resno, j_resno);
+        }
 
-      if (chain_no[i]!=chain_no[j]) error->all(FLERR,"Fragment Memory: Interaction between residues of different chains");
+        eps = epsilon_k_weight*frag_mem_gamma;
+        if (eps==0.0) continue;
 
-      fm_sigma_sq = pow(abs(i_resno-j_resno), 2*fm_sigma_exp);
+        for (k=0;k<4;++k) {
+          if ( itype[k]==frag->FM_CB && (se[i_resno]=='G' || frag->getSe(i_resno)=='G') ) continue;
+          if ( jtype[k]==frag->FM_CB && (se[j_resno]=='G' || frag->getSe(j_resno)=='G') ) continue;
 
-      if (!fm_gamma->fourResTypes()) {
-	frag_mem_gamma = fm_gamma->getGamma(ires_type, jres_type, i_resno, j_resno);
-      } else {
-	frag_mem_gamma = fm_gamma->getGamma(ires_type, jres_type, frag->resType(i_resno), frag->resType(j_resno), i_resno, j_resno);
-      }
-      if (fm_gamma->error==fm_gamma->ERR_CALL) error->all(FLERR,"Fragment_Memory: Wrong call of getGamma() function");
+          rf = frag->Rf(i_resno, itype[k], j_resno, jtype[k]);
+          if (frag->error==frag->ERR_CALL) error->all(FLERR,"Fragment_Memory: Wrong call of Rf() function");
+
+          if (fm_list_n==fm_list_max) {
+            fm_list_max += DELTA_FM_LIST;
+            memory->grow(fm_list_j,fm_list_max,"backbone:fm_list_j");
+            memory->grow(fm_list_sites,fm_list_max,"backbone:fm_list_sites");
+            memory->grow(fm_list_rf,fm_list_max,"backbone:fm_list_rf");
+            memory->grow(fm_list_inv2sigsq,fm_list_max,"backbone:fm_list_inv2sigsq");
+            memory->grow(fm_list_eps,fm_list_max,"backbone:fm_list_eps");
+          }
 
-      epsilon_k_weight_gamma = epsilon_k_weight*frag_mem_gamma;
+          fm_list_j[fm_list_n] = j_resno;
+          fm_list_sites[fm_list_n] = (itype[k]==frag->FM_CB ? 2 : 0) | (jtype[k]==frag->FM_CB ? 1 : 0);
+          fm_list_rf[fm_list_n] = rf;
+          fm_list_inv2sigsq[fm_list_n] = 0.5/fm_sigma_sq_sep[j_resno-i_resno];
+          fm_list_eps[fm_list_n] = eps;
+          fm_list_n++;
+        }
+      }
+    }
+  }
+  fm_list_start[n] = fm_list_n;
 
-      xj[0] = xca[j];
-      xj[1] = xcb[j];
-      xj[2] = xca[j];
-      xj[3] = xcb[j];
+  fm_list_dirty = false;
+}
 
-      jatom[0] = alpha_carbons[j];
-      jatom[1] = beta_atoms[j];
-      jatom[2] = alpha_carbons[j];
-      jatom[3] = beta_atoms[j];
+// The threaded residue loop cannot stop the run, so the partners of the
+// local residues in the chi and memory terms are checked here, serially,
+// after each reneighboring and after the memory list is rebuilt. Only the
+// rank that owns the residue sees the problem, hence error->one().
+void FixBackbone::check_residue_partners()
+{
+  int i, j, e, js, je, jl, i_fm, i_resno, j_resno, i_chno, jr0, jrn, sites, p, itb;
+  int *site_atoms[2] = {alpha_carbons, beta_atoms};
+  Fragment_Memory *frag;
 
-      for (k=0;k<4;++k) {
-	if ( iatom_type[k]==frag->FM_CB && (se[i_resno]=='G' || frag->getSe(i_resno)=='G') ) continue;
-	if ( jatom_type[k]==frag->FM_CB && (se[j_resno]=='G' || frag->getSe(j_resno)=='G') ) continue;
+  for (i=0;i<nn;++i) {
+    if (res_info[i]!=LOCAL) continue;
+    i_resno = res_no[i]-1;
+    i_chno = chain_no[i]-1;
 
-        dx[0] = xi[k][0] - xj[k][0];
-        dx[1] = xi[k][1] - xj[k][1];
-        dx[2] = xi[k][2] - xj[k][2];
+    if (chi_flag && !isFirst(i) && !isLast(i) && se[i_resno]!='G') {
+      jl = res_no_l[i_resno-1];
+      if (jl==-1 || alpha_carbons[jl]==-1 || oxygens[jl]==-1)
+        error->one(FLERR,"Chi: Missing atom! Increase pair cutoff and neighbor skin or check system integrity!");
+      jl = res_no_l[i_resno+1];
+      if (jl==-1 || alpha_carbons[jl]==-1)
+        error->one(FLERR,"Chi: Missing atom! Increase pair cutoff and neighbor skin or check system integrity!");
+    }
 
-        r = sqrt(dx[0]*dx[0]+dx[1]*dx[1]+dx[2]*dx[2]);
-        rf = frag->Rf(i_resno, iatom_type[k], j_resno, jatom_type[k]);
-        if (frag->error==frag->ERR_CALL) error->all(FLERR,"Fragment_Memory: Wrong call of Rf() function");
-        dr = r - rf;
-        drsq = dr*dr;
+    if (frag_mem_flag && !fm_list_dirty) {
+      for (e=fm_list_start[i_resno];e<fm_list_start[i_resno+1];++e) {
+        jl = res_no_l[fm_list_j[e]];
+        if (jl==-1) error->one(FLERR,"Missing residues in memory potential");
+        sites = fm_list_sites[e];
+        if (site_atoms[sites>>1][i]==-1 || site_atoms[sites&1][jl]==-1)
+          error->one(FLERR,"Fragment_Memory: Missing atom! Increase pair cutoff and neighbor skin or check system integrity!");
+      }
+    }
 
-        V = -epsilon_k_weight_gamma*exp(-drsq/(2.0*fm_sigma_sq));
+    if (vec_frag_mem_flag) {
+      for (i_fm=0; i_fm<ilen_fm_map[i_resno]; ++i_fm) {
+        frag = frag_mems[ frag_mem_map[i_resno][i_fm] ];
 
-        energy[ET_FRAGMEM] += V;
+        js = i+fm_gamma->minSep();
+        je = frag->pos+frag->len-1;
+        if (fm_gamma->maxSep()!=-1) je = MIN(je, i+fm_gamma->maxSep());
+        if (je>=n || res_no[je]-res_no[i]!=je-i) error->one(FLERR,"Missing residues in memory potential");
+
+        for (j=js;j<=je;++j) {
+          j_resno = res_no[j]-1;
+          if (chain_no[i]!=chain_no[j]) error->one(FLERR,"Fragment Memory: Interaction between residues of different chains");
+          if (se[i_resno]=='G' || se[j_resno]=='G' || frag->getSe(i_resno)=='G' || frag->getSe(j_resno)=='G') continue;
+
+          if (alpha_carbons[i]==-1 || beta_atoms[i]==-1 || alpha_carbons[j]==-1 || beta_atoms[j]==-1)
+            error->one(FLERR,"Vector_Fragment_Memory: Missing atom! Increase pair cutoff and neighbor skin or check system integrity!");
+          frag->VMf(i_resno, j_resno);
+          if (frag->error==frag->ERR_CALL || frag->error==frag->ERR_VFM_GLY)
+            error->one(FLERR,"Vector_Fragment_Memory: Wrong call of VMf() function");
+        }
+      }
+    }
 
-        force = V*dr/(fm_sigma_sq*r);
+    if (frag_mem_tb_flag) {
+      jr0 = i_resno+fm_gamma->minSep();
+      jrn = ch_pos[i_chno]+ch_len[i_chno]-2;
+      if (fm_gamma->maxSep()!=-1)
+        jrn = MIN(i_resno+fm_gamma->maxSep(), jrn);
 
-        f[iatom[k]][0] += force*dx[0];
-        f[iatom[k]][1] += force*dx[1];
-        f[iatom[k]][2] += force*dx[2];
+      for (j=jr0;j<=jrn;++j) {
+        jl = res_no_l[j];
+        if (jl==-1) error->one(FLERR,"Missing interaction in Table Fragment Memory (increase communication cutoff)");
+
+        // pairs without a table are skipped by table_fragment_memory()
+        if (fm_compact_flag) {
+          p = fm_compact_pair(i_resno, j-jr0);
+          if (p<0) continue;
+        } else {
+          itb = 4*tb_nbrs*i_resno + 4*(j-jr0);
+          if (!fm_table[itb]) continue;
+        }
 
-        f[jatom[k]][0] += -force*dx[0];
-        f[jatom[k]][1] += -force*dx[1];
-        f[jatom[k]][2] += -force*dx[2];
+        if (alpha_carbons[i]==-1 || alpha_carbons[jl]==-1 || (se[i_resno]!='G' && beta_atoms[i]==-1) || (se[j]!='G' && beta_atoms[jl]==-1))
+          error->one(FLERR,"FM table: Missing atom! Increase pair cutoff and neighbor skin or check system integrity!");
       }
     }
   }
 }
 
+void FixBackbone::compute_fragment_memory_potential(int i)
+{
+  double **f = force_buffer();
+  double *energy = energy_buffer();
+  int e, jl, ia, ja, sites, i_resno;
+  double *xi, *xj, dx[3], r, dr, V, force, E;
+  double **xsite[2] = {xca, xcb};
+  int *site_atoms[2] = {alpha_carbons, beta_atoms};
+
+  i_resno = res_no[i]-1;
+
+  E = 0.0;
+  for (e=fm_list_start[i_resno];e<fm_list_start[i_resno+1];++e) {
+    jl = res_no_l[fm_list_j[e]];
+
+    sites = fm_list_sites[e];
+    xi = xsite[sites>>1][i];
+    xj = xsite[sites&1][jl];
+    ia = site_atoms[sites>>1][i];
+    ja = site_atoms[sites&1][jl];
+
+    dx[0] = xi[0] - xj[0];
+    dx[1] = xi[1] - xj[1];
+    dx[2] = xi[2] - xj[2];
+
+    r = sqrt(dx[0]*dx[0]+dx[1]*dx[1]+dx[2]*dx[2]);
+    dr = r - fm_list_rf[e];
+
+    V = -fm_list_eps[e]*math_exp(-dr*dr*fm_list_inv2sigsq[e]);
+    E += V;
+
+    force = 2.0*V*dr*fm_list_inv2sigsq[e]/r;
+
+    f[ia][0] += force*dx[0];
+    f[ia][1] += force*dx[1];
+    f[ia][2] += force*dx[2];
+
+    f[ja][0] -= force*dx[0];
+    f[ja][1] -= force*dx[1];
+    f[ja][2] -= force*dx[2];
+  }
+
+  energy[ET_FRAGMEM] += E;
+}
+
+// The text files have a row for every table, so the tables are read into
+// one block. With Shared_Memory the node leader reads it into a segment
+// that the other ranks of the node map.
 void FixBackbone::read_fragment_memory_table()
 {
-  int itb,ir,ntb_tot;
+  int itb, ntb_tot, iwin;
+  size_t k, nval;
   double val;
 
   ntb_tot = 4*n*tb_nbrs;
+  nval = (size_t)ntb_tot*tb_size;
+
+  iwin = -1;
+  if (shm_flag) {
+    fm_table_data = (TBV *) shm_allocate(nval*sizeof(TBV), iwin);
+  } else {
+    fm_table_data = new TBV[nval];
+  }
 
-  // Reading Fragmnet Memory Tabale energies
+  if (!shm_flag || shm_me==0) {
+    shm_reading = shm_flag;
+    memset(fm_table_data, 0, nval*sizeof(TBV));
 
-  ifstream infmeng("fm_table.energy");
-  if (!infmeng) error->all(FLERR,"Fragment memory table files not found!");
+    // Reading Fragmnet Memory Tabale energies
 
-  ir = 0;
-  itb = 0;
-  while (!infmeng.eof()) {
-    infmeng >> val;
-    if (infmeng.eof()) break;
+    ifstream infmeng("fm_table.energy");
+    if (!infmeng) read_error(FLERR,"Fragment memory table files not found!");
 
-    if (ir!=0 && ir%tb_size==0) {
-      ir = 0;
-      itb++;
+    k = 0;
+    while (infmeng >> val) {
+      if (k>=nval) read_error(FLERR,"Fragment memory table file format error!");
+      fm_table_data[k++].energy = val;
     }
+    infmeng.close();
+    if (k==0 || k%tb_size!=0) read_error(FLERR,"Fragment memory table file format error!");
+
+
+    // Reading Fragmnet Memory Tabale forces
 
-    if (itb>=ntb_tot) error->all(FLERR,"Fragment memory table file format error!");
+    ifstream infmforce("fm_table.force");
+    if (!infmforce) read_error(FLERR,"Fragment memory table files not found!");
 
-    if (!fm_table[itb]) fm_table[itb] = new TBV[tb_size];
+    k = 0;
+    while (infmforce >> val) {
+      if (k>=nval) read_error(FLERR,"Fragment memory table file format error!");
+      fm_table_data[k++].force = val;
+    }
+    infmforce.close();
+    if (k==0 || k%tb_size!=0) read_error(FLERR,"Fragment memory table file format error!");
 
-    fm_table[itb][ir].energy = val;
-    ir++;
+    shm_reading = false;
   }
-  infmeng.close();
-  if (itb!=ntb_tot-1 && ir!=tb_size) error->all(FLERR,"Fragment memory table file format error!");
+  if (shm_flag) shm_sync(iwin);
+
+  for (itb=0;itb<ntb_tot;++itb)
+    fm_table[itb] = fm_table_data + (size_t)itb*tb_size;
+}
 
+// Number the non-empty FM tables in residue order; tb_slot[itb] is the
+// table number of (i, j, atom pair) itb or -1, res_first[i] is the number
+// of the first table of residue i. Returns the number of tables.
+int FixBackbone::fm_table_layout(int *tb_slot, int *res_first)
+{
+  int i, j, js, je, i_fm, k, itb, ntables;
+  Fragment_Memory *frag;
 
-  // Reading Fragmnet Memory Tabale forces
+  for (itb=0;itb<4*n*tb_nbrs;++itb) tb_slot[itb] = -1;
 
-  ifstream infmforce("fm_table.force");
-  if (!infmforce) error->all(FLERR,"Fragment memory table files not found!");
+  for (i=0; i<n; ++i) {
+    for (i_fm=0; i_fm<ilen_fm_map[i]; ++i_fm) {
+      frag = frag_mems[ frag_mem_map[i][i_fm] ];
 
-  ir = 0;
-  itb = 0;
-  while (!infmforce.eof()) {
-    infmforce >> val;
-    if (infmforce.eof()) break;
+      js = i+fm_gamma->minSep();
+      je = frag->pos+frag->len-1;
+      if (fm_gamma->maxSep()!=-1) je = MIN(je, i+fm_gamma->maxSep());
+      if (je>=n) error->all(FLERR,"Missing residues in memory potential");
 
-    if (ir!=0 && ir%tb_size==0) {
-      ir = 0;
-      itb++;
+      for (j=js;j<=je;++j) {
+	for (k=0;k<4;++k) {
+	  if ( fm_table_iatom[k]==frag->FM_CB && (se[i]=='G' || frag->getSe(i)=='G') ) continue;
+	  if ( fm_table_jatom[k]==frag->FM_CB && (se[j]=='G' || frag->getSe(j)=='G') ) continue;
+	  tb_slot[4*tb_nbrs*i + 4*(j-js) + k] = 0;
+	}
+      }
     }
+  }
+
+  ntables = 0;
+  for (i=0; i<n; ++i) {
+    res_first[i] = ntables;
+    for (itb=4*tb_nbrs*i;itb<4*tb_nbrs*(i+1);++itb)
+      if (tb_slot[itb]==0) tb_slot[itb] = ntables++;
+  }
+  res_first[n] = ntables;
+
+  return ntables;
+}
 
-    if (itb>=ntb_tot) error->all(FLERR,"Fragment memory table file format error!");
+// Split the residues whose first table is in t0..t0+nt-1 into nparts
+// contiguous ranges; residue i goes to the part owning its first table, so
+// every part gets about nt/nparts tables
+static void fm_table_split(int n, int *res_first, int t0, int nt, int nparts, int *counts, int *displs)
+{
+  int i, k;
 
-    fm_table[itb][ir].force = val;
-    ir++;
+  for (k=0;k<nparts;++k) counts[k] = 0;
+  for (i=0; i<n; ++i) {
+    if (res_first[i]<t0 || res_first[i]>=t0+nt) continue;
+    k = (int)((double)(res_first[i]-t0)*nparts/nt);
+    k = MIN(k, nparts-1);
+    counts[k] += res_first[i+1] - res_first[i];
   }
-  infmforce.close();
-  if (itb!=ntb_tot-1 && ir!=tb_size) error->all(FLERR,"Fragment memory table file format error!");
+  displs[0] = t0;
+  for (k=1;k<nparts;++k) displs[k] = displs[k-1] + counts[k-1];
 }
 
-void FixBackbone::compute_fragment_memory_table()
+// Tables first..last-1 are computed by this rank. counts and displs give the
+// blocks assembled by fm_table_gather(): one per rank, or one per node with
+// Shared_Memory, where the node block is split again between its ranks.
+void FixBackbone::fm_table_partition(int *res_first, int ntables, int *counts, int *displs, int &first, int &last)
 {
-  int i, j, js, je, ir, i_fm, k, itb, iatom[4], jatom[4], iatom_type[4], jatom_type[4];
-  int i_first_res, i_last_res, i_resno, j_resno, ires_type, jres_type;
-  double r, rf, dr, drsq, V, force;
-  double fm_sigma_sq, frag_mem_gamma, epsilon_k_weight, epsilon_k_weight_gamma;
-  Fragment_Memory *frag;
+  int *node_counts, *node_displs;
+
+  if (shm_flag) {
+    fm_table_split(n, res_first, 0, ntables, shm_nnodes, counts, displs);
+
+    node_counts = new int[shm_nprocs];
+    node_displs = new int[shm_nprocs];
+    fm_table_split(n, res_first, displs[shm_node], counts[shm_node], shm_nprocs, node_counts, node_displs);
+    first = node_displs[shm_me];
+    last = first + node_counts[shm_me];
+    delete [] node_counts;
+    delete [] node_displs;
+  } else {
+    fm_table_split(n, res_first, 0, ntables, comm->nprocs, counts, displs);
+    first = displs[comm->me];
+    last = first + counts[comm->me];
+  }
+}
 
-  iatom_type[0] = Fragment_Memory::FM_CA;
-  iatom_type[1] = Fragment_Memory::FM_CA;
-  iatom_type[2] = Fragment_Memory::FM_CB;
-  iatom_type[3] = Fragment_Memory::FM_CB;
+// Assemble a table block in which every rank has filled its own range. With
+// Shared_Memory the ranks of a node write into one segment, so only the node
+// leaders exchange data.
+void FixBackbone::fm_table_gather(void *data, int *counts, int *displs, MPI_Datatype type, int iwin)
+{
+  if (shm_flag) {
+    shm_sync(iwin);
+    if (shm_me==0) MPI_Allgatherv(MPI_IN_PLACE, 0, type, data, counts, displs, type, shm_leader_comm);
+    shm_sync(iwin);
+  } else {
+    MPI_Allgatherv(MPI_IN_PLACE, 0, type, data, counts, displs, type, world);
+  }
+}
 
-  jatom_type[0] = Fragment_Memory::FM_CA;
-  jatom_type[1] = Fragment_Memory::FM_CB;
-  jatom_type[2] = Fragment_Memory::FM_CA;
-  jatom_type[3] = Fragment_Memory::FM_CB;
+// Collect the Gaussian wells of tables first..last-1 as (table, rf, sigma_sq,
+// eps) entries. This runs serially, so that every Rf() error is raised
+// outside the threaded loops. Returns the number of entries.
+int FixBackbone::fm_table_contributions(int first, int last, int *tb_slot, int *res_first,
+					int *&c_slot, double *&c_rf, double *&c_sigma_sq, double *&c_eps)
+{
+  int i, j, js, je, i_fm, k, itb, ires_type, jres_type, nc, nc_max;
+  double rf, fm_sigma_sq, frag_mem_gamma, epsilon_k_weight;
+  Fragment_Memory *frag;
+
+  nc = nc_max = 0;
+  c_slot = NULL;
+  c_rf = c_sigma_sq = c_eps = NULL;
 
   for (i=0; i<n; ++i) {
-    iatom[0] = alpha_carbons[i];
-    iatom[1] = alpha_carbons[i];
-    iatom[2] = beta_atoms[i];
-    iatom[3] = beta_atoms[i];
+    if (res_first[i]<first || res_first[i]>=last) continue;
 
-    i_resno = i;
-    ires_type = se_map[se[i_resno]-'A'];
+    ires_type = se_map[se[i]-'A'];
 
-    for (i_fm=0; i_fm<ilen_fm_map[i_resno]; ++i_fm) {
-      frag = frag_mems[ frag_mem_map[i_resno][i_fm] ];
+    for (i_fm=0; i_fm<ilen_fm_map[i]; ++i_fm) {
+      frag = frag_mems[ frag_mem_map[i][i_fm] ];
 
       epsilon_k_weight = epsilon*k_frag_mem*frag->weight;
 
       js = i+fm_gamma->minSep();
       je = frag->pos+frag->len-1;
       if (fm_gamma->maxSep()!=-1) je = MIN(je, i+fm_gamma->maxSep());
-      if (je>=n) error->all(FLERR,"Missing residues in memory potential");
 
       for (j=js;j<=je;++j) {
-	j_resno = j;
-	jres_type = se_map[se[j_resno]-'A'];
+	jres_type = se_map[se[j]-'A'];
 
-	fm_sigma_sq = pow(abs(i_resno-j_resno), 2*fm_sigma_exp);
+	fm_sigma_sq = fm_sigma_sq_sep[abs(i-j)];
 	fm_sigma_sq = fm_sigma_sq*frag_table_well_width*frag_table_well_width;
 
 	if (!fm_gamma->fourResTypes()) {
-	  frag_mem_gamma = fm_gamma->getGamma(ires_type, jres_type, i_resno, j_resno);
+	  frag_mem_gamma = fm_gamma->gammaLookup(ires_type, jres_type, i, j);
 	} else {
-	  frag_mem_gamma = fm_gamma->getGamma(ires_type, jres_type, frag->resType(i_resno), frag->resType(j_resno), i_resno, j_resno);
+	  frag_mem_gamma = fm_gamma->gammaLookup(ires_type, jres_type, frag->resType(i), frag->resType(j), i, j);
 	}
-	if (fm_gamma->error==fm_gamma->ERR_CALL) error->all(FLERR,"Fragment_Memory: Wrong call of getGamma() function");
 
-	epsilon_k_weight_gamma = epsilon_k_weight*frag_mem_gamma;
+	for (k=0;k<4;++k) {
+	  itb = 4*tb_nbrs*i + 4*(j-js) + k;
+	  if (tb_slot[itb]<0) continue;
 
-	jatom[0] = alpha_carbons[j];
-	jatom[1] = beta_atoms[j];
-	jatom[2] = alpha_carbons[j];
-	jatom[3] = beta_atoms[j];
+	  rf = frag->Rf(i, fm_table_iatom[k], j, fm_table_jatom[k]);
+	  if (frag->error==frag->ERR_CALL) error->one(FLERR,"Fragment_Memory: Wrong call of Rf() function");
 
-	for (k=0;k<4;++k) {
-	  if ( iatom_type[k]==frag->FM_CB && (se[i_resno]=='G' || frag->getSe(i_resno)=='G') ) continue;
-	  if ( jatom_type[k]==frag->FM_CB && (se[j_resno]=='G' || frag->getSe(j_resno)=='G') ) continue;
+	  if (nc==nc_max) {
+	    nc_max += DELTA_FM_LIST;
+	    memory->grow(c_slot,nc_max,"backbone:c_slot");
+	    memory->grow(c_rf,nc_max,"backbone:c_rf");
+	    memory->grow(c_sigma_sq,nc_max,"backbone:c_sigma_sq");
+	    memory->grow(c_eps,nc_max,"backbone:c_eps");
+	  }
+	  c_slot[nc] = tb_slot[itb];
+	  c_rf[nc] = rf;
+	  c_sigma_sq[nc] = fm_sigma_sq;
+	  c_eps[nc] = epsilon_k_weight*frag_mem_gamma;
+	  nc++;
+	}
+      }
+    }
+  }
 
-	  itb = 4*tb_nbrs*i + 4*(j-js) + k;
-	  if (!fm_table[itb])
-	    fm_table[itb] = new TBV[tb_size];
+  return nc;
+}
 
-	  rf = frag->Rf(i_resno, iatom_type[k], j_resno, jatom_type[k]);
-	  if (frag->error==frag->ERR_CALL) error->all(FLERR,"Fragment_Memory: Wrong call of Rf() function");
-	  for (ir=0;ir<tb_size;++ir) {
-	    r = tb_rmin + ir*tb_dr;
+// Build the FM table in parallel. All ranks allocate the non-empty tables
+// in one block ordered by residue, each rank fills its share of the tables
+// with threads splitting the grid points, and the block is then assembled
+// with MPI_Allgatherv.
+void FixBackbone::compute_fragment_memory_table()
+{
+  int ir, c, itb, ntb_tot, ntables, nc, first, last, nprocs, iwin;
+  int *tb_slot, *res_first, *recvcounts, *displs, *c_slot;
+  double r, dr, V;
+  double *c_rf, *c_sigma_sq, *c_eps;
+  TBV *tb;
+  MPI_Datatype tb_type;
 
-	    dr = r - rf;
-	    drsq = dr*dr;
+  if (fm_compact_flag) {
+    compute_fragment_memory_compact_table();
+    return;
+  }
 
-	    V = -epsilon_k_weight_gamma*exp(-drsq/(2*fm_sigma_sq));
+  nprocs = comm->nprocs;
+  ntb_tot = 4*n*tb_nbrs;
 
-	    fm_table[itb][ir].energy += V;
+  tb_slot = new int[ntb_tot];
+  res_first = new int[n+1];
+  ntables = fm_table_layout(tb_slot, res_first);
 
-	    fm_table[itb][ir].force += V*dr/(fm_sigma_sq*r);
-	  }
+  iwin = -1;
+  if (shm_flag) {
+    fm_table_data = (TBV *) shm_allocate((size_t)ntables*tb_size*sizeof(TBV), iwin);
+    if (shm_me==0) memset(fm_table_data, 0, (size_t)ntables*tb_size*sizeof(TBV));
+    shm_sync(iwin);
+  } else {
+    fm_table_data = new TBV[(size_t)ntables*tb_size];
+  }
+  for (itb=0;itb<ntb_tot;++itb)
+    fm_table[itb] = (tb_slot[itb]<0 ? NULL : fm_table_data + (size_t)tb_slot[itb]*tb_size);
+
+  recvcounts = new int[nprocs];
+  displs = new int[nprocs];
+  fm_table_partition(res_first, ntables, recvcounts, displs, first, last);
+
+  nc = fm_table_contributions(first, last, tb_slot, res_first, c_slot, c_rf, c_sigma_sq, c_eps);
+
+  // threads own disjoint grid points, so the sums need no atomics
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(nthreads) if(nthreads>1) schedule(static) private(c, r, dr, V, tb)
+#endif
+  for (ir=0;ir<tb_size;++ir) {
+    r = tb_rmin + ir*tb_dr;
+    for (c=0;c<nc;++c) {
+      tb = fm_table_data + (size_t)c_slot[c]*tb_size;
+      dr = r - c_rf[c];
+      V = -c_eps[c]*exp(-dr*dr/(2*c_sigma_sq[c]));
+
+      tb[ir].energy += V;
+      tb[ir].force += V*dr/(c_sigma_sq[c]*r);
+    }
+  }
+
+  MPI_Type_contiguous(2*tb_size, MPI_DOUBLE, &tb_type);
+  MPI_Type_commit(&tb_type);
+  fm_table_gather(fm_table_data, recvcounts, displs, tb_type, iwin);
+  MPI_Type_free(&tb_type);
+
+  memory->destroy(c_slot);
+  memory->destroy(c_rf);
+  memory->destroy(c_sigma_sq);
+  memory->destroy(c_eps);
+  delete [] tb_slot;
+  delete [] res_first;
+  delete [] recvcounts;
+  delete [] displs;
+
+  if (fm_use_table_flag==2) write_fragment_memory_table_binary();
+  else if (fm_use_table_flag) output_fragment_memory_table();
+}
+
+// Compact FM table: only the (i, j) pairs with a non-empty table are kept,
+// in CSR form (fmc_row over residues, fmc_col holds j-i-minSep, fmc_slot
+// the four atom pair tables of every pair). Each table stores the energy
+// and dV/dr as float arrays on a grid of spacing fmc_dr and is evaluated
+// by cubic Hermite interpolation. The interpolation error is estimated at
+// the midpoint of every grid interval and written to fm_table_error.dat.
+void FixBackbone::compute_fragment_memory_compact_table()
+{
+  int i, k, p, t, ir, c, itb, ntb_tot, nc, first, last, nlocal_tb, nprocs, me, iwin;
+  size_t nbytes, g, ng;
+  int *tb_slot, *res_first, *recvcounts, *displs, *c_slot;
+  double r, dr, V, dV, u, e0, e1, d0, d1, err_max[2], mbytes;
+  double *c_rf, *c_sigma_sq, *c_eps, *ebuf, *dbuf, *emid, *dmid, *err;
+  float *fe, *fd;
+  FILE *errfile;
+  MPI_Datatype tb_type;
+
+  me = comm->me;
+  nprocs = comm->nprocs;
+  ntb_tot = 4*n*tb_nbrs;
+
+  tb_slot = new int[ntb_tot];
+  res_first = new int[n+1];
+  fmc_ntables = fm_table_layout(tb_slot, res_first);
+
+  // CSR index of the non-empty (i, j) pairs
+  fmc_row = new int[n+1];
+  fmc_npairs = 0;
+  for (i=0; i<n; ++i) {
+    fmc_row[i] = fmc_npairs;
+    for (p=0;p<tb_nbrs;++p) {
+      itb = 4*tb_nbrs*i + 4*p;
+      if (tb_slot[itb]>=0 || tb_slot[itb+1]>=0 || tb_slot[itb+2]>=0 || tb_slot[itb+3]>=0) fmc_npairs++;
+    }
+  }
+  fmc_row[n] = fmc_npairs;
+
+  fmc_col = new int[fmc_npairs];
+  fmc_slot = new int[4*fmc_npairs];
+  c = 0;
+  for (i=0; i<n; ++i) {
+    for (p=0;p<tb_nbrs;++p) {
+      itb = 4*tb_nbrs*i + 4*p;
+      if (tb_slot[itb]<0 && tb_slot[itb+1]<0 && tb_slot[itb+2]<0 && tb_slot[itb+3]<0) continue;
+      fmc_col[c] = p;
+      for (k=0;k<4;++k) fmc_slot[4*c+k] = tb_slot[itb+k];
+      c++;
+    }
+  }
+
+  iwin = -1;
+  if (shm_flag) {
+    // one segment: fmc_err first to keep the doubles aligned, then fmc_e and fmc_d
+    nbytes = 2*sizeof(double)*fmc_ntables + 2*sizeof(float)*fmc_ntables*fmc_size;
+    fmc_err = (double *) shm_allocate(nbytes, iwin);
+    if (shm_me==0) memset(fmc_err, 0, nbytes);
+    shm_sync(iwin);
+    fmc_e = (float *) (fmc_err + 2*fmc_ntables);
+    fmc_d = fmc_e + (size_t)fmc_ntables*fmc_size;
+  } else {
+    fmc_e = new float[(size_t)fmc_ntables*fmc_size];
+    fmc_d = new float[(size_t)fmc_ntables*fmc_size];
+    fmc_err = new double[2*fmc_ntables];
+  }
+
+  recvcounts = new int[nprocs];
+  displs = new int[nprocs];
+  fm_table_partition(res_first, fmc_ntables, recvcounts, displs, first, last);
+  nlocal_tb = last - first;
+
+  nc = fm_table_contributions(first, last, tb_slot, res_first, c_slot, c_rf, c_sigma_sq, c_eps);
+
+  // exact energy and dV/dr on the grid nodes and on the interval midpoints
+  // grid points of the local tables, indexed in size_t since the count
+  // can exceed INT_MAX for large memories on few ranks
+  ng = (size_t)nlocal_tb*fmc_size;
+  ebuf = new double[ng];
+  dbuf = new double[ng];
+  emid = new double[ng];
+  dmid = new double[ng];
+  for (g=0;g<ng;++g) ebuf[g] = dbuf[g] = emid[g] = dmid[g] = 0.0;
+
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(nthreads) if(nthreads>1) schedule(static) private(c, g, r, dr, V)
+#endif
+  for (ir=0;ir<fmc_size;++ir) {
+    for (c=0;c<nc;++c) {
+      g = (size_t)(c_slot[c]-first)*fmc_size + ir;
+
+      r = tb_rmin + ir*fmc_dr;
+      dr = r - c_rf[c];
+      V = -c_eps[c]*exp(-dr*dr/(2*c_sigma_sq[c]));
+      ebuf[g] += V;
+      dbuf[g] += -V*dr/c_sigma_sq[c];
+
+      r += 0.5*fmc_dr;
+      dr = r - c_rf[c];
+      V = -c_eps[c]*exp(-dr*dr/(2*c_sigma_sq[c]));
+      emid[g] += V;
+      dmid[g] += -V*dr/c_sigma_sq[c];
+    }
+  }
+
+  // round to float and compare the interpolated midpoints with the exact values
+  fe = fmc_e + (size_t)first*fmc_size;
+  fd = fmc_d + (size_t)first*fmc_size;
+  err = fmc_err + 2*first;
+  for (g=0;g<ng;++g) {
+    fe[g] = (float)ebuf[g];
+    fd[g] = (float)dbuf[g];
+  }
+  u = 0.5;
+  for (t=0;t<nlocal_tb;++t) {
+    err[2*t] = err[2*t+1] = 0.0;
+    for (ir=0;ir<fmc_size-1;++ir) {
+      g = (size_t)t*fmc_size + ir;
+      e0 = fe[g]; e1 = fe[g+1];
+      d0 = fmc_dr*fd[g]; d1 = fmc_dr*fd[g+1];
+      V = (2*u*u*u-3*u*u+1)*e0 + (u*u*u-2*u*u+u)*d0 + (-2*u*u*u+3*u*u)*e1 + (u*u*u-u*u)*d1;
+      dV = ((6*u*u-6*u)*e0 + (3*u*u-4*u+1)*d0 + (-6*u*u+6*u)*e1 + (3*u*u-2*u)*d1)/fmc_dr;
+      err[2*t] = MAX(err[2*t], fabs(V-emid[g]));
+      err[2*t+1] = MAX(err[2*t+1], fabs(dV-dmid[g]));
+    }
+  }
+
+  MPI_Type_contiguous(fmc_size, MPI_FLOAT, &tb_type);
+  MPI_Type_commit(&tb_type);
+  fm_table_gather(fmc_e, recvcounts, displs, tb_type, iwin);
+  fm_table_gather(fmc_d, recvcounts, displs, tb_type, iwin);
+  MPI_Type_free(&tb_type);
+
+  MPI_Type_contiguous(2, MPI_DOUBLE, &tb_type);
+  MPI_Type_commit(&tb_type);
+  fm_table_gather(fmc_err, recvcounts, displs, tb_type, iwin);
+  MPI_Type_free(&tb_type);
+
+  if (me==0) {
+    errfile = fopen("fm_table_error.dat", "w");
+    if (errfile==NULL) error->one(FLERR,"Cannot open fm_table_error.dat");
+    fprintf(errfile, "# i j atom_pair max_err_energy max_err_dVdr\n");
+
+    err_max[0] = err_max[1] = 0.0;
+    for (i=0; i<n; ++i) {
+      for (p=fmc_row[i];p<fmc_row[i+1];++p) {
+	for (k=0;k<4;++k) {
+	  t = fmc_slot[4*p+k];
+	  if (t<0) continue;
+	  fprintf(errfile, "%d %d %d %g %g\n", i+1, i+1+fmc_col[p]+fm_gamma->minSep(), k, fmc_err[2*t], fmc_err[2*t+1]);
+	  err_max[0] = MAX(err_max[0], fmc_err[2*t]);
+	  err_max[1] = MAX(err_max[1], fmc_err[2*t+1]);
 	}
       }
     }
+    fclose(errfile);
+
+    mbytes = (2.0*sizeof(float)*fmc_ntables*fmc_size + 5.0*sizeof(int)*fmc_npairs)/1048576.0;
+    if (screen) {
+      fprintf(screen, "Compact FM table: %d tables, %d points each, %.1f MB\n", fmc_ntables, fmc_size, mbytes);
+      fprintf(screen, "Compact FM table: max interpolation error %g (energy), %g (dV/dr)\n", err_max[0], err_max[1]);
+    }
+    if (logfile) {
+      fprintf(logfile, "Compact FM table: %d tables, %d points each, %.1f MB\n", fmc_ntables, fmc_size, mbytes);
+      fprintf(logfile, "Compact FM table: max interpolation error %g (energy), %g (dV/dr)\n", err_max[0], err_max[1]);
+    }
+  }
+
+  memory->destroy(c_slot);
+  memory->destroy(c_rf);
+  memory->destroy(c_sigma_sq);
+  memory->destroy(c_eps);
+  delete [] ebuf;
+  delete [] dbuf;
+  delete [] emid;
+  delete [] dmid;
+  delete [] tb_slot;
+  delete [] res_first;
+  delete [] recvcounts;
+  delete [] displs;
+}
+
+// Position of the (i, j) pair in the compact FM table or -1, where tb_j is
+// j-i-minSep
+inline int FixBackbone::fm_compact_pair(int tb_i, int tb_j)
+{
+  int lo = fmc_row[tb_i], hi = fmc_row[tb_i+1]-1, mid;
+
+  while (lo<=hi) {
+    mid = (lo+hi)/2;
+    if (fmc_col[mid]==tb_j) return mid;
+    if (fmc_col[mid]<tb_j) lo = mid+1;
+    else hi = mid-1;
   }
-  if (fm_use_table_flag) output_fragment_memory_table();
+  return -1;
+}
+
+// Cubic Hermite interpolation of compact table t at r
+inline void FixBackbone::fm_compact_eval(int t, double r, double &V, double &dV)
+{
+  int ir;
+  double x, u, u2, u3, e0, e1, d0, d1;
+  const float *fe, *fd;
+
+  x = (r-tb_rmin)/fmc_dr;
+  ir = MIN((int)x, fmc_size-2);
+  u = x - ir;
+  u2 = u*u;
+  u3 = u2*u;
+
+  fe = fmc_e + (size_t)t*fmc_size + ir;
+  fd = fmc_d + (size_t)t*fmc_size + ir;
+  e0 = fe[0]; e1 = fe[1];
+  d0 = fmc_dr*fd[0]; d1 = fmc_dr*fd[1];
+
+  V = (2*u3-3*u2+1)*e0 + (u3-2*u2+u)*d0 + (-2*u3+3*u2)*e1 + (u3-u2)*d1;
+  dV = ((6*u2-6*u)*e0 + (3*u2-4*u+1)*d0 + (-6*u2+6*u)*e1 + (3*u2-2*u)*d1)/fmc_dr;
 }
 
 void FixBackbone::table_fragment_memory(int i, int j)
 {
-  int k, i_resno, j_resno, tb_i, tb_j, itb, iatom_type[4], jatom_type[4], iatom[4], jatom[4], ir;
+  double **f = force_buffer();
+  double *energy = energy_buffer();
+  int k, i_resno, j_resno, tb_i, tb_j, itb, iatom_type[4], jatom_type[4], iatom[4], jatom[4], ir, p;
   double *xi[4], *xj[4], dx[3], r, r1, r2;
-  double V, ff, v1, v2, f1, f2;
+  double V, dV, ff, v1, v2, f1, f2;
 
   i_resno = res_no[i]-1;
   j_resno = res_no[j]-1;
@@ -4337,12 +5889,13 @@ void FixBackbone::table_fragment_memory(int i, int j)
   tb_i = i_resno;
   tb_j = j_resno - i_resno - fm_gamma->minSep();
 
-  itb = 4*tb_nbrs*tb_i + 4*tb_j;
-  if (!fm_table[itb]) return;
-
-  if (alpha_carbons[i]==-1 || alpha_carbons[j]==-1 || (se[i_resno]!='G' && beta_atoms[i]==-1) || (se[j_resno]!='G' && beta_atoms[j]==-1)) {
-    if (comm->me==0) print_log("FM table: Missing atom! Increase pair cutoff and neighbor skin or check system integrity!\n");
-    error->all(FLERR,"FM table: Missing atom! Increase pair cutoff and neighbor skin or check system integrity!");
+  p = -1;
+  if (fm_compact_flag) {
+    p = fm_compact_pair(tb_i, tb_j);
+    if (p<0) return;
+  } else {
+    itb = 4*tb_nbrs*tb_i + 4*tb_j;
+    if (!fm_table[itb]) return;
   }
 
   iatom_type[0] = Fragment_Memory::FM_CA;
@@ -4386,14 +5939,35 @@ void FixBackbone::table_fragment_memory(int i, int j)
 
     r = sqrt(dx[0]*dx[0]+dx[1]*dx[1]+dx[2]*dx[2]);
 
-    if (r>=tb_rmin && r<=tb_rmax) {
+    if (fm_compact_flag && r>=tb_rmin && r<=tb_rmax) {
+      if (fmc_slot[4*p+k]<0) return;
+
+      fm_compact_eval(fmc_slot[4*p+k], r, V, dV);
+      ff = -dV/r;
+
+      energy[ET_FRAGMEM] += V;
+
+      f[iatom[k]][0] += ff*dx[0];
+      f[iatom[k]][1] += ff*dx[1];
+      f[iatom[k]][2] += ff*dx[2];
+
+      f[jatom[k]][0] += -ff*dx[0];
+      f[jatom[k]][1] += -ff*dx[1];
+      f[jatom[k]][2] += -ff*dx[2];
+    } else if (r>=tb_rmin && r<=tb_rmax) {
       ir = int((r-tb_rmin)/tb_dr);
 
       itb = 4*tb_nbrs*tb_i + 4*tb_j + k;
 
       if (!fm_table[itb]) return;
 
-      if (ir<0 || ir>=tb_size) error->all(FLERR,"Table Fragment Memory: ir is out of range.");
+      if (ir<0 || ir>=tb_size) {
+#if defined(_OPENMP)
+#pragma omp atomic write
+#endif
+        fm_tb_range_error = 1;
+        continue;
+      }
 
       // Energy and force values are obtained from trangle interpolation
       r1 = tb_rmin + (double)ir*tb_dr;
@@ -4419,11 +5993,11 @@ void FixBackbone::table_fragment_memory(int i, int j)
       f[jatom[k]][1] += -ff*dx[1];
       f[jatom[k]][2] += -ff*dx[2];
     } else {
-      if (comm->me==0) {
-        if (screen) fprintf(screen, "r=%f\n", r);
-        if (logfile) fprintf(logfile, "r=%f\n", r);
-      }
-      error->all(FLERR,"Table Fragment Memory: r is out of computed range.");
+      // reported by compute_backbone() after the residue loop
+#if defined(_OPENMP)
+#pragma omp atomic write
+#endif
+      fm_tb_range_error = 1;
     }
   }
 }
@@ -4503,18 +6077,17 @@ void FixBackbone::compute_decoy_memory_potential(int i, int decoy_calc)
 
 	  if (chain_no[i]!=chain_no[j]) error->all(FLERR,"Decoy Memory: Interaction between residues of different chains");
 
-	  fm_sigma_sq = pow(abs(i_resno-j_resno), 2*fm_sigma_exp);
+	  fm_sigma_sq = fm_sigma_sq_sep[abs(i_resno-j_resno)];
 	  fm_sigma_sq = fm_sigma_sq*frag_frust_well_width*frag_frust_well_width;
 
 	  if (!fm_gamma->fourResTypes())
 	    {
-	      frag_mem_gamma = fm_gamma->getGamma(ires_type, jres_type, i_resno, j_resno);
+	      frag_mem_gamma = fm_gamma->gammaLookup(ires_type, jres_type, i_resno, j_resno);
 	    }
 	  else
 	    {
-	      frag_mem_gamma = fm_gamma->getGamma(ires_type, jres_type, frag->resType(i_resno), frag->resType(j_resno), i_resno, j_resno);
+	      frag_mem_gamma = fm_gamma->gammaLookup(ires_type, jres_type, frag->resType(i_resno), frag->resType(j_resno), i_resno, j_resno);
 	    }
-	  if (fm_gamma->error==fm_gamma->ERR_CALL) error->all(FLERR,"Decoy_Memory: Wrong call of getGamma() function");
 
 	  // sequence distance dependent gamma
 	  if (frag_frust_seqsep_flag)
@@ -4745,17 +6318,16 @@ void FixBackbone::compute_generated_decoy_energies()
 		  j_resno = res_no[j]-1;
 		  jres_type = se_map[se[j_resno]-'A'];
 
-		  fm_sigma_sq = pow(abs(i_resno-j_resno), 2*fm_sigma_exp);
+		  fm_sigma_sq = fm_sigma_sq_sep[abs(i_resno-j_resno)];
 		  fm_sigma_sq = fm_sigma_sq*frag_frust_well_width*frag_frust_well_width;
 		  if (!fm_gamma->fourResTypes())
 		    {
-		      frag_mem_gamma = fm_gamma->getGamma(ires_type, jres_type, i_resno, j_resno);
+		      frag_mem_gamma = fm_gamma->gammaLookup(ires_type, jres_type, i_resno, j_resno);
 		    }
 		  else
 		    {
-		      frag_mem_gamma = fm_gamma->getGamma(ires_type, jres_type, frag->resType(i_resno), frag->resType(j_resno), i_resno, j_resno);
+		      frag_mem_gamma = fm_gamma->gammaLookup(ires_type, jres_type, frag->resType(i_resno), frag->resType(j_resno), i_resno, j_resno);
 		    }
-		  if (fm_gamma->error==fm_gamma->ERR_CALL) error->all(FLERR,"Decoy_Memory: Wrong call of getGamma() function");
 
 		  // sequence distance dependent gamma
 		  if (frag_frust_seqsep_flag)
@@ -5480,12 +7052,7 @@ double FixBackbone::compute_burial_energy(int i_resno, int ires_type, double rho
   double t[3][2];
   double burial_gamma_0, burial_gamma_1, burial_gamma_2, burial_energy;
 
-  t[0][0] = tanh( burial_kappa*(rho_i - burial_ro_min[0]) );
-  t[0][1] = tanh( burial_kappa*(burial_ro_max[0] - rho_i) );
-  t[1][0] = tanh( burial_kappa*(rho_i - burial_ro_min[1]) );
-  t[1][1] = tanh( burial_kappa*(burial_ro_max[1] - rho_i) );
-  t[2][0] = tanh( burial_kappa*(rho_i - burial_ro_min[2]) );
-  t[2][1] = tanh( burial_kappa*(burial_ro_max[2] - rho_i) );
+  compute_burial_tanh(rho_i, t);
 
   burial_gamma_0 = get_burial_gamma(i_resno, ires_type, 0);
   burial_gamma_1 = get_burial_gamma(i_resno, ires_type, 1);
@@ -6104,25 +7671,282 @@ void FixBackbone::output_fragment_memory_table()
   fclose(fmforcesfile);
 }
 
-void FixBackbone::compute_membrane_potential(int i)
+// Write fm_table.bin from rank 0; the file is renamed into place only once
+// complete, so an interrupted run never leaves a truncated table behind
+void FixBackbone::write_fragment_memory_table_binary()
 {
+  int itb, ir, ntb_tot, ntables, pad = 0;
+  int *index;
+  TBV *buf;
+  FMTableHeader hdr;
+  FILE *fp;
 
-//  k_bin is coming from the input
-//  gamma[0][0] is an array coming from input
-//  k_overall_memb coming from input
-//  rho0_distor is coming from the input
-//  rho0_max= is coming from the input
-//  memb_len= is coming from the input
-//  memb_pore_type = is coming from the input
+  if (comm->me==0) print_log("Saving binary FM table for future use...\n");
+  if (comm->me!=0) return;
 
+  ntb_tot = 4*n*tb_nbrs;
+  index = new int[ntb_tot];
+  buf = new TBV[tb_size];
+
+  ntables = 0;
+  for (itb=0;itb<ntb_tot;++itb) index[itb] = (fm_table[itb] ? ntables++ : -1);
+
+  // infinities are stored as zeros, as in the text tables
+  memset(&hdr, 0, sizeof(FMTableHeader));
+  memcpy(hdr.magic, FM_TABLE_MAGIC, 8);
+  hdr.version = FM_TABLE_VERSION;
+  hdr.n = n;
+  hdr.tb_size = tb_size;
+  hdr.tb_nbrs = tb_nbrs;
+  hdr.ntables = ntables;
+  hdr.tb_rmin = tb_rmin;
+  hdr.tb_dr = tb_dr;
+  hdr.checksum = fm_table_hash(index, ntb_tot*sizeof(int), 14695981039346656037ULL);
+  if (ntb_tot%2) hdr.checksum = fm_table_hash(&pad, sizeof(int), hdr.checksum);
+  for (itb=0;itb<ntb_tot;++itb) {
+    if (!fm_table[itb]) continue;
+    for (ir=0;ir<tb_size;++ir) {
+      buf[ir].energy = (isinf(fm_table[itb][ir].energy) ? 0.0 : fm_table[itb][ir].energy);
+      buf[ir].force = (isinf(fm_table[itb][ir].force) ? 0.0 : fm_table[itb][ir].force);
+    }
+    hdr.checksum = fm_table_hash(buf, tb_size*sizeof(TBV), hdr.checksum);
+  }
+
+  fp = fopen("fm_table.bin.tmp", "wb");
+  if (fp==NULL) error->one(FLERR,"Cannot open fm_table.bin.tmp for writing");
+
+  fwrite(&hdr, sizeof(FMTableHeader), 1, fp);
+  fwrite(index, sizeof(int), ntb_tot, fp);
+  if (ntb_tot%2) fwrite(&pad, sizeof(int), 1, fp);
+  for (itb=0;itb<ntb_tot;++itb) {
+    if (!fm_table[itb]) continue;
+    for (ir=0;ir<tb_size;++ir) {
+      buf[ir].energy = (isinf(fm_table[itb][ir].energy) ? 0.0 : fm_table[itb][ir].energy);
+      buf[ir].force = (isinf(fm_table[itb][ir].force) ? 0.0 : fm_table[itb][ir].force);
+    }
+    fwrite(buf, sizeof(TBV), tb_size, fp);
+  }
+
+  if (ferror(fp)) error->one(FLERR,"Error writing fm_table.bin.tmp");
+  fclose(fp);
+  rename("fm_table.bin.tmp", "fm_table.bin");
+
+  delete [] index;
+  delete [] buf;
+}
 
-  double V, x_actual, y_actual, z_actual;
-  double dx, dy, dz, *xi;
-  double memb_a, memb_b;
-  double rho_actual, rho0;
-  double s_per, s_mem, s_cyt, s_por, s_nopor;
-  double dz_per, dz_mem, dz_cyt, dr1_dz;
-  double dz_s_por, dx_s_por, dy_s_por;
+// Map fm_table.bin read-only and point fm_table at the slots inside it. The
+// pages are shared through the page cache by every rank on a node.
+void FixBackbone::map_fragment_memory_table()
+{
+  int fd, itb, ntb_tot, ok;
+  size_t idx_bytes, expected;
+  struct stat st;
+  char *map;
+  int *index;
+  TBV *data;
+  FMTableHeader *hdr;
+
+  fd = open("fm_table.bin", O_RDONLY);
+  if (fd<0) error->all(FLERR,"Fragment memory table file fm_table.bin not found!");
+  if (fstat(fd, &st)!=0 || (size_t)st.st_size<sizeof(FMTableHeader)) error->all(FLERR,"Fragment memory table file format error!");
+
+  map = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map==MAP_FAILED) error->all(FLERR,"Cannot map fm_table.bin");
+
+  fm_table_map = map;
+  fm_table_map_size = st.st_size;
+
+  hdr = (FMTableHeader *) map;
+  if (memcmp(hdr->magic, FM_TABLE_MAGIC, 8)!=0) error->all(FLERR,"fm_table.bin is not a fragment memory table");
+  if (hdr->version!=FM_TABLE_VERSION) error->all(FLERR,"Unsupported fm_table.bin version");
+  if (hdr->n!=n || hdr->tb_size!=tb_size || hdr->tb_nbrs!=tb_nbrs || fabs(hdr->tb_rmin-tb_rmin)>1e-12 || fabs(hdr->tb_dr-tb_dr)>1e-12)
+    error->all(FLERR,"fm_table.bin was built for a different system or table grid");
+
+  ntb_tot = 4*n*tb_nbrs;
+  idx_bytes = (ntb_tot + ntb_tot%2)*sizeof(int);
+  expected = sizeof(FMTableHeader) + idx_bytes + (size_t)hdr->ntables*tb_size*sizeof(TBV);
+  if (expected!=fm_table_map_size) error->all(FLERR,"Fragment memory table file format error!");
+
+  // one rank verifies the checksum for everyone
+  ok = 1;
+  if (comm->me==0)
+    ok = (fm_table_hash(map+sizeof(FMTableHeader), fm_table_map_size-sizeof(FMTableHeader), 14695981039346656037ULL)==hdr->checksum);
+  MPI_Bcast(&ok, 1, MPI_INT, 0, world);
+  if (!ok) error->all(FLERR,"fm_table.bin checksum mismatch");
+
+  index = (int *) (map + sizeof(FMTableHeader));
+  data = (TBV *) (map + sizeof(FMTableHeader) + idx_bytes);
+  for (itb=0;itb<ntb_tot;++itb) {
+    if (index[itb]>=hdr->ntables) error->all(FLERR,"Fragment memory table file format error!");
+    fm_table[itb] = (index[itb]<0 ? NULL : data + (size_t)index[itb]*tb_size);
+  }
+}
+
+// Tabulate the membrane switching functions with their derivatives, at
+// spacing memb_tb_dr up to where tanh saturates in double precision:
+// s_per, s_mem and s_cyt over z from the membrane center and s_por over
+// the distance to the pore wall, rho-rho0
+void FixBackbone::setup_membrane_table()
+{
+  int k;
+  double z, u, th_per, th_mem1, th_mem2, th_cyt, th_por, *tb;
+  double memb_b = memb_len/2;
+
+  memb_tb_umax = MEMB_TANH_SAT/k_bin;
+  memb_tb_zmax = memb_b + memb_tb_umax;
+  memb_tb_nz = (int)ceil(2.0*memb_tb_zmax/memb_tb_dr) + 1;
+  memb_tb_nu = (int)ceil(2.0*memb_tb_umax/memb_tb_dr) + 1;
+
+  memb_tb_z = new double[6*memb_tb_nz];
+  memb_tb_u = new double[2*memb_tb_nu];
+
+  for (k=0;k<memb_tb_nz;++k) {
+    z = -memb_tb_zmax + k*memb_tb_dr;
+    th_per = tanh(k_bin*(z-memb_b));
+    th_mem1 = tanh(k_bin*(z+memb_b));
+    th_mem2 = tanh(k_bin*(memb_b-z));
+    th_cyt = tanh(k_bin*(-memb_b-z));
+
+    tb = memb_tb_z + 6*k;
+    tb[0] = 0.5*(1+th_per);
+    tb[1] = 0.5*(th_mem1+th_mem2);
+    tb[2] = 0.5*(1+th_cyt);
+    tb[3] = 0.5*k_bin*(1-th_per*th_per);
+    tb[4] = 0.5*k_bin*(th_mem2*th_mem2-th_mem1*th_mem1);
+    tb[5] = -0.5*k_bin*(1-th_cyt*th_cyt);
+  }
+
+  for (k=0;k<memb_tb_nu;++k) {
+    u = -memb_tb_umax + k*memb_tb_dr;
+    th_por = tanh(k_bin*u);
+
+    tb = memb_tb_u + 2*k;
+    tb[0] = 0.5*(1-th_por);
+    tb[1] = -0.5*k_bin*(1-th_por*th_por);
+  }
+
+  if (comm->me==0) {
+    if (screen) fprintf(screen, "Membrane table: %d z and %d pore points\n", memb_tb_nz, memb_tb_nu);
+    if (logfile) fprintf(logfile, "Membrane table: %d z and %d pore points\n", memb_tb_nz, memb_tb_nu);
+  }
+}
+
+// Cubic Hermite interpolation of nf functions stored per point as nf values
+// followed by nf derivatives; outside the table the end values hold and the
+// derivatives vanish, as the switching functions are saturated there
+inline void FixBackbone::memb_table_eval(const double *tb, int ntb, int nf, double xmin, double x, double *v, double *dv)
+{
+  int k, ix;
+  double t, u, u2, u3, h00, h10, h01, h11;
+  const double *t0, *t1;
+
+  t = (x-xmin)/memb_tb_dr;
+  if (t<=0.0 || t>=ntb-1) {
+    t0 = tb + 2*nf*(t<=0.0 ? 0 : ntb-1);
+    for (k=0;k<nf;++k) {
+      v[k] = t0[k];
+      dv[k] = 0.0;
+    }
+    return;
+  }
+
+  ix = (int)t;
+  u = t - ix;
+  u2 = u*u;
+  u3 = u2*u;
+  h00 = 2*u3-3*u2+1; h10 = u3-2*u2+u; h01 = -2*u3+3*u2; h11 = u3-u2;
+
+  t0 = tb + 2*nf*ix;
+  t1 = t0 + 2*nf;
+  for (k=0;k<nf;++k) {
+    v[k] = h00*t0[k] + h10*memb_tb_dr*t0[nf+k] + h01*t1[k] + h11*memb_tb_dr*t1[nf+k];
+    dv[k] = ((6*u2-6*u)*(t0[k]-t1[k]))/memb_tb_dr + (3*u2-4*u+1)*t0[nf+k] + (3*u2-2*u)*t1[nf+k];
+  }
+}
+
+// Sort the local residues after reneighboring: far above or below the slab,
+// or inside it away from the pore wall, every switching function is
+// saturated, so the energy is a constant and the force vanishes. The
+// margins cover the motion allowed before the next reneighboring.
+void FixBackbone::sort_membrane_residues()
+{
+  int i, cl;
+  double *xi, dx, dy, dz, rho, rho0, sgn;
+  double memb_a = rho0_distor*rho0_max;
+  double memb_b = memb_len/2;
+  double dr1_dz = memb_a/memb_len;
+  double sat, skin = neighbor->skin;
+
+  memb_resort = 0;
+  memb_bulk_V = 0.0;
+  n_memb_kernel = 0;
+
+  sat = (k_bin>0.0 ? MEMB_TANH_SAT/k_bin : -1.0);
+
+  for (i=0;i<nn;++i) {
+    if (res_info[i]!=LOCAL) continue;
+
+    xi = (se[res_no[i]-1]=='G' ? xca[i] : xcb[i]);
+    dx = xi[0]-memb_xo[0];
+    dy = xi[1]-memb_xo[1];
+    dz = xi[2]-memb_xo[2];
+    rho = sqrt(dx*dx+dy*dy);
+    rho0 = (rho0_max-memb_a) + dr1_dz*(dz+memb_b);
+
+    cl = z_res[i]-1;
+    if (sat<0.0 || cl<0 || cl>2) {
+      memb_kernel[n_memb_kernel++] = i;
+      continue;
+    }
+    sgn = (cl==1 ? 1.0 : -1.0);
+
+    if (dz-memb_b > sat+skin) memb_bulk_V += sgn*g_memb[cl][0];
+    else if (-dz-memb_b > sat+skin) memb_bulk_V += sgn*g_memb[cl][1];
+    else if (memb_b-fabs(dz) > sat+skin && rho-rho0 > sat+skin*(1+fabs(dr1_dz))) memb_bulk_V += -sgn*g_memb[cl][2];
+    else if (memb_b-fabs(dz) > sat+skin && rho0-rho > sat+skin*(1+fabs(dr1_dz))) memb_bulk_V += sgn*g_memb[cl][3];
+    else memb_kernel[n_memb_kernel++] = i;
+  }
+}
+
+void FixBackbone::compute_membrane()
+{
+  int k;
+
+  if (memb_resort) sort_membrane_residues();
+
+  energy[ET_MEMB] += epsilon*k_overall_memb*memb_bulk_V;
+
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(nthreads) if(nthreads>1) schedule(static)
+#endif
+  for (k=0;k<n_memb_kernel;++k)
+    compute_membrane_potential(memb_kernel[k]);
+}
+
+void FixBackbone::compute_membrane_potential(int i)
+{
+  double **f = force_buffer();
+  double *energy = energy_buffer();
+
+//  k_bin is coming from the input
+//  gamma[0][0] is an array coming from input
+//  k_overall_memb coming from input
+//  rho0_distor is coming from the input
+//  rho0_max= is coming from the input
+//  memb_len= is coming from the input
+//  memb_pore_type = is coming from the input
+
+
+  double V, x_actual, y_actual, z_actual;
+  double dx, dy, dz, *xi;
+  double memb_a, memb_b;
+  double rho_actual, rho0;
+  double s_per, s_mem, s_cyt, s_por, s_nopor;
+  double dz_per, dz_mem, dz_cyt, dr1_dz;
+  double dz_s_por, dx_s_por, dy_s_por, du_s_por;
+  double sz[3], dsz[3];
   double dz_s_nopor, dx_s_nopor, dy_s_nopor;
   double dz_s_por_smem, dz_s_nopor_smem;
   double dV_dx, dV_dy, dV_dz;
@@ -6160,11 +7984,23 @@ void FixBackbone::compute_membrane_potential(int i)
 
 
 
-//definition of swithing functions
-  s_per=0.5*(1+tanh(k_bin*(dz-memb_b)));
-  s_mem=0.5*((tanh(k_bin*(dz+memb_b)))+(tanh(k_bin*(memb_b-dz))));
-  s_cyt=0.5*(1+tanh(k_bin*(-memb_b-dz)));
-  s_por=0.5*(1-(tanh(k_bin*(rho_actual-rho0))));
+//definition of swithing functions and their derivatives
+  if (memb_table_flag) {
+    memb_table_eval(memb_tb_z, memb_tb_nz, 3, -memb_tb_zmax, dz, sz, dsz);
+    s_per = sz[0]; s_mem = sz[1]; s_cyt = sz[2];
+    dz_per = dsz[0]; dz_mem = dsz[1]; dz_cyt = dsz[2];
+    memb_table_eval(memb_tb_u, memb_tb_nu, 1, -memb_tb_umax, rho_actual-rho0, &s_por, &du_s_por);
+  } else {
+    s_per=0.5*(1+tanh(k_bin*(dz-memb_b)));
+    s_mem=0.5*((tanh(k_bin*(dz+memb_b)))+(tanh(k_bin*(memb_b-dz))));
+    s_cyt=0.5*(1+tanh(k_bin*(-memb_b-dz)));
+    s_por=0.5*(1-(tanh(k_bin*(rho_actual-rho0))));
+
+    dz_per=0.5*k_bin*(1-pow((tanh(k_bin*(dz-memb_b))),2));
+    dz_mem=-0.5*k_bin*pow(tanh(k_bin*(dz+memb_b)),2)+0.5*k_bin*pow(tanh(k_bin*(memb_b-dz)),2);
+    dz_cyt=-0.5*k_bin*(1-pow((tanh(k_bin*(-memb_b-dz))),2));
+    du_s_por=-0.5*k_bin*(1-pow(tanh(k_bin*(rho_actual-rho0)),2));
+  }
   s_nopor=(1-s_por);
 
   if (z_res[i] == 1) {
@@ -6181,10 +8017,6 @@ void FixBackbone::compute_membrane_potential(int i)
   energy[ET_MEMB] += epsilon*k_overall_memb*V;
 
 // parcial derivatives
-dz_per=0.5*k_bin*(1-pow((tanh(k_bin*(dz-memb_b))),2));
-dz_mem=-0.5*k_bin*pow(tanh(k_bin*(dz+memb_b)),2)+0.5*k_bin*pow(tanh(k_bin*(memb_b-dz)),2);
-dz_cyt=-0.5*k_bin*(1-pow((tanh(k_bin*(-memb_b-dz))),2));
-
 // if (memb_pore_type == 0){
   dr1_dz=((memb_a)/(memb_len));
 //  }
@@ -6192,10 +8024,10 @@ dz_cyt=-0.5*k_bin*(1-pow((tanh(k_bin*(-memb_b-dz))),2));
 //  dr1_dz=(1/(dz<=memb_b ? (sqrt(1-pow(dz/memb_b,2))):0))*(dz/pow(memb_b,2))*memb_a;
 //  }
 
-dz_s_por=0.5*k_bin*(1-pow(tanh(k_bin*(rho_actual-rho0)),2))*dr1_dz;
+dz_s_por=-du_s_por*dr1_dz;
 
-dx_s_por=((-0.5*k_bin*dx)/rho_actual)*(1-pow(tanh(k_bin*(rho_actual-rho0)),2));
-dy_s_por=((-0.5*k_bin*dy)/rho_actual)*(1-pow(tanh(k_bin*(rho_actual-rho0)),2));
+dx_s_por=du_s_por*dx/rho_actual;
+dy_s_por=du_s_por*dy/rho_actual;
 
 //some definitions to be used in "calculate general derivatives"
 dx_s_nopor=-dx_s_por;
@@ -6236,6 +8068,8 @@ dz_s_nopor_smem=s_mem*dz_s_nopor+dz_mem*s_nopor;
 
 void FixBackbone::compute_solvent_barrier(int i, int j)
 {
+  double **f = force_buffer();
+  double *energy = energy_buffer();
   if (chain_no[i]==chain_no[j] && res_no[j]-res_no[i]<ssb_ij_sep) return;
 
   double dx[3], force1, force2;
@@ -6304,28 +8138,90 @@ void FixBackbone::compute_solvent_barrier(int i, int j)
   f[jatom][2] += -force2*dx[2];
 }
 
+// Charged residues present as local or ghost, by local residue index, and
+// the pairs among them, each once under the owner of the residue that comes
+// first. With [DebyeHuckel_Cutoff] these are the pairs whose interaction
+// sites can come within dh_cutoff before the next reneighboring. Without it
+// they are the pairs with CA atoms within the neighbor list cutoff and more
+// than one residue apart, which the CA-CA neighbor list used to give.
+void FixBackbone::build_dh_list()
+{
+  int i, j, k, l, i_resno, j_resno, iatom, jatom;
+  double dx[3], cutsq;
+  double **x = atom->x;
+
+  n_dh_res = 0;
+  for (i=0;i<nn;++i) {
+    i_resno = res_no[i]-1;
+    if (charge_on_residue[i_resno]==0.0) continue;
+    if (res_info[i]!=LOCAL && res_info[i]!=GHOST) continue;
+    if ((se[i_resno]=='G' ? alpha_carbons[i] : beta_atoms[i])==-1) continue;
+    dh_res[n_dh_res++] = i;
+  }
+
+  if (dh_cutoff_flag) cutsq = (dh_cutoff+neighbor->skin)*(dh_cutoff+neighbor->skin);
+  else cutsq = (pair_list_cutoff+neighbor->skin)*(pair_list_cutoff+neighbor->skin);
+
+  n_dh_pairs = 0;
+  for (k=0;k<n_dh_res;++k) {
+    i = dh_res[k];
+    if (res_info[i]!=LOCAL) continue;
+    i_resno = res_no[i]-1;
+
+    for (l=k+1;l<n_dh_res;++l) {
+      j = dh_res[l];
+      j_resno = res_no[j]-1;
+
+      if (dh_cutoff_flag) {
+        iatom = (se[i_resno]=='G' ? alpha_carbons[i] : beta_atoms[i]);
+        jatom = (se[j_resno]=='G' ? alpha_carbons[j] : beta_atoms[j]);
+      } else {
+        if (abs(j_resno-i_resno)<=1) continue;
+        iatom = alpha_carbons[i];
+        jatom = alpha_carbons[j];
+        if (iatom==-1 || jatom==-1) continue;
+      }
+
+      dx[0] = x[iatom][0] - x[jatom][0];
+      dx[1] = x[iatom][1] - x[jatom][1];
+      dx[2] = x[iatom][2] - x[jatom][2];
+
+      if (dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2] < cutsq)
+        add_hbond_pair(dh_pairs, n_dh_pairs, max_dh_pairs, i, j);
+    }
+  }
+}
+
+void FixBackbone::compute_DebyeHuckel_list()
+{
+  int k;
+
+  for (k=0;k<n_dh_pairs;++k)
+    compute_DebyeHuckel_Interaction(dh_pairs[k].i, dh_pairs[k].j);
+}
+
 void FixBackbone::compute_DebyeHuckel_Interaction(int i, int j)
 {
-  if (abs(i-j)<debye_huckel_min_sep) return;
+  double **f = force_buffer();
+  double *energy = energy_buffer();
 
   double dx[3];
-  double *xi, *xj, r;
+  double *xi, *xj, r, rsq;
   int iatom, jatom;
   double charge_i = 0.0;
   double charge_j = 0.0;
   double term_qq_by_r = 0.0;
   double force_term = 0.0;
 
-  charge_i = charge_on_residue[i];
-  charge_j = charge_on_residue[j];
-
-  if (charge_i == 0 && charge_j == 0) return;
-
   int i_resno = res_no[i]-1;
   int j_resno = res_no[j]-1;
 
-  int ires_type = se_map[se[i_resno]-'A'];
-  int jres_type = se_map[se[j_resno]-'A'];
+  if (abs(i_resno-j_resno)<debye_huckel_min_sep) return;
+
+  charge_i = charge_on_residue[i_resno];
+  charge_j = charge_on_residue[j_resno];
+
+  if (charge_i == 0 || charge_j == 0) return;
 
   if (se[i_resno]=='G') { xi = xca[i]; iatom = alpha_carbons[i]; }
   else { xi = xcb[i]; iatom  = beta_atoms[i]; }
@@ -6336,7 +8232,9 @@ void FixBackbone::compute_DebyeHuckel_Interaction(int i, int j)
   dx[1] = xi[1] - xj[1];
   dx[2] = xi[2] - xj[2];
 
-  r = sqrt(dx[0]*dx[0]+dx[1]*dx[1]+dx[2]*dx[2]);
+  rsq = dx[0]*dx[0]+dx[1]*dx[1]+dx[2]*dx[2];
+  if (dh_cutoff_flag && rsq>=dh_cutoff_sq) return;
+  r = sqrt(rsq);
 
   if( (charge_i > 0.0) && (charge_j > 0.0) ) {
     term_qq_by_r = k_PlusPlus*charge_i*charge_j/r;
@@ -6348,11 +8246,19 @@ void FixBackbone::compute_DebyeHuckel_Interaction(int i, int j)
     term_qq_by_r = k_PlusMinus*charge_i*charge_j/r;
   }
 
-  double term_energy = epsilon*term_qq_by_r*exp(-k_screening*r/screening_length);
-  energy[ET_DH] += term_energy;
-
+  double term_energy = epsilon*term_qq_by_r*math_exp(-k_screening*r/screening_length);
   force_term = (term_energy/r)*(1.0/r + k_screening/screening_length);
 
+  // shifted force: V(r) - V(rc) + (r-rc)*F(rc), dh_e_rc and dh_f_rc are
+  // V(rc) and F(rc) per unit epsilon*k*qi*qj
+  if (dh_cutoff_flag) {
+    double qq = epsilon*term_qq_by_r*r;
+    term_energy += qq*((r - dh_cutoff)*dh_f_rc - dh_e_rc);
+    force_term -= qq*dh_f_rc/r;
+  }
+
+  energy[ET_DH] += term_energy;
+
   f[iatom][0] += force_term*dx[0];
   f[iatom][1] += force_term*dx[1];
   f[iatom][2] += force_term*dx[2];
@@ -6910,12 +8816,7 @@ void FixBackbone::compute_burial_optimization()
 
     rho_i = get_residue_density(i);
 
-    t[0][0] = tanh( burial_kappa*(rho_i - burial_ro_min[0]) );
-    t[0][1] = tanh( burial_kappa*(burial_ro_max[0] - rho_i) );
-    t[1][0] = tanh( burial_kappa*(rho_i - burial_ro_min[1]) );
-    t[1][1] = tanh( burial_kappa*(burial_ro_max[1] - rho_i) );
-    t[2][0] = tanh( burial_kappa*(rho_i - burial_ro_min[2]) );
-    t[2][1] = tanh( burial_kappa*(burial_ro_max[2] - rho_i) );
+    compute_burial_tanh(rho_i, t);
 
     burial_gamma_0 = get_burial_gamma(i_resno, ires_type, 0);
     burial_gamma_1 = get_burial_gamma(i_resno, ires_type, 1);
@@ -7044,10 +8945,128 @@ void FixBackbone::print_forces(int coord)
   fprintf(dout, "\n\n\n\n");
 }
 
+// Kernel groups that evaluate exp, tanh, sin or cos through the
+// math_* dispatchers, in the order reported by validate_fast_math()
+void FixBackbone::compute_fast_math_group(int group)
+{
+  int i, i_resno;
+
+  switch (group) {
+  case 0:
+    for (i=0;i<nn;i++) {
+      i_resno = res_no[i]-1;
+      if (!isFirst(i) && !isLast(i) && rama_flag && res_info[i]==LOCAL && se[i_resno]!='G')
+        compute_rama_potential(i);
+    }
+    break;
+  case 1:
+    for (i=0;i<nn;i++) {
+      if (frag_mem_flag && res_info[i]==LOCAL)
+        compute_fragment_memory_potential(i);
+      if (vec_frag_mem_flag && res_info[i]==LOCAL)
+        compute_vector_fragment_memory_potential(i);
+    }
+    break;
+  case 2:
+    if (amh_go_flag) compute_amh_go_model();
+    break;
+  case 3:
+    if (pair_flag) compute_pair();
+    break;
+  }
+}
+
+// Evaluate every kernel group with libm and with fast_math.h on the current
+// coordinates and report the largest energy deviation of each term and the
+// largest force component deviation of each group. Forces and energies are
+// restored afterwards, so the step itself is unaffected.
+void FixBackbone::validate_fast_math()
+{
+  int i, k, g, pass;
+  int nall = atom->nlocal + atom->nghost;
+  int nthreads_save = nthreads;
+  double **f_save, **f_ref, d;
+  double e_pass[2][nEnergyTerms], e_save[nEnergyTerms], de[nEnergyTerms], df[4], df_all[4];
+  const char *group_names[4] = {"Rama", "Frag_Mem", "AMH-Go", "Pair"};
+  char buf[256];
+
+  memory->create(f_save,nall,3,"backbone:f_save");
+  memory->create(f_ref,nall,3,"backbone:f_ref");
+  for (i=0;i<nall;++i)
+    for (k=0;k<3;++k) f_save[i][k] = f[i][k];
+  for (k=0;k<nEnergyTerms;++k) e_save[k] = energy[k];
+
+  // single-threaded so both passes sum in the same order
+  nthreads = 1;
+  for (k=0;k<nEnergyTerms;++k) de[k] = 0.0;
+
+  for (g=0;g<4;++g) {
+    df[g] = 0.0;
+    for (pass=0;pass<2;++pass) {
+      fast_math_on = (pass==1);
+      for (i=0;i<nall;++i) f[i][0] = f[i][1] = f[i][2] = 0.0;
+      for (k=0;k<nEnergyTerms;++k) energy[k] = 0.0;
+
+      // cached values of the other pass would hide the difference
+      if (water_flag) well->reset();
+      if (helix_flag) helix_well->reset();
+      if (p_ap_flag) p_ap->reset();
+      R->reset();
+
+      compute_fast_math_group(g);
+
+      MPI_Allreduce(energy,e_pass[pass],nEnergyTerms,MPI_DOUBLE,MPI_SUM,world);
+      for (i=0;i<nall;++i) {
+        for (k=0;k<3;++k) {
+          if (pass==0) {
+            f_ref[i][k] = f[i][k];
+          } else {
+            d = fabs(f[i][k] - f_ref[i][k]);
+            if (d>df[g]) df[g] = d;
+          }
+        }
+      }
+    }
+    for (k=0;k<nEnergyTerms;++k) {
+      d = fabs(e_pass[1][k] - e_pass[0][k]);
+      if (d>de[k]) de[k] = d;
+    }
+  }
+
+  MPI_Allreduce(df,df_all,4,MPI_DOUBLE,MPI_MAX,world);
+
+  if (comm->me==0) {
+    sprintf(buf, "FastMath validation at step %d\n", ntimestep);
+    print_log(buf);
+    for (k=1;k<nEnergyTerms;++k) {
+      if (de[k]==0.0) continue;
+      sprintf(buf, "  %-20s max |dE| = %.6e\n", energy_term_names[k], de[k]);
+      print_log(buf);
+    }
+    for (g=0;g<4;++g) {
+      sprintf(buf, "  %-20s max |dF| = %.6e\n", group_names[g], df_all[g]);
+      print_log(buf);
+    }
+  }
+
+  for (i=0;i<nall;++i)
+    for (k=0;k<3;++k) f[i][k] = f_save[i][k];
+  for (k=0;k<nEnergyTerms;++k) energy[k] = e_save[k];
+
+  memory->destroy(f_save);
+  memory->destroy(f_ref);
+  nthreads = nthreads_save;
+  fast_math_on = true;
+}
+
 void FixBackbone::compute_backbone()
 {
   ntimestep = update->ntimestep;
 
+  // coordinates change between the rRESPA levels of a step, not only
+  // between steps, so the caches are stamped per evaluation
+  cache_stamp++;
+
 //  printf("step: %d proc: %d nlocal: %d n: %d nn: %d\n", ntimestep, comm->me, atom->nlocal,n ,nn);
 
   //if(atom->nlocal==0) return;
@@ -7057,86 +9076,68 @@ void FixBackbone::compute_backbone()
   f = atom->f;
   image = atom->image;
 
-  int i, j, xbox, ybox, zbox;
+  int i, j, k, ia, im1;
   int i_resno, j_resno;
   int i_chno, j_chno;
   int jr0, jrn, jl;
+  int *index, *site_atoms[3];
+  double shift[3], *xs;
 
-  for (int i=0;i<nEnergyTerms;++i) energy[i] = 0.0;
+  // under rRESPA the terms of the other levels keep their last values
+  for (int i=0;i<nEnergyTerms;++i)
+    if (respa_ilevel<0 || i==ET_TOTAL || respa_term_level[i]==respa_ilevel) energy[i] = 0.0;
 
-  for (i=0;i<nn;++i) {
-    if ( (res_info[i]==LOCAL || res_info[i]==GHOST) ) {
-      if (domain->xperiodic) {
-        xbox = (image[alpha_carbons[i]] & 1023) - 512;
-        xca[i][0] = x[alpha_carbons[i]][0] + xbox*prd[0];
-      } else xca[i][0] = x[alpha_carbons[i]][0];
-      if (domain->yperiodic) {
-        ybox = (image[alpha_carbons[i]] >> 10 & 1023) - 512;
-        xca[i][1] = x[alpha_carbons[i]][1] + ybox*prd[1];
-      } else xca[i][1] = x[alpha_carbons[i]][1];
-      if (domain->zperiodic) {
-        zbox = (image[alpha_carbons[i]] >> 20) - 512;
-        xca[i][2] = x[alpha_carbons[i]][2] + zbox*prd[2];
-      } else xca[i][2] = x[alpha_carbons[i]][2];
-
-      if (beta_atoms[i]!=-1) {
-        if (domain->xperiodic) {
-          xbox = (image[beta_atoms[i]] & 1023) - 512;
-          xcb[i][0] = x[beta_atoms[i]][0] + xbox*prd[0];
-        } else xcb[i][0] = x[beta_atoms[i]][0];
-        if (domain->yperiodic) {
-          ybox = (image[beta_atoms[i]] >> 10 & 1023) - 512;
-          xcb[i][1] = x[beta_atoms[i]][1] + ybox*prd[1];
-        } else xcb[i][1] = x[beta_atoms[i]][1];
-        if (domain->zperiodic) {
-          zbox = (image[beta_atoms[i]] >> 20) - 512;
-          xcb[i][2] = x[beta_atoms[i]][2] + zbox*prd[2];
-        } else xcb[i][2] = x[beta_atoms[i]][2];
-      }
-
-      if (oxygens[i]!=-1) {
-        if (domain->xperiodic) {
-          xbox = (image[oxygens[i]] & 1023) - 512;
-          xo[i][0] = x[oxygens[i]][0] + xbox*prd[0];
-        } else xo[i][0] = x[oxygens[i]][0];
-        if (domain->yperiodic) {
-          ybox = (image[oxygens[i]] >> 10 & 1023) - 512;
-          xo[i][1] = x[oxygens[i]][1] + ybox*prd[1];
-        } else xo[i][1] = x[oxygens[i]][1];
-        if (domain->zperiodic) {
-          zbox = (image[oxygens[i]] >> 20) - 512;
-          xo[i][2] = x[oxygens[i]][2] + zbox*prd[2];
-        } else xo[i][2] = x[oxygens[i]][2];
-      }
+  if (nthreads>1) thr_zero();
+
+  // Unwrap CA, CB and O positions. Shifts are zero along non-periodic
+  // dimensions, so each site block is filled by a branch-free pass.
+  shift[0] = domain->xperiodic ? prd[0] : 0.0;
+  shift[1] = domain->yperiodic ? prd[1] : 0.0;
+  shift[2] = domain->zperiodic ? prd[2] : 0.0;
+
+  site_atoms[SITE_CA] = alpha_carbons;
+  site_atoms[SITE_CB] = beta_atoms;
+  site_atoms[SITE_O] = oxygens;
+
+  for (k=SITE_CA;k<=SITE_O;++k) {
+    index = site_atoms[k];
+    xs = site_arena + k*site_stride;
+    for (i=0;i<nn;++i) {
+      ia = index[i];
+      if (ia==-1 || (res_info[i]!=LOCAL && res_info[i]!=GHOST)) continue;
+      xs[3*i] = x[ia][0] + ((image[ia] & 1023) - 512)*shift[0];
+      xs[3*i+1] = x[ia][1] + ((image[ia] >> 10 & 1023) - 512)*shift[1];
+      xs[3*i+2] = x[ia][2] + ((image[ia] >> 20) - 512)*shift[2];
     }
+  }
 
+  // N, H and C' are linear combinations of CA(i-1), CA(i) and O(i-1)
+  for (i=0;i<nn;++i) {
     i_resno=res_no[i]-1;
-    int im1 = -1;
+    im1 = -1;
     if (i_resno>0) im1 = res_no_l[i_resno-1];
     if (im1!=-1 && !isFirst(i) && (res_info[i]==LOCAL || res_info[i]==GHOST) && (res_info[im1]==LOCAL || res_info[im1]==GHOST)) {
-      xn[i][0] = an*xca[im1][0] + bn*xca[i][0] + cn*xo[im1][0];
-      xn[i][1] = an*xca[im1][1] + bn*xca[i][1] + cn*xo[im1][1];
-      xn[i][2] = an*xca[im1][2] + bn*xca[i][2] + cn*xo[im1][2];
-
-      xh[i][0] = ah*xca[im1][0] + bh*xca[i][0] + ch*xo[im1][0];
-      xh[i][1] = ah*xca[im1][1] + bh*xca[i][1] + ch*xo[im1][1];
-      xh[i][2] = ah*xca[im1][2] + bh*xca[i][2] + ch*xo[im1][2];
+      for (k=0;k<3;++k) {
+        xn[i][k] = an*xca[im1][k] + bn*xca[i][k] + cn*xo[im1][k];
+        xh[i][k] = ah*xca[im1][k] + bh*xca[i][k] + ch*xo[im1][k];
+        xcp[im1][k] = ap*xca[im1][k] + bp*xca[i][k] + cp*xo[im1][k];
+      }
     } else {
       xn[i][0] = xn[i][1] = xn[i][2] = 0.0;
       xh[i][0] = xh[i][1] = xh[i][2] = 0.0;
+      if (im1!=-1) xcp[im1][0] = xcp[im1][1] = xcp[im1][2] = 0.0;
     }
-
-    if (im1!=-1 && !isFirst(i) && (res_info[i]==LOCAL || res_info[i]==GHOST) && (res_info[im1]==LOCAL || res_info[im1]==GHOST)) {
-      xcp[im1][0] = ap*xca[im1][0] + bp*xca[i][0] + cp*xo[im1][0];
-      xcp[im1][1] = ap*xca[im1][1] + bp*xca[i][1] + cp*xo[im1][1];
-      xcp[im1][2] = ap*xca[im1][2] + bp*xca[i][2] + cp*xo[im1][2];
-    } else if (im1!=-1) {
-	    xcp[im1][0] = xcp[im1][1] = xcp[im1][2] = 0.0;
-    }
-
   }
   if (nn>0) xcp[nn-1][0] = xcp[nn-1][1] = xcp[nn-1][2] = 0.0;
 
+  if (frag_mem_flag && fm_list_dirty) {
+    build_fm_list();
+    check_residue_partners();
+  }
+
+  if (fast_math_flag==2 && ntimestep%fast_math_validate_every==0 && isOuterLevel())
+    validate_fast_math();
+
 #ifdef DEBUGFORCES
 
   if (ntimestep>=sStep && ntimestep<=eStep) {
@@ -7219,8 +9220,10 @@ void FixBackbone::compute_backbone()
   for (i=0;i<nn;i++) {
     for (j=0;j<nn;j++) {
       //if (i<n-i_med_min && j>=i+i_med_min && p_ap_flag && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST))
-      if (i<n-i_med_min && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST))
+      if (i<n-i_med_min && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST)) {
+	prepare_P_AP(i, j);
 	compute_P_AP_potential(i, j);
+      }
     }
   }
 
@@ -7292,17 +9295,8 @@ void FixBackbone::compute_backbone()
 
   timerEnd(TIME_SSB);
 
-  for (i=0;i<nn;i++) {
-    i_resno = res_no[i]-1;
-    i_chno = chain_no[i]-1;
-    for (j=0;j<nn;j++) {
-      j_resno = res_no[j]-1;
-      j_chno = chain_no[j]-1;
-      if (huckel_flag) {
-        compute_DebyeHuckel_Interaction(i, j);
-      }
-    }
-  }
+  if (huckel_flag)
+    compute_DebyeHuckel_list();
 
   if (huckel_flag && ntimestep >=sStep && ntimestep <=eStep) {
     fprintf(dout, "DH: %d\n", ntimestep);
@@ -7342,10 +9336,8 @@ void FixBackbone::compute_backbone()
 
   timerEnd(TIME_HELIX);
 
-  for (i=0;i<nn;i++) {
-    if (memb_flag && res_info[i]==LOCAL)
-      compute_membrane_potential(i);
-  }
+  if (memb_flag)
+    compute_membrane();
 
   if (memb_flag && ntimestep>=sStep && ntimestep<=eStep) {
     fprintf(dout, "Membrane: %d\n", ntimestep);
@@ -7409,6 +9401,13 @@ void FixBackbone::compute_backbone()
 
 #else
 
+  if (nthreads>1) timerBegin();
+
+  // Residues are independent here; with [OpenMP] each thread accumulates
+  // into its own force/energy buffer (see force_buffer()/energy_buffer())
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(nthreads) if(nthreads>1) schedule(dynamic,8) private(j, i_resno, j_resno, i_chno, j_chno, jr0, jrn, jl)
+#endif
   for (i=0;i<nn;i++) {
     i_resno = res_no[i]-1;
     i_chno = chain_no[i]-1;
@@ -7435,98 +9434,105 @@ void FixBackbone::compute_backbone()
 
     timerEnd(TIME_RAMA);
 
-    if (memb_flag && res_info[i]==LOCAL)
-      compute_membrane_potential(i);
-
-    timerEnd(TIME_MEMB);
 
-    if (!pair_flag) {
+    if (frag_mem_flag && res_info[i]==LOCAL)
+      compute_fragment_memory_potential(i);
 
-    for (j=0;j<nn;j++) {
-      j_resno = res_no[j]-1;
-      j_chno = chain_no[j]-1;
+    timerEnd(TIME_FRAGMEM);
 
-      if (dssp_hdrgn_flag && !isLast(i) && !isFirst(j) && ( i_chno!=j_chno || abs(j_resno-i_resno)>2 ) && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST) && j>0 && (res_info[j-1]==LOCAL || res_info[j-1]==GHOST) && se[j_resno]!='P') {
-        timerBegin();
-	compute_dssp_hdrgn(i, j);
-        timerEnd(TIME_DSSP);
-      }
+    if (vec_frag_mem_flag && res_info[i]==LOCAL)
+      compute_vector_fragment_memory_potential(i);
 
-      if (p_ap_flag && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST)) {
-        timerBegin();
-	compute_P_AP_potential(i, j);
-        timerEnd(TIME_PAP);
-      }
+    timerEnd(TIME_VFRAGMEM);
 
-      if (water_flag && ( (i_chno!=j_chno && j_resno > i_resno ) || ( i_chno == j_chno && j_resno-i_resno>=contact_cutoff) ) && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST)) {
-        timerBegin();
-	compute_water_potential(i, j);
-        timerEnd(TIME_WATER);
-      }
+    // Compute fragment memory potential
+    if (pair_flag && frag_mem_tb_flag && res_info[i]==LOCAL) {
+      
+      jr0 = i_resno+fm_gamma->minSep();
+      jrn = ch_pos[i_chno]+ch_len[i_chno]-2;
+      if (fm_gamma->maxSep()!=-1)
+        jrn = MIN(i_resno+fm_gamma->maxSep(), jrn);        
 
-      if (frag_mem_tb_flag && j_resno-i_resno>=fm_gamma->minSep() && (fm_gamma->maxSep()==-1 || j_resno-i_resno<=fm_gamma->maxSep()) && chain_no[i]==chain_no[j] && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST) ) {
-        timerBegin();
-	table_fragment_memory(i, j);
-        timerEnd(TIME_FRAGMEM);
-      }
+      for (j=jr0;j<=jrn;++j)
+        table_fragment_memory(i, res_no_l[j]);
+    }
 
-      if (ssb_flag && ( i_chno!=j_chno || j_resno-i_resno>=ssb_ij_sep ) && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST)) {
-        timerBegin();
-	compute_solvent_barrier(i, j);
-        timerEnd(TIME_SSB);
-      }
+    timerEnd(TIME_FRAGMEM);
+  }
 
-      if (huckel_flag && (j > i) && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST)) {
-        timerBegin();
-        compute_DebyeHuckel_Interaction(i, j);
-        timerEnd(TIME_DH);
-      }
+  if (nthreads>1) timerEnd(TIME_THR_RESIDUES);
 
-    }
+  // Residue pair terms without the neighbor list. They write f, energy and
+  // the R/p_ap/well caches directly, so this path stays serial.
+  if (!pair_flag) {
+    for (i=0;i<nn;i++) {
+      i_resno = res_no[i]-1;
+      i_chno = chain_no[i]-1;
 
-    timerBegin();
+      for (j=0;j<nn;j++) {
+        j_resno = res_no[j]-1;
+        j_chno = chain_no[j]-1;
 
-    if (burial_flag && res_info[i]==LOCAL)
-      compute_burial_potential(i);
+        if (dssp_hdrgn_flag && !isLast(i) && !isFirst(j) && ( i_chno!=j_chno || abs(j_resno-i_resno)>2 ) && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST) && j>0 && (res_info[j-1]==LOCAL || res_info[j-1]==GHOST) && se[j_resno]!='P') {
+          timerBegin();
+  	compute_dssp_hdrgn(i, j);
+          timerEnd(TIME_DSSP);
+        }
 
-    timerEnd(TIME_BURIAL);
+        if (p_ap_flag && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST)) {
+          timerBegin();
+          prepare_P_AP(i, j);
+          compute_P_AP_potential(i, j);
+          timerEnd(TIME_PAP);
+        }
 
-    if (helix_flag && i_resno<(ch_pos[i_chno]+ch_len[i_chno]-1)-helix_i_diff-1 && i<nn-helix_i_diff &&
-	i_chno==chain_no[i+helix_i_diff]-1 && i_resno==res_no[i+helix_i_diff]-helix_i_diff-1 && res_info[i]==LOCAL && (res_info[i+helix_i_diff]==LOCAL || res_info[i+helix_i_diff]==GHOST) && (res_info[i+helix_i_diff-1]==LOCAL || res_info[i+helix_i_diff-1]==GHOST) )
-      compute_helix_potential(i, i+helix_i_diff);
+        if (water_flag && ( (i_chno!=j_chno && j_resno > i_resno ) || ( i_chno == j_chno && j_resno-i_resno>=contact_cutoff) ) && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST)) {
+          timerBegin();
+  	compute_water_potential(i, j);
+          timerEnd(TIME_WATER);
+        }
 
-    timerEnd(TIME_HELIX);
+        if (frag_mem_tb_flag && j_resno-i_resno>=fm_gamma->minSep() && (fm_gamma->maxSep()==-1 || j_resno-i_resno<=fm_gamma->maxSep()) && chain_no[i]==chain_no[j] && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST) ) {
+          timerBegin();
+  	table_fragment_memory(i, j);
+          timerEnd(TIME_FRAGMEM);
+        }
 
-    }
+        if (ssb_flag && ( i_chno!=j_chno || j_resno-i_resno>=ssb_ij_sep ) && res_info[i]==LOCAL && (res_info[j]==LOCAL || res_info[j]==GHOST)) {
+          timerBegin();
+  	compute_solvent_barrier(i, j);
+          timerEnd(TIME_SSB);
+        }
 
-    if (frag_mem_flag && res_info[i]==LOCAL)
-      compute_fragment_memory_potential(i);
+      }
 
-    timerEnd(TIME_FRAGMEM);
+      timerBegin();
 
-    if (vec_frag_mem_flag && res_info[i]==LOCAL)
-      compute_vector_fragment_memory_potential(i);
+      if (burial_flag && res_info[i]==LOCAL)
+        compute_burial_potential(i);
 
-    timerEnd(TIME_VFRAGMEM);
+      timerEnd(TIME_BURIAL);
 
-    // Compute fragment memory potential
-    if (pair_flag && frag_mem_tb_flag && res_info[i]==LOCAL) {
-      
-      jr0 = i_resno+fm_gamma->minSep();
-      jrn = ch_pos[i_chno]+ch_len[i_chno]-2;
-      if (fm_gamma->maxSep()!=-1)
-        jrn = MIN(i_resno+fm_gamma->maxSep(), jrn);        
+      if (helix_flag && i_resno<(ch_pos[i_chno]+ch_len[i_chno]-1)-helix_i_diff-1 && i<nn-helix_i_diff &&
+  	i_chno==chain_no[i+helix_i_diff]-1 && i_resno==res_no[i+helix_i_diff]-helix_i_diff-1 && res_info[i]==LOCAL && (res_info[i+helix_i_diff]==LOCAL || res_info[i+helix_i_diff]==GHOST) && (res_info[i+helix_i_diff-1]==LOCAL || res_info[i+helix_i_diff-1]==GHOST) )
+        compute_helix_potential(i, i+helix_i_diff);
 
-      for (j=jr0;j<=jrn;++j) {
-        jl = res_no_l[j];
-        if (jl!=-1)
-          table_fragment_memory(i, jl);
-        else
-          error->all(FLERR,"Missing interaction in Table Fragment Memory (increase communication cutoff)");
-      }
+      timerEnd(TIME_HELIX);
     }
+  }
 
-    timerEnd(TIME_FRAGMEM);
+  // Membrane potential, with the kernel only near the slab
+  if (memb_flag) {
+    timerBegin();
+    compute_membrane();
+    timerEnd(TIME_MEMB);
+  }
+
+  // Debye-Huckel over the charged residues
+  if (huckel_flag) {
+    timerBegin();
+    compute_DebyeHuckel_list();
+    timerEnd(TIME_DH);
   }
 
   // Compute pair potential
@@ -7534,19 +9540,75 @@ void FixBackbone::compute_backbone()
 
   timerBegin();
 
-  // if the fragment frustratometer is on and it is time to compute the fragment frustration, do so!
-  if (frag_frust_flag && ntimestep % frag_frust_output_freq == 0) {
-    // if running in shuffle mode...
-    if (frag_frust_shuffle_flag) {
-      // zero decoy energy array (because new decoy energies are generated at every calculation in "shuffle" mode)
-      for (i=0; i<n; i++) {
-	for (j=0; j<num_decoy_calcs; j++) {
-	  decoy_energy[i][j] = 0.0;
-	}
-      }
-      // loop over decoys to be generated
-      for (int idecoy=0; idecoy<num_decoy_calcs; idecoy++) {
-	// compute and store decoy energies for each residue
+  // analysis and sequence moves run once per step, with every term on
+  if (isOuterLevel()) {
+    if (respa_ilevel>=0) respa_select_terms(-1);
+    compute_analysis();
+    if (respa_ilevel>=0) respa_select_terms(respa_ilevel);
+  }
+
+  timerEnd(TIME_FRUST);
+
+  if (amh_go_flag)
+    compute_amh_go_model();
+
+  timerEnd(TIME_AMHGO);
+
+// To be removed
+/*  if (excluded_flag)
+    compute_excluded_volume();
+
+  if (p_excluded_flag)
+    compute_p_degree_excluded_volume();
+
+  if (r6_excluded_flag)
+    compute_r6_excluded_volume();
+
+  timerEnd(TIME_VEXCLUDED);*/
+
+#endif
+
+  // flagged by table_fragment_memory(), which may run on worker threads
+  if (fm_tb_range_error) error->one(FLERR,"Table Fragment Memory: r is out of computed range.");
+
+  if (nthreads>1) thr_reduce();
+
+  for (int i=1;i<nEnergyTerms;++i) energy[ET_TOTAL] += energy[i];
+
+  if (ntimestep%output->thermo_every==0 && isOuterLevel()) {
+    if (force_flag == 0) {
+      MPI_Allreduce(energy,energy_all,nEnergyTerms,MPI_DOUBLE,MPI_SUM,world);
+      force_flag = 1;
+    }
+
+    if (comm->me==0 && efile!=NULL) {
+      fprintf(efile, "%d ", ntimestep);
+      for (int i=1;i<nEnergyTerms;++i) fprintf(efile, "\t%8.6f", energy_all[i]);
+      fprintf(efile, "\t%8.6f\n", energy_all[ET_TOTAL]);
+    }
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+// Frustration analysis, optimization output and sequence moves
+void FixBackbone::compute_analysis()
+{
+  int i, j;
+
+  // if the fragment frustratometer is on and it is time to compute the fragment frustration, do so!
+  if (frag_frust_flag && ntimestep % frag_frust_output_freq == 0) {
+    // if running in shuffle mode...
+    if (frag_frust_shuffle_flag) {
+      // zero decoy energy array (because new decoy energies are generated at every calculation in "shuffle" mode)
+      for (i=0; i<n; i++) {
+	for (j=0; j<num_decoy_calcs; j++) {
+	  decoy_energy[i][j] = 0.0;
+	}
+      }
+      // loop over decoys to be generated
+      for (int idecoy=0; idecoy<num_decoy_calcs; idecoy++) {
+	// compute and store decoy energies for each residue
 	for (i=0;i<n;i++) {
 	  compute_decoy_memory_potential(i,idecoy);
 	}
@@ -7612,6 +9674,8 @@ void FixBackbone::compute_backbone()
   // if it is time to do the mcso, do it
   if (monte_carlo_seq_opt_flag) {
     compute_mcso();
+    rebuild_active_pairs = true;
+    fm_list_dirty = true;
   }
 
   // if it is time to output energies for contact potential optimization DO IT
@@ -7629,47 +9693,16 @@ void FixBackbone::compute_backbone()
   // if collecting energies for optimization, shuffle the sequence.  (native sequence used on step 0)
   if ((optimization_flag || burial_optimization_flag || debyehuckel_optimization_flag) && (shuffler_flag)){
     shuffler();
+    rebuild_active_pairs = true;
+    fm_list_dirty = true;
   }
   // if mutating sequence to evaluate energy of mutants, call function to mutate the sequence
   if (mutate_sequence_flag && ntimestep != update->laststep) {
     mutate_sequence();
+    rebuild_active_pairs = true;
+    fm_list_dirty = true;
   }
 
-  timerEnd(TIME_FRUST);
-
-  if (amh_go_flag)
-    compute_amh_go_model();
-
-  timerEnd(TIME_AMHGO);
-
-// To be removed
-/*  if (excluded_flag)
-    compute_excluded_volume();
-
-  if (p_excluded_flag)
-    compute_p_degree_excluded_volume();
-
-  if (r6_excluded_flag)
-    compute_r6_excluded_volume();
-
-  timerEnd(TIME_VEXCLUDED);*/
-
-#endif
-
-  for (int i=1;i<nEnergyTerms;++i) energy[ET_TOTAL] += energy[i];
-
-  if (ntimestep%output->thermo_every==0) {
-    if (force_flag == 0) {
-      MPI_Allreduce(energy,energy_all,nEnergyTerms,MPI_DOUBLE,MPI_SUM,world);
-      force_flag = 1;
-    }
-
-    if (comm->me==0 && efile!=NULL) {
-      fprintf(efile, "%d ", ntimestep);
-      for (int i=1;i<nEnergyTerms;++i) fprintf(efile, "\t%8.6f", energy_all[i]);
-      fprintf(efile, "\t%8.6f\n", energy_all[ET_TOTAL]);
-    }
-  }
 }
 
 /* ---------------------------------------------------------------------- */
@@ -7677,7 +9710,7 @@ void FixBackbone::compute_backbone()
 void FixBackbone::compute_pair()
 {
   int i, j, k, ii, jj, inum, jnum, ires_type, jres_type;
-  int il, jl, kl, i_chno, j_chno;
+  int il, jl, i_chno, j_chno;
   int itype, jtype, i_well;
   int *ilist,*jlist,*numneigh,**firstneigh;
   tagint ires, jres, imol, jmol;
@@ -7685,7 +9718,10 @@ void FixBackbone::compute_pair()
   double factor, force, ff[3], th, theta;
   double water_gamma_0, water_gamma_1, sigma_gamma, theta_gamma;
   double t[3][2], burial_gamma_0, burial_gamma_1, burial_gamma_2;
+  double **fthr, *ethr, *slot;
   bool br, direct_contact;
+  double helix_theta[5], helix_prd_theta[5];
+  ActivePair *ap;
 
   double **x = atom->x;
   double **f = atom->f;
@@ -7718,6 +9754,8 @@ void FixBackbone::compute_pair()
     water_xi[i] = 0.0;
   }
 
+  if (ghost_comm_flag) dens_zero();
+
   inum = list->inum;
   ilist = list->ilist;
   numneigh = list->numneigh;
@@ -7725,69 +9763,87 @@ void FixBackbone::compute_pair()
 
   timerBegin();
 
-  // first loop over neighbors of atoms to calculate local densities
-  for (ii = 0; ii < inum; ii++) {
-    i = ilist[ii];
-    itype = type[i];
-    ires = residue[i]-1;
-    imol = molecule[i];
-
-    if ( (mask[i]&group2bit && se[ires]!='G') || (mask[i]&groupbit && se[ires]=='G') ) {
-      jlist = firstneigh[i];
-      jnum = numneigh[i];
-
-      xi[0] = x[i][0];
-      xi[1] = x[i][1];
-      xi[2] = x[i][2];
-
-      for (jj = 0; jj < jnum; jj++) {
-        j = jlist[jj];
-        //factor_lj = special_lj[sbmask(j)];
-        j &= NEIGHMASK;
-
-        jtype = type[j];
-        jres = residue[j]-1;
-        jmol = molecule[j];
-
-        if ( (mask[j]&group2bit && se[jres]!='G') || (mask[j]&groupbit && se[jres]=='G') ) {
-          xj[0] = x[j][0];
-          xj[1] = x[j][1];
-          xj[2] = x[j][2];
-
-          dx[0] = xi[0] - xj[0];
-          dx[1] = xi[1] - xj[1];
-          dx[2] = xi[2] - xj[2];
-
-          rsq = dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2];
-          br = false;
-
-          if (imol!=jmol || abs(ires-jres)>1) {
-            if (water_flag && rsq>well->rmin_theta_sq[0] && rsq<well->rmax_theta_sq[0]) {
+  if (rebuild_active_pairs) {
+    build_active_pairs();
+    build_hbond_pairs();
+  }
 
-              if (!br) { r = sqrt(rsq); br = true; }
+  // first pass over the active density pairs: refresh distances, residue
+  // types and well values once per step, then sum the local densities
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(nthreads) if(nthreads>1) schedule(static) private(i, j, ires, jres, ap, slot, helix_theta, helix_prd_theta)
+#endif
+  for (k = 0; k < n_active; k++) {
+    ap = &active_pairs[k];
+    i = ap->i;
+    j = ap->j;
+    ires = ap->ires;
+    jres = ap->jres;
+
+    ap->ires_type = se_map[se[ires]-'A'];
+    ap->jres_type = se_map[se[jres]-'A'];
+
+    ap->dx[0] = x[i][0] - x[j][0];
+    ap->dx[1] = x[i][1] - x[j][1];
+    ap->dx[2] = x[i][2] - x[j][2];
+
+    ap->rsq = ap->dx[0]*ap->dx[0] + ap->dx[1]*ap->dx[1] + ap->dx[2]*ap->dx[2];
+    ap->r = sqrt(ap->rsq);
+
+    if (water_flag) {
+      well->compute_theta_wells(ap->r, ap->theta, ap->prd_theta);
+
+      if (ap->rsq>well->rmin_theta_sq[0] && ap->rsq<well->rmax_theta_sq[0]) {
+        slot = dens_slot(i, ires, DENS_WATER_RO, loc_water_ro);
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+        *slot += ap->theta[0];
+        slot = dens_slot(j, jres, DENS_WATER_RO, loc_water_ro);
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+        *slot += ap->theta[0];
+      }
+    }
 
-              theta = well->theta_pair(ires, jres, 0, r);
-              loc_water_ro[ires] += theta;
-              loc_water_ro[jres] += theta;
-            }
+    if (helix_flag) {
+      helix_well->compute_theta_wells(ap->r, helix_theta, helix_prd_theta);
+      ap->helix_theta = helix_theta[0];
+      ap->helix_prd_theta = helix_prd_theta[0];
 
-            if (helix_flag && rsq>helix_well->rmin_theta_sq[0] && rsq<helix_well->rmax_theta_sq[0]) {
+      if (ap->rsq>helix_well->rmin_theta_sq[0] && ap->rsq<helix_well->rmax_theta_sq[0]) {
+        slot = dens_slot(i, ires, DENS_HELIX_RO, loc_helix_ro);
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+        *slot += ap->helix_theta;
+        slot = dens_slot(j, jres, DENS_HELIX_RO, loc_helix_ro);
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+        *slot += ap->helix_theta;
+      }
+    }
+  }
 
-              if (!br) { r = sqrt(rsq); br = true; }
+  if (ghost_comm_flag) {
+    if (water_flag || helix_flag) {
+      dens_reverse_comm(DENS_WATER_RO, 2);
+      dens_forward_comm(DENS_WATER_RO, 2);
 
-              theta = helix_well->theta_pair(ires, jres, 0, r);
-              loc_helix_ro[ires] += theta;
-              loc_helix_ro[jres] += theta;
-            }
-          }
-        }
+      for (i = 0; i < nall; i++) {
+        if (!isDensityAtom(i)) continue;
+        ires = residue[i]-1;
+        water_ro[ires] = atom_dens[i][DENS_WATER_RO];
+        helix_ro[ires] = atom_dens[i][DENS_HELIX_RO];
       }
     }
+  } else {
+    if (water_flag) MPI_Allreduce(loc_water_ro,water_ro,n,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+    if (helix_flag) MPI_Allreduce(loc_helix_ro,helix_ro,n,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
   }
 
-  if (water_flag) MPI_Allreduce(loc_water_ro,water_ro,n,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
-  if (helix_flag) MPI_Allreduce(loc_helix_ro,helix_ro,n,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
-
   timerEnd(TIME_PAIR_DL1);
 
   // Calculating water and helix sigma values
@@ -7799,26 +9855,21 @@ void FixBackbone::compute_pair()
 
       if ( (mask[i]&group2bit && se[ires]!='G') || (mask[i]&groupbit && se[ires]=='G') ) {
         if (water_flag && !b_water_sigma_h[ires]) {
-          th = tanh(water_par.kappa_sigma*(water_ro[ires] - water_par.treshold));
+          th = math_tanh(water_par.kappa_sigma*(water_ro[ires] - water_par.treshold));
           water_sigma_h[ires] = 0.5*(1.0 - th);
           water_sigma_h_prd[ires] = -water_par.kappa_sigma*water_sigma_h[ires]*(1.0 + th);
           b_water_sigma_h[ires] = true;
         }
 
         if (helix_flag && !b_helix_sigma_h[ires]) {
-          th = tanh(helix_par.kappa_sigma*(helix_ro[ires] - helix_par.treshold));
+          th = math_tanh(helix_par.kappa_sigma*(helix_ro[ires] - helix_par.treshold));
           helix_sigma_h[ires] = 0.5*(1.0 - th);
           helix_sigma_h_prd[ires] = -helix_par.kappa_sigma*helix_sigma_h[ires]*(1.0 + th);
           b_helix_sigma_h[ires] = true;
         }
 
         if (burial_flag && !b_burial_force[ires]) {
-          t[0][0] = tanh( burial_kappa*(water_ro[ires] - burial_ro_min[0]) );
-          t[0][1] = tanh( burial_kappa*(burial_ro_max[0] - water_ro[ires]) );
-          t[1][0] = tanh( burial_kappa*(water_ro[ires] - burial_ro_min[1]) );
-          t[1][1] = tanh( burial_kappa*(burial_ro_max[1] - water_ro[ires]) );
-          t[2][0] = tanh( burial_kappa*(water_ro[ires] - burial_ro_min[2]) );
-          t[2][1] = tanh( burial_kappa*(burial_ro_max[2] - water_ro[ires]) );
+          compute_burial_tanh(water_ro[ires], t);
 
           burial_gamma_0 = get_burial_gamma(ires, ires_type, 0);
           burial_gamma_1 = get_burial_gamma(ires, ires_type, 1);
@@ -7841,125 +9892,232 @@ void FixBackbone::compute_pair()
   }
 
   if (helix_flag) {
-    for (i = 0; i < nlocal; i++) {
+    for (k = 0; k < n_helix_pairs; k++) {
+      il = helix_pairs[k].i;
+      jl = helix_pairs[k].j;
 
-      if (mask[i]&group3bit) {
-        ires = residue[i]-1;
-        imol = molecule[i];
-        ires_type = se_map[se[ires]-'A'];
-        il = res_no_l[ires];
-        jl = -1;
+      dx[0] = xo[il][0] - xn[jl][0];
+      dx[1] = xo[il][1] - xn[jl][1];
+      dx[2] = xo[il][2] - xn[jl][2];
 
-        if (ires+helix_i_diff<n && res_no_l[ires+helix_i_diff]!=-1)
-          jl = res_no_l[ires+helix_i_diff];
+      r2sq = dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2];
 
-        if (jl!=-1 && imol==chain_no[jl] && (res_info[jl]==LOCAL || res_info[jl]==GHOST) && (res_info[jl-1]==LOCAL || res_info[jl-1]==GHOST) && res_no[jl-1]-1==ires+helix_i_diff-1) {
+      if (r2sq<helix_cutoff_sq) compute_helix_dtheta_pair(il, jl);
+    }
+  }
 
-          dx[0] = xo[il][0] - xn[jl][0];
-          dx[1] = xo[il][1] - xn[jl][1];
-          dx[2] = xo[il][2] - xn[jl][2];
+  if (helix_flag && ghost_comm_flag) {
+    // helix_xi_2 is already folded into the residue it is read for, see compute_helix_dtheta_pair()
+    dens_reverse_comm(DENS_HELIX_XI, 1);
+    dens_forward_comm(DENS_HELIX_XI, 1);
 
-          r2sq = dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2];
+    for (i = 0; i < nall; i++) {
+      if (isDensityAtom(i)) helix_xi_1[residue[i]-1] = atom_dens[i][DENS_HELIX_XI];
+    }
+  } else if (helix_flag) {
+    MPI_Allreduce(loc_helix_xi_1,helix_xi_1,n,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+    MPI_Allreduce(loc_helix_xi_2,helix_xi_2,n,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+  }
 
-          if (r2sq<helix_cutoff_sq) compute_helix_dtheta_pair(il, jl);
+  timerEnd(TIME_PAIR_SL);
+
+  // second pass over the active pairs to calculate gradients
+
+  if (water_flag) {
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(nthreads) if(nthreads>1) schedule(static) private(ires, jres, i_well, water_gamma_0, water_gamma_1, theta_gamma, ap, slot)
+#endif
+    for (k = 0; k < n_active; k++) {
+      ap = &active_pairs[k];
+      if (!ap->contact) continue;
+      ires = ap->ires;
+      jres = ap->jres;
+
+      for (i_well=0;i_well<n_wells;++i_well) {
+        if (!well_flag[i_well]) continue;
+
+        water_gamma_0 = get_water_gamma(ires, jres, i_well, ap->ires_type, ap->jres_type, 0);
+        water_gamma_1 = get_water_gamma(ires, jres, i_well, ap->ires_type, ap->jres_type, 1);
+
+        // Optimization for gamma[0]==gamma[1]
+        if (!fabs(water_gamma_0 - water_gamma_1)<delta && ap->rsq>well->rmin_theta_sq[i_well] && ap->rsq<well->rmax_theta_sq[i_well]) {
+          theta_gamma = (water_gamma_1 - water_gamma_0)*ap->theta[i_well];
+          slot = dens_slot(ap->i, ires, DENS_WATER_XI, loc_water_xi);
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+          *slot += theta_gamma*water_sigma_h[jres];
+          slot = dens_slot(ap->j, jres, DENS_WATER_XI, loc_water_xi);
+#if defined(_OPENMP)
+#pragma omp atomic
+#endif
+          *slot += theta_gamma*water_sigma_h[ires];
         }
       }
     }
   }
 
-  if (helix_flag) {
-    MPI_Allreduce(loc_helix_xi_1,helix_xi_1,n,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
-    MPI_Allreduce(loc_helix_xi_2,helix_xi_2,n,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+  if (water_flag && ghost_comm_flag) {
+    dens_reverse_comm(DENS_WATER_XI, 1);
+
+    for (i = 0; i < nlocal; i++) {
+      if (isDensityAtom(i)) atom_dens[i][DENS_WATER_XI] *= water_sigma_h_prd[residue[i]-1];
+    }
+
+    dens_forward_comm(DENS_WATER_XI, 1);
+
+    for (i = 0; i < nall; i++) {
+      if (isDensityAtom(i)) water_xi[residue[i]-1] = atom_dens[i][DENS_WATER_XI];
+    }
+  } else if (water_flag) {
+    for (i = 0; i < nall; i++) {
+      ires = residue[i]-1;
+      if ( (mask[i]&groupbit && se[ires]=='G') || (mask[i]&group2bit && se[ires]!='G') ) {
+        if (!b_water_xi[ires]) {
+            loc_water_xi[ires] *= water_sigma_h_prd[ires];
+
+          b_water_xi[ires] = true;
+        }
+      }
+    }
+
+    MPI_Allreduce(loc_water_xi,water_xi,n,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
   }
 
-  timerEnd(TIME_PAIR_SL);
+  timerEnd(TIME_PAIR_DL2);
 
-  // second loop over neighbors of atoms to calculate gradients
+  // forces of the density-dependent terms, streamed over the active pairs
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(nthreads) if(nthreads>1) schedule(static) private(i, j, ires, jres, i_well, water_gamma_0, water_gamma_1, sigma_gamma, direct_contact, factor, force, ff, fthr, ethr, ap)
+#endif
+  for (k = 0; k < n_active; k++) {
+    ap = &active_pairs[k];
+    i = ap->i;
+    j = ap->j;
+    ires = ap->ires;
+    jres = ap->jres;
+    fthr = force_buffer();
+    ethr = energy_buffer();
+
+    force = 0.0;
+
+    if (water_flag) {
+      for (i_well=0;i_well<n_wells;++i_well) {
+        if (!well_flag[i_well]) continue;
+
+        if (ap->contact && ap->rsq>well->rmin_theta_sq[i_well] && ap->rsq<well->rmax_theta_sq[i_well]) {
+          direct_contact = false;
+
+          water_gamma_0 = get_water_gamma(ires, jres, i_well, ap->ires_type, ap->jres_type, 0);
+          water_gamma_1 = get_water_gamma(ires, jres, i_well, ap->ires_type, ap->jres_type, 1);
+
+          // Optimization for gamma[0]==gamma[1]
+          if (fabs(water_gamma_0 - water_gamma_1)<delta) direct_contact = true;
+
+          if (direct_contact) {
+            sigma_gamma = 0.5*(water_gamma_0 + water_gamma_1);
+          } else {
+            sigma_gamma = water_gamma_0 + (water_gamma_1 - water_gamma_0)*water_sigma_h[ires]*water_sigma_h[jres];
+          }
 
-  for (ii = 0; ii < inum; ii++) {
-    i = ilist[ii];
-    itype = type[i];
-    ires = residue[i]-1;
-    imol = molecule[i];
-    ires_type = se_map[se[ires]-'A'];
+          factor = sigma_gamma;
+          ethr[ET_WATER] += -factor*ap->theta[i_well];
 
-    if ( (mask[i]&group2bit && se[ires]!='G') || (mask[i]&groupbit && se[ires]=='G') ) {
-      jlist = firstneigh[i];
-      jnum = numneigh[i];
+          force += factor*ap->prd_theta[i_well];
+        }
+      }
 
-      xi[0] = x[i][0];
-      xi[1] = x[i][1];
-      xi[2] = x[i][2];
+      if ( ap->rsq>well->rmin_theta_sq[0] && ap->rsq<well->rmax_theta_sq[0]) {
+        if (fabs(water_xi[ires])>delta_water_xi) force += ap->prd_theta[0]*water_xi[ires];
+        if (fabs(water_xi[jres])>delta_water_xi) force += ap->prd_theta[0]*water_xi[jres];
+      }
+    }
 
-      for (jj = 0; jj < jnum; jj++) {
-        j = jlist[jj];
-        //factor_lj = special_lj[sbmask(j)];
-        j &= NEIGHMASK;
+    if (burial_flag && ap->rsq>well->rmin_theta_sq[0] && ap->rsq<well->rmax_theta_sq[0]) {
+      force += (burial_force[ires]+burial_force[jres])*ap->prd_theta[0];
+    }
 
-        jtype = type[j];
-        jres = residue[j]-1;
-        jmol = molecule[j];
-        jres_type = se_map[se[jres]-'A'];
+    if (helix_flag && ap->rsq>helix_well->rmin_theta_sq[0] && ap->rsq<helix_well->rmax_theta_sq[0]) {
+      factor = helix_xi_1[ires] + helix_xi_1[jres];
+      if (ires-helix_i_diff>=0) factor += helix_xi_2[ires-helix_i_diff];
+      if (jres-helix_i_diff>=0) factor += helix_xi_2[jres-helix_i_diff];
 
-        if ( (mask[j]&group2bit && se[jres]!='G') || (mask[j]&groupbit && se[jres]=='G') ) {
-          xj[0] = x[j][0];
-          xj[1] = x[j][1];
-          xj[2] = x[j][2];
+      if (fabs(factor)>delta_helix_xi) force += -factor*ap->helix_prd_theta;
+    }
 
-          dx[0] = xi[0] - xj[0];
-          dx[1] = xi[1] - xj[1];
-          dx[2] = xi[2] - xj[2];
+    if (force!=0.0) {
+      ff[0] = force*ap->dx[0];
+      ff[1] = force*ap->dx[1];
+      ff[2] = force*ap->dx[2];
 
-          rsq = dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2];
-          br = false;
+      fthr[i][0] += ff[0];
+      fthr[i][1] += ff[1];
+      fthr[i][2] += ff[2];
 
-          if (water_flag && (imol!=jmol || abs(ires-jres)>=contact_cutoff)) {
+      fthr[j][0] -= ff[0];
+      fthr[j][1] -= ff[1];
+      fthr[j][2] -= ff[2];
+    }
+  }
 
-            for (i_well=0;i_well<n_wells;++i_well) {
-              if (!well_flag[i_well]) continue;
+  // contact restraints from their own list rather than probed per pair
+  if (cont_rest_flag) compute_contact_restraints();
 
-              water_gamma_0 = get_water_gamma(ires, jres, i_well, ires_type, jres_type, 0);
-              water_gamma_1 = get_water_gamma(ires, jres, i_well, ires_type, jres_type, 1);
+  // hydrogen bonding over the O-N candidates; DSSP reads and fills R/p_ap
+  // cache entries of neighbouring pairs, so this loop stays serial
+  if (dssp_hdrgn_flag) {
+    for (k = 0; k < n_dssp_pairs; k++) {
+      il = dssp_pairs[k].i;
+      jl = dssp_pairs[k].j;
 
-              // Optimization for gamma[0]==gamma[1]
-              if (!fabs(water_gamma_0 - water_gamma_1)<delta && rsq>well->rmin_theta_sq[i_well] && rsq<well->rmax_theta_sq[i_well]) {
+      dx[0] = xo[il][0] - xn[jl][0];
+      dx[1] = xo[il][1] - xn[jl][1];
+      dx[2] = xo[il][2] - xn[jl][2];
 
-                if (!br) { r = sqrt(rsq); br = true; }
-                theta_gamma = (water_gamma_1 - water_gamma_0)*well->theta_pair(ires, jres, i_well, r);
-                loc_water_xi[ires] += theta_gamma*water_sigma_h[jres];
-                loc_water_xi[jres] += theta_gamma*water_sigma_h[ires];
-              }
-            }
-          }
-        }
-      }
+      r2sq = dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2];
+
+      if (r2sq < dssp_hdrgn_cut_sq) compute_dssp_hdrgn(il, jl);
     }
   }
 
-  if (water_flag) {
-    for (i = 0; i < nall; i++) {
-      ires = residue[i]-1;
-      if ( (mask[i]&groupbit && se[ires]=='G') || (mask[i]&group2bit && se[ires]!='G') ) {
-        if (!b_water_xi[ires]) {
-            loc_water_xi[ires] *= water_sigma_h_prd[ires];
+  // P_AP over the CA-CA candidates: the missing atom checks and the p_ap
+  // cache entries are done serially, then the pairs are evaluated in
+  // threads that only read the cache
+  if (p_ap_flag) {
+    for (k = 0; k < n_pap_pairs; k++) {
+      il = pap_pairs[k].i;
+      jl = pap_pairs[k].j;
 
-          b_water_xi[ires] = true;
-        }
-      }
+      dx[0] = xca[il][0] - xca[jl][0];
+      dx[1] = xca[il][1] - xca[jl][1];
+      dx[2] = xca[il][2] - xca[jl][2];
+
+      if (dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2] < pap_cutoff_sq) prepare_P_AP(il, jl);
     }
 
-    MPI_Allreduce(loc_water_xi,water_xi,n,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
-  }
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(nthreads) if(nthreads>1) schedule(dynamic,16) private(il, jl, dx)
+#endif
+    for (k = 0; k < n_pap_pairs; k++) {
+      il = pap_pairs[k].i;
+      jl = pap_pairs[k].j;
 
-  timerEnd(TIME_PAIR_DL2);
+      dx[0] = xca[il][0] - xca[jl][0];
+      dx[1] = xca[il][1] - xca[jl][1];
+      dx[2] = xca[il][2] - xca[jl][2];
 
-  // loop over neighbors of my atoms
-  // Main loop
+      if (dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2] < pap_cutoff_sq) compute_P_AP_potential(il, jl);
+    }
+  }
+
+  // loop over neighbors of my atoms for the solvent barrier term
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(nthreads) if(nthreads>1) schedule(dynamic,16) private(i, j, jj, ires, jres, imol, jmol, il, jl, jlist, jnum, xi, xj, dx, rsq)
+#endif
   for (ii = 0; ii < inum; ii++) {
     i = ilist[ii];
     ires = atom->residue[i]-1;
     imol = atom->molecule[i];
-    ires_type = se_map[se[ires]-'A'];
     il = res_no_l[ires];
 
     if ( mask[i]&groupbit || mask[i]&group2bit || mask[i]&group3bit ) {
@@ -7975,7 +10133,6 @@ void FixBackbone::compute_pair()
         j &= NEIGHMASK;
         jres = atom->residue[j]-1;
         jmol = atom->molecule[j];
-        jres_type = se_map[se[jres]-'A'];
         jl = res_no_l[jres];
 
         if ( mask[j]&groupbit || mask[j]&group2bit || mask[j]&group3bit ) {
@@ -7989,143 +10146,17 @@ void FixBackbone::compute_pair()
           dx[2] = xi[2] - xj[2];
 
           rsq = dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2];
-          br = false;
-
-          force = 0.0;
-
-          if ( ( (mask[i]&group2bit && se[ires]!='G') || (mask[i]&groupbit && se[ires]=='G') ) && ( (mask[j]&group2bit && se[jres]!='G') || (mask[j]&groupbit && se[jres]=='G') ) && (imol!=jmol || abs(jres-ires)>1) ) {
-
-            if (water_flag) {
-              for (i_well=0;i_well<n_wells;++i_well) {
-                if (!well_flag[i_well]) continue;
-
-                if ( (imol!=jmol || abs(jres-ires)>=contact_cutoff) && rsq>well->rmin_theta_sq[i_well] && rsq<well->rmax_theta_sq[i_well]) {
-                  direct_contact = false;
-
-                  water_gamma_0 = get_water_gamma(ires, jres, i_well, ires_type, jres_type, 0);
-                  water_gamma_1 = get_water_gamma(ires, jres, i_well, ires_type, jres_type, 1);
-
-                  // Optimization for gamma[0]==gamma[1]
-                  if (fabs(water_gamma_0 - water_gamma_1)<delta) direct_contact = true;
-
-                  if (direct_contact) {
-                    sigma_gamma = 0.5*(water_gamma_0 + water_gamma_1);
-                  } else {
-                    sigma_gamma = water_gamma_0 + (water_gamma_1 - water_gamma_0)*water_sigma_h[ires]*water_sigma_h[jres];
-                  }
-
-                  if (!br) { r = sqrt(rsq); br = true; }
-
-                  factor = sigma_gamma;
-                  energy[ET_WATER] += -factor*well->theta_pair(ires, jres, i_well, r);
-
-                  force += factor*well->prd_theta_pair(ires, jres, i_well, r);
-                }
-              }
-
-              if ( rsq>well->rmin_theta_sq[0] && rsq<well->rmax_theta_sq[0]) {
-                if (fabs(water_xi[ires])>delta_water_xi) {
-                  if (!br) { r = sqrt(rsq); br = true; }
-
-                  force += well->prd_theta_pair(ires, jres, 0, r)*water_xi[ires];
-                }
-
-                if (fabs(water_xi[jres])>delta_water_xi) {
-                  if (!br) { r = sqrt(rsq); br = true; }
-
-                  force += well->prd_theta_pair(ires, jres, 0, r)*water_xi[jres];
-                }
-              }
-            }
-
-            if (burial_flag && rsq>well->rmin_theta_sq[0] && rsq<well->rmax_theta_sq[0]) {
-              if (!br) { r = sqrt(rsq); br = true; }
-
-              force += (burial_force[ires]+burial_force[jres])*well->prd_theta_pair(ires, jres, 0, r);
-            }
-
-            if (helix_flag && rsq>helix_well->rmin_theta_sq[0] && rsq<helix_well->rmax_theta_sq[0]) {
-              factor = helix_xi_1[ires] + helix_xi_1[jres];
-              if (ires-helix_i_diff>=0) factor += helix_xi_2[ires-helix_i_diff];
-              if (jres-helix_i_diff>=0) factor += helix_xi_2[jres-helix_i_diff];
-
-              if (fabs(factor)>delta_helix_xi) {
-                if (!br) { r = sqrt(rsq); br = true; }
-
-                force += -factor*helix_well->prd_theta_pair(ires, jres, 0, r);
-              }
-            }
-
-            if (cont_rest_flag && cr_map_n[MIN(ires,jres)]>0 && rsq<cr_glob_cutoff_sq) {
-              force += compute_contact_restraints_potential(ires, jres, rsq);
-            }
-          }
-
-            if ( mask[i]&group3bit && mask[j]&groupbit && dssp_hdrgn_flag && ( imol!=jmol || abs(jres-ires)>2 ) && se[jres]!='P' && !isLast(il) && !isFirst(jl) ) {
-
-              if (jres>0) kl = res_no_l[jres-1];
-              else kl = -1;
-
-              if (kl!=-1 && oxygens[kl]!=-1 && alpha_carbons[kl]!=-1) {
-                dx[0] = xo[il][0] - xn[jl][0];
-                dx[1] = xo[il][1] - xn[jl][1];
-                dx[2] = xo[il][2] - xn[jl][2];
-
-                r2sq = dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2];
-
-                if (r2sq < dssp_hdrgn_cut_sq) compute_dssp_hdrgn(il, jl);
-              }
-            }
-
-            if ( mask[j]&group3bit && mask[i]&groupbit && dssp_hdrgn_flag && ( imol!=jmol || abs(jres-ires)>2 ) && se[ires]!='P' && !isLast(jl) && !isFirst(il) ) {
-
-              if (ires>0) kl = res_no_l[ires-1];
-              else kl = -1;
-
-              if (kl!=-1 && oxygens[kl]!=-1 && alpha_carbons[kl]!=-1) {
-                dx[0] = xo[jl][0] - xn[il][0];
-                dx[1] = xo[jl][1] - xn[il][1];
-                dx[2] = xo[jl][2] - xn[il][2];
-
-                r2sq = dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2];
-
-                if (r2sq < dssp_hdrgn_cut_sq) compute_dssp_hdrgn(jl, il);
-              }
-            }
 
           if ( mask[i]&groupbit && mask[j]&groupbit) {
 
-              if (p_ap_flag && rsq < pap_cutoff_sq) {
-                if (ires<jres)
-                  compute_P_AP_potential(il, jl);
-                else
-                  compute_P_AP_potential(jl, il);
-              }
-
               /*if ( frag_mem_tb_flag && imol==jmol && abs(jres-ires)>=fm_gamma->minSep() && (fm_gamma->maxSep()==-1 || abs(jres-ires)<=fm_gamma->maxSep()))
                 if (jres>ires) table_fragment_memory(il, jl);
                 else table_fragment_memory(jl, il);*/
 
               if (ssb_flag && ( imol!=jmol || abs(jres-ires)>=ssb_ij_sep ) )
                 compute_solvent_barrier(il, jl);
-
-              if (huckel_flag && abs(jres-ires)>1)
-                compute_DebyeHuckel_Interaction(il, jl);
           }
 
-          if (force!=0.0) {
-            ff[0] = force*dx[0];
-            ff[1] = force*dx[1];
-            ff[2] = force*dx[2];
-
-            f[i][0] += ff[0];
-            f[i][1] += ff[1];
-            f[i][2] += ff[2];
-
-            f[j][0] -= ff[0];
-            f[j][1] -= ff[1];
-            f[j][2] -= ff[2];
-          }
         }
       }
     }
@@ -8134,46 +10165,78 @@ void FixBackbone::compute_pair()
   timerEnd(TIME_PAIR_DL3);
 }
 
-inline int FixBackbone::cr_contact_search(int i1, int i2)
+// Restraints whose first residue is owned here and whose second residue is
+// present as local or ghost. Pairs further apart than the ghost cutoff,
+// which covers the restraint cutoff, contribute nothing.
+void FixBackbone::build_cr_list()
 {
- // if (i2<cr_map[i1][0].i2 || i2>cr_map[i1][cr_map_n[i1]-1].i2) return -1;
+  int i, j, k, i_resno, j_resno;
 
-  for (int i=0;i<cr_map_n[i1];++i)
-    if (cr_map[i1][i].i2==i2) return i;
+  n_cr_list = 0;
+  for (i=0;i<nn;++i) {
+    if (res_info[i]!=LOCAL) continue;
+    i_resno = res_no[i]-1;
+    if ((se[i_resno]=='G' ? alpha_carbons[i] : beta_atoms[i])==-1) continue;
+    for (k=cr_first[i_resno];k<cr_first[i_resno+1];++k) {
+      j_resno = cr_pars[k].i2;
+      j = res_no_l[j_resno];
+      if (j==-1 || (res_info[j]!=LOCAL && res_info[j]!=GHOST)) continue;
+      if ((se[j_resno]=='G' ? alpha_carbons[j] : beta_atoms[j])==-1) continue;
+      // same exclusions as the density atom pairs
+      if (chain_no[i]==chain_no[j] && j_resno-i_resno<=1) continue;
+      cr_list[n_cr_list++] = k;
+    }
+  }
+}
 
-/*  int n_map = (cr_map_n[i1]+1);
-  int nl = n_map  >> 1;
-  for (int i=0;i<nl;++i) {
-    if (i2<cr_map[i1][i].i2) return -1;
-    if (cr_map[i1][i].i2==i2) return i;
-    if (i==(n_map-1-i) || i2>cr_map[i1][n_map-i-1].i2) return -1;
-    if (cr_map[i1][n_map-i-1].i2==i2) return n_map-i-1;
-  }*/
-  
-  return -1;
+void FixBackbone::compute_contact_restraints()
+{
+  int k;
+
+#if defined(_OPENMP)
+#pragma omp parallel for num_threads(nthreads) if(nthreads>1) schedule(static)
+#endif
+  for (k=0;k<n_cr_list;++k)
+    compute_contact_restraints_potential(cr_list[k]);
 }
 
-double FixBackbone::compute_contact_restraints_potential(int ires, int jres, double rsq)
+void FixBackbone::compute_contact_restraints_potential(int k)
 {
-  int k = cr_contact_search(MIN(ires,jres), MAX(ires,jres));
+  double **f = force_buffer();
+  double *energy = energy_buffer();
 
-  if (k==-1) return 0.0;
+  ContactRestraintsPar &par = cr_pars[k];
+  int i = res_no_l[par.i1];
+  int j = res_no_l[par.i2];
+  int iatom, jatom;
+  double dx[3], *xi, *xj, r, dr, V, force;
 
-  double r, dr, drsq, V, force=0.0;
-  ContactRestraintsPar &par = cr_map[MIN(ires,jres)][k];
+  if (se[par.i1]=='G') { xi = xca[i]; iatom = alpha_carbons[i]; }
+  else { xi = xcb[i]; iatom = beta_atoms[i]; }
+  if (se[par.i2]=='G') { xj = xca[j]; jatom = alpha_carbons[j]; }
+  else { xj = xcb[j]; jatom = beta_atoms[j]; }
 
-  r = sqrt(rsq);
+  dx[0] = xi[0] - xj[0];
+  dx[1] = xi[1] - xj[1];
+  dx[2] = xi[2] - xj[2];
+
+  r = sqrt(dx[0]*dx[0] + dx[1]*dx[1] + dx[2]*dx[2]);
   dr = r - par.r0;
 
-  if (fabs(dr) < cr_dr_cutoff) {
-    drsq = dr*dr;
+  if (fabs(dr) >= cr_dr_cutoff) return;
 
-    V = -par.w*exp(-0.5*drsq*cr_sigma_sq_inv);
-    force = V*dr*cr_sigma_sq_inv/r;
+  V = -par.w*math_exp(-0.5*dr*dr*cr_sigma_sq_inv);
+  force = V*dr*cr_sigma_sq_inv/r;
 
-    energy[ET_CONT_REST] += V;
-  }
-  return force;
+  energy[ET_CONT_REST] += V;
+
+  f[iatom][0] += force*dx[0];
+  f[iatom][1] += force*dx[1];
+  f[iatom][2] += force*dx[2];
+
+  f[jatom][0] -= force*dx[0];
+  f[jatom][1] -= force*dx[1];
+  f[jatom][2] -= force*dx[2];
 }
 
 /* ---------------------------------------------------------------------- */
@@ -8192,9 +10255,44 @@ void FixBackbone::pre_force(int vflag)
 
 void FixBackbone::pre_force_respa(int vflag, int ilevel, int iloop)
 {
-  if (ilevel == nlevels_respa-1) pre_force(vflag);
+  int k;
+
+  if (!respa_flag) {
+    if (ilevel == nlevels_respa-1) pre_force(vflag);
+    return;
+  }
+
+  // the outermost level always runs for the analysis and energy output
+  if (ilevel != nlevels_respa-1) {
+    for (k=1;k<nEnergyTerms;++k)
+      if (respa_term_level[k]==ilevel && (respa_switch_on[k][0] || respa_switch_on[k][1] || respa_switch_on[k][2])) break;
+    if (k==nEnergyTerms) return;
+  }
+
+  respa_ilevel = ilevel;
+  respa_select_terms(ilevel);
+  pre_force(vflag);
+  respa_select_terms(-1);
+  respa_ilevel = -1;
 }
 
+/* ---------------------------------------------------------------------- */
+
+// Switch on only the terms assigned to rRESPA level ilevel; ilevel<0
+// restores the switches read from the coefficient file
+void FixBackbone::respa_select_terms(int ilevel)
+{
+  int k, l;
+
+  for (k=1;k<nEnergyTerms;++k) {
+    for (l=0;l<3;++l) {
+      if (!respa_switch[k][l]) continue;
+      *respa_switch[k][l] = respa_switch_on[k][l] && (ilevel<0 || respa_term_level[k]==ilevel);
+    }
+  }
+}
+
+
 /* ---------------------------------------------------------------------- */
 
 void FixBackbone::min_pre_force(int vflag)
@@ -22,6 +22,7 @@ FixStyle(backbone,FixBackbone)
 
 #include "fix.h"
 
+#include "fast_math.h"
 #include "smart_matrix_lib.h"
 #include "fragment_memory.h"
 
@@ -47,6 +48,10 @@ class FixBackbone : public Fix {
   double compute_scalar();
   double compute_vector(int);
   void init_list(int, class NeighList *);
+  int pack_forward_comm(int, int *, double *, int, int *);
+  void unpack_forward_comm(int, int, double *);
+  int pack_reverse_comm(int, int, double *);
+  void unpack_reverse_comm(int, int *, double *);
 
 // private:
 public:
@@ -66,6 +71,13 @@ public:
   bool ssweight[12];
   double w[12], sigma[12], phiw[12], phi0[12], psiw[12], psi0[12], *aps[12];
 
+  // [Rama_Table]: periodic (phi, psi) grids of V, dV/dphi, dV/dpsi and
+  // d2V/dphi/dpsi interpolated bicubically. Table 0 sums the unweighted
+  // regular terms, table 1 the unweighted proline terms and table
+  // rama_table_ssw[j] holds ssweight term j, scaled per residue by aps[j].
+  int rama_table_flag, rama_table_n, n_rama_table, rama_table_ssw[12];
+  double *rama_table;
+
   // Hydrogen bonding parameters
   double hbscl[4][9], sigma_NO, sigma_HO, NO_zero, HO_zero, sigma_NO_sqinv, sigma_HO_sqinv;
   double k_dssp, dssp_hdrgn_cut, dssp_hdrgn_cut_sq, pref[2], d_nu0;
@@ -92,6 +104,7 @@ public:
   // Burial potential parameters
   double k_burial;
   double burial_ro_min[3], burial_ro_max[3];
+  double burial_exp_ro_min[3], burial_exp_ro_max[3], burial_exp_max_arg;
   double burial_gamma[20][3];
 
   // Helical hydrogen bonding parameters
@@ -109,14 +122,15 @@ public:
   double amh_go_p;
   Fragment_Memory *m_amh_go;
   Gamma_Array *amh_go_gamma;
-  double **amh_go_force;
-  int *amh_go_force_map;
   double *amh_go_norm;
-  int **frustration_censoring_map;
-  double **r_nativeCACA;
-  double **r_nativeCBCB;
-  double **r_nativeCACB;
+  int amh_go_npairs;
+  int *amh_go_first; // [2*n+1] CSR offsets of the native pairs of site 2*residue+atom with higher sites
+  int *amh_go_site; // partner site of each native pair
+  double *amh_go_sigma_sq; // Gaussian width of each pair
+  double *amh_go_rn, *amh_go_gm, *amh_go_dE; // [2*k] as seen from the lower site, [2*k+1] from the partner
+  int *amh_go_near; // pair k was within the neighbor list cutoff at the last reneighboring
   double amh_go_pl_cutoff;
+  double *amh_go_sigma_sq_sep; // |i-j|^0.3 indexed by sequence separation
 
   // Fragment Memory parameters
   double k_frag_mem;
@@ -127,6 +141,15 @@ public:
   char fm_gamma_file[100];
   double fm_sigma_exp;
 
+  // All memory interactions of residue i_resno, flattened into entries
+  // fm_list_start[i_resno]..fm_list_start[i_resno+1]-1; fm_list_sites has
+  // bit 1 set when the i site is CB and bit 0 when the j site is CB
+  int fm_list_n, fm_list_max, *fm_list_start, *fm_list_j;
+  char *fm_list_sites;
+  double *fm_list_rf, *fm_list_inv2sigsq, *fm_list_eps;
+  bool fm_list_dirty;
+  double *fm_sigma_sq_sep; // |i-j|^(2*fm_sigma_exp) indexed by sequence separation
+
   // Fragment Frustratometer parameters
   int n_decoy_mems, **decoy_mem_map, *ilen_decoy_map;
   Fragment_Memory **decoy_mems;
@@ -166,14 +189,37 @@ public:
   TBV **fm_table;
   int tb_size, tb_nbrs;
   double tb_rmin, tb_rmax, tb_dr;
-  int fm_use_table_flag, fm_read_table_flag;
+  int fm_use_table_flag, fm_read_table_flag; // fm_use_table_flag: 1 text tables, 2 binary fm_table.bin
+  void *fm_table_map;
+  TBV *fm_table_data; // one block holding every computed table
+  size_t fm_table_map_size;
+  int fm_tb_range_error; // set by the kernels when r falls outside the table
+
+  // Compact FM table: CSR index over the non-empty (i, j) pairs, float
+  // energy and dV/dr per table, cubic Hermite interpolation
+  int fm_compact_flag, fmc_size, fmc_npairs, fmc_ntables;
+  double fmc_dr;
+  int *fmc_row, *fmc_col, *fmc_slot;
+  float *fmc_e, *fmc_d;
+  double *fmc_err; // max interpolation error of energy and dV/dr per table
+
+  // Shared_Memory: read-only fragment data and FM tables are kept once per
+  // node in MPI shared memory segments
+  enum ShmLimits{MAX_SHM_WIN=8};
+  int shm_flag, shm_me, shm_nprocs, shm_node, shm_nnodes, n_shm_win;
+  bool shm_reading; // true while only the node leader reads
+  MPI_Comm shm_comm, shm_leader_comm;
+  MPI_Win shm_win[MAX_SHM_WIN];
 
   // Contact Restraints parameters
   double k_cont_rest, cr_sigma, cr_sigma_sq_inv;
   double cr_glob_cutoff_sq, cr_dr_cutoff;
   char cr_file[100];
-  int *cr_map_n;
-  ContactRestraintsPar **cr_map;
+  // restraints sorted by (i1,i2); those of residue i1 are
+  // cr_pars[cr_first[i1]] to cr_pars[cr_first[i1+1]-1]
+  int n_cont_rest, *cr_first;
+  ContactRestraintsPar *cr_pars;
+  int n_cr_list, *cr_list; // restraints computed by this proc
 
   // Vector Fragment Memory
   double k_vec_frag_mem;
@@ -195,6 +241,9 @@ public:
   double *charge_on_residue;
   bool huckel_flag; //flag to turn on DebyeHuckel
   int debye_huckel_min_sep; // minimum sequence separation for DH interaction
+  bool dh_cutoff_flag; // shifted-force cutoff at dh_cutoff_factor screening lengths
+  double dh_cutoff_factor, dh_cutoff, dh_cutoff_sq, dh_e_rc, dh_f_rc;
+  int n_dh_res, *dh_res; // local indices of the charged residues
 
   // Amylometer variables
   char amylometer_sequence_file[100];
@@ -214,6 +263,13 @@ public:
   double rho0_max;
   double rho0_distor;
   double g_memb[3][4];
+  // local residues that need the full kernel, the others adding the
+  // constant memb_bulk_V; optional tables over z and rho-rho0
+  int memb_resort, n_memb_kernel, *memb_kernel;
+  double memb_bulk_V;
+  int memb_table_flag, memb_tb_nz, memb_tb_nu;
+  double memb_tb_dr, memb_tb_zmax, memb_tb_umax;
+  double *memb_tb_z, *memb_tb_u;
 
   // Selection Temperature
   char selection_temperature_file_name[100];
@@ -263,7 +319,6 @@ public:
   int nlevels_respa;
   bool allocated;
   class NeighList *list;         // standard neighbor list used by most pairs
-  class NeighList *listfull;         // standard neighbor list used by most pairs
 
   // Pair style computation arrays
   double *loc_water_ro;
@@ -281,6 +336,39 @@ public:
   double *helix_xi_1;
   double *helix_xi_2;
   double *burial_force;
+
+  // Per-atom density, xi and AMH-Go Ei accumulators exchanged with ghost-only
+  // forward/reverse comm instead of n-length MPI_Allreduce
+  int ghost_comm_flag, dens_nmax, comm_stage, comm_nvals;
+  double **atom_dens;
+  enum DensTerms{DENS_WATER_RO=0, DENS_HELIX_RO, DENS_WATER_XI, DENS_HELIX_XI, DENS_AMHGO_EI, nDens};
+
+  // Density atom pairs of the neighbor list shared by the three passes of
+  // compute_pair(); geometry and well values are refreshed in the first pass
+  struct ActivePair {
+    int i, j, ires, jres, ires_type, jres_type;
+    bool contact;
+    double rsq, r, dx[3];
+    double theta[5], prd_theta[5];
+    double helix_theta, helix_prd_theta;
+  };
+  int n_active, max_active;
+  bool rebuild_active_pairs;
+  ActivePair *active_pairs;
+
+  // O-N hydrogen bond candidates of the DSSP and helix terms as local
+  // residue indices of the O acceptor and N donor, and the CA-CA candidates
+  // of P_AP with i before j in sequence, rebuilt with the active pairs
+  // within the cutoffs plus the reneighboring padding, and the pairs of
+  // charged residues evaluated by Debye-Huckel, see build_dh_list()
+  struct HBondPair {
+    int i, j;
+  };
+  int n_dssp_pairs, max_dssp_pairs, n_helix_pairs, max_helix_pairs;
+  int n_pap_pairs, max_pap_pairs;
+  int n_dh_pairs, max_dh_pairs;
+  HBondPair *dssp_pairs, *helix_pairs, *pap_pairs, *dh_pairs;
+
   bool *b_water_sigma_h;
   bool *b_helix_sigma_h;
   bool *b_water_xi;
@@ -288,6 +376,7 @@ public:
   bool *b_burial_force;
 
   int ntimestep;
+  int cache_stamp; // counts compute_backbone() calls, so rRESPA levels of one step see fresh caches
   int n, nn; // n is the total number of residues, nn is the local number of residues
   double an, bn, cn, ap, bp, cp, ah, bh, ch;
   int *alpha_carbons;
@@ -295,7 +384,10 @@ public:
   int *oxygens;
   int *res_no, *res_info, *chain_no;
   int *res_no_l;
+  int *res_atom_map; // [3*n] first CA, CB and O atom index of each residue tag
   double **xca, **xcb, **xo, **xn, **xcp, **xh;
+  double *site_arena; // backing store of the site arrays above
+  int site_stride;
   double **x, **f;
   int *image;
   double prd[3], half_prd[3];
@@ -320,9 +412,24 @@ public:
   bool monte_carlo_seq_opt_flag;
   double pair_list_cutoff;
 
+  // OpenMP threading
+  int nthreads, thr_nmax;
+  double ***thr_f;
+  double **thr_energy;
+
+  // [FastMath]: 0 uses libm, 1 the approximations of fast_math.h, 2 the
+  // approximations checked against libm every fast_math_validate_every steps
+  int fast_math_flag, fast_math_validate_every;
+  bool fast_math_on;
+  inline double math_exp(double x);
+  inline double math_tanh(double x);
+  inline double math_sin(double x);
+  inline double math_cos(double x);
+
   enum Atoms{CA0 = 0, CA1, CA2, O0, O1, nAtoms};
   enum Angles{PHI = 0, PSI, nAngles};
   enum ResInfo{NONE=0, LOCAL, GHOST, OFF};
+  enum Sites{SITE_CA=0, SITE_CB, SITE_O, SITE_N, SITE_CP, SITE_H, nSites};
 
   char *se; // Protein sequance
   int nch, ch_len[1000], ch_pos[1000];
@@ -331,10 +438,16 @@ public:
   enum EnergyTerms{ET_TOTAL=0, ET_CHAIN, ET_SHAKE, ET_CHI, ET_RAMA, ET_VEXCLUDED, ET_DSSP, ET_PAP,
 		   ET_WATER, ET_BURIAL, ET_HELIX, ET_AMHGO, ET_FRAGMEM, ET_VFRAGMEM, ET_CONT_REST, ET_MEMB, ET_SSB, ET_DH, nEnergyTerms};
 
+  // [Respa_Levels]: rRESPA level of each energy term (-1 for the outermost).
+  // While a level runs, the switches of the terms on other levels are
+  // cleared and their energies keep the values from their own level.
+  int respa_flag, respa_ilevel, respa_level[nEnergyTerms], respa_term_level[nEnergyTerms];
+  bool *respa_switch[nEnergyTerms][3], respa_switch_on[nEnergyTerms][3];
+
   double ctime[30], previous_time;
   enum ComputeTime{TIME_CHAIN=0, TIME_SHAKE, TIME_CHI, TIME_RAMA, TIME_VEXCLUDED, TIME_DSSP, TIME_PAP,
 		   TIME_WATER, TIME_BURIAL, TIME_HELIX, TIME_AMHGO, TIME_FRAGMEM, TIME_VFRAGMEM, TIME_MEMB,
-                   TIME_SSB, TIME_DH, TIME_FRUST, TIME_PAIR, TIME_PAIR_DL1, TIME_PAIR_SL, TIME_PAIR_DL2, TIME_PAIR_DL3, TIME_TOTAL, TIME_N};
+                   TIME_SSB, TIME_DH, TIME_FRUST, TIME_PAIR, TIME_PAIR_DL1, TIME_PAIR_SL, TIME_PAIR_DL2, TIME_PAIR_DL3, TIME_THR_RESIDUES, TIME_TOTAL, TIME_N};
 
  private:
   void compute_backbone();
@@ -343,35 +456,61 @@ public:
   void compute_shake(int i);
   void compute_chi_potential(int i);
   void compute_rama_potential(int i);
-  void compute_rama_force(int i, double *force1);
+  void compute_rama_force(int i, double *force1, double y_slope[][nAtoms][3], double x_slope[][nAtoms][3]);
+  void build_rama_table();
+  inline void rama_table_eval(int t, double weight, double phi, double psi, double &V, double *dV);
   void read_contact_restraints_file();
   void compute_excluded_volume();
   void compute_p_degree_excluded_volume();
   void compute_r6_excluded_volume();
   void compute_dssp_hdrgn(int i, int j);
   void compute_P_AP_potential(int i, int j);
+  void P_AP_pair_types(int i, int j, bool &i_AP_med, bool &i_AP_long, bool &i_P);
+  void prepare_P_AP(int i, int j);
   void compute_water_potential(int i, int j);
   void compute_burial_potential(int i);
   void compute_helix_potential(int i, int j);
   void compute_helix_dtheta_pair(int i, int j);
   void compute_amh_go_model();
+  void build_fm_list();
+  void check_residue_partners();
   void compute_fragment_memory_potential(int i);
   void compute_decoy_memory_potential(int i, int decoy_calc);
   void randomize_decoys();
   void compute_generated_decoy_energies();
   void compute_fragment_frustration();
   void compute_solvent_barrier(int i, int j);
+  int fm_table_layout(int *tb_slot, int *res_first);
+  void fm_table_partition(int *res_first, int ntables, int *counts, int *displs, int &first, int &last);
+  void fm_table_gather(void *data, int *counts, int *displs, MPI_Datatype type, int iwin);
+  int fm_table_contributions(int first, int last, int *tb_slot, int *res_first,
+			     int *&c_slot, double *&c_rf, double *&c_sigma_sq, double *&c_eps);
   void compute_fragment_memory_table();
+  void compute_fragment_memory_compact_table();
+  inline int fm_compact_pair(int tb_i, int tb_j);
+  inline void fm_compact_eval(int t, double r, double &V, double &dV);
   void read_fragment_memory_table();
   void output_fragment_memory_table();
+  void write_fragment_memory_table_binary();
+  void map_fragment_memory_table();
   void table_fragment_memory(int i, int j);
-  void compute_amhgo_normalization();
+  void setup_amh_go_pairs(int **censored, double **rn_caca, double **rn_cbcb, double **rn_cacb);
+  void build_amh_go_near();
+  inline double amh_go_rnative(int i, int iatom, int j, int jatom, double **rn_caca, double **rn_cbcb, double **rn_cacb);
   void compute_vector_fragment_memory_potential(int i);
   void compute_amylometer();
   void read_amylometer_sequences(char *amylometer_sequence_file, int amylometer_nmer_size, int amylometer_mode);
+  void setup_membrane_table();
+  inline void memb_table_eval(const double *tb, int ntb, int nf, double xmin, double x, double *v, double *dv);
+  void sort_membrane_residues();
+  void compute_membrane();
   void compute_membrane_potential(int i);
+  void build_dh_list();
+  void compute_DebyeHuckel_list();
   void compute_DebyeHuckel_Interaction(int i, int j);
-  double compute_contact_restraints_potential(int ires, int jres, double rsq);
+  void build_cr_list();
+  void compute_contact_restraints();
+  void compute_contact_restraints_potential(int k);
 
   // Tertiary Frustratometer Functions
   void compute_tert_frust();
@@ -431,11 +570,13 @@ public:
   inline void Construct_Computational_Arrays();
   int Tag(int index);
 
-  void calcDihedralAndSlopes(int, double& angle, int iAng);
-  double y_slope[nAngles][nAtoms][3], x_slope[nAngles][nAtoms][3];
+  void calcDihedralAndSlopes(int, double& angle, int iAng, double y_slope[][nAtoms][3], double x_slope[][nAtoms][3]);
   inline double PeriodicityCorrection(double d, int i);
   inline bool isFirst(int index);
   inline bool isLast(int index);
+  inline bool isOuterLevel();
+  void respa_select_terms(int ilevel);
+  void compute_analysis();
   inline double anti_HB(int res1, int res2, int k);
   inline double anti_NHB(int res1, int res2, int k);
   inline double para_HB(int res1, int res2, int k);
@@ -443,22 +584,45 @@ public:
   inline double anti_one(int res);
   inline double get_water_gamma(int i_resno, int j_resno, int i_well, int ires_type, int jres_type, int local_dens);
   inline double get_burial_gamma(int i_resno, int irestype, int local_dens);
-  inline int cr_contact_search(int i1, int i2);
+  inline void compute_burial_tanh(double ro, double t[3][2]);
   double calc_exp_helix_cutoff();
 
   inline void print_log(const char *line);
   void final_log_output();
   Fragment_Memory **read_mems(char *mems_file, int &n_mems);
+  Fragment_Memory **read_mems_library(FILE *file, int &n_mems);
+  Fragment_Memory **read_mems_shared(char *mems_file, int &n_mems);
+  void share_mems(Fragment_Memory **mems, int n_mems);
+  void read_error(const char *file, int line, const char *str);
+  void *shm_allocate(size_t nbytes, int &iwin);
+  void shm_sync(int iwin);
   bool isEmptyString(char *str);
   char *ltrim(char *s);
   char *rtrim(char *s);
   char *trim(char *s);
   inline bool file_exists (const char *name);
-  static int cmp_cr_map_i2(const void *a, const void *b);
+  static int cmp_cr_pars(const void *a, const void *b);
 
   inline void timerBegin();
   inline void timerEnd(int which);
 
+  inline double **force_buffer();
+  inline double *energy_buffer();
+  void thr_zero();
+  void thr_reduce();
+  void build_active_pairs();
+  void build_hbond_pairs();
+  void add_hbond_pair(HBondPair *&pairs, int &npairs, int &maxpairs, int i, int j);
+  void compute_fast_math_group(int group);
+  void validate_fast_math();
+
+  inline double *dens_slot(int i, int ires, int which, double *loc);
+  inline bool isDensityAtom(int i);
+  void dens_grow();
+  void dens_zero();
+  void dens_reverse_comm(int first, int count);
+  void dens_forward_comm(int first, int count);
+
   cP_AP<double, FixBackbone> *p_ap;
   cR<double, FixBackbone> *R;
   cWell<double, FixBackbone> *well;
@@ -47,6 +47,7 @@ private:
   int n, nn;
   int *alpha_carbons;
   int *res_no, *res_info, *chain_no;
+  int *res_atom_map;
   int *image;
   int *periodicity;
   int seed;
@@ -168,6 +168,7 @@ FixQBias::~FixQBias()
 		delete [] alpha_carbons;
 		delete [] xca;
 		delete [] res_no;
+		delete [] res_atom_map;
 		delete [] res_info;
 		delete [] chain_no;
 
@@ -203,28 +204,29 @@ inline void FixQBias::Construct_Computational_Arrays()
 
 	int i, j, js;
 
+	// Bucket alpha carbons by residue tag in a single pass over local and ghost atoms,
+	// keeping the first (lowest index) atom of each tag
+	int max_tag = 0;
+	for (i = 0; i < n; ++i) res_atom_map[i] = -1;
+	for (j = 0; j < nall; ++j) {
+		if (res_tag[j]<=0)
+			error->all(FLERR,"Residue index must be positive in fix qbias");
+
+		if (mask[j] & groupbit) {
+			if (res_tag[j]>n)
+				error->all(FLERR,"Residue index is out of range in fix qbias");
+			if (res_atom_map[res_tag[j]-1]==-1) res_atom_map[res_tag[j]-1] = j;
+			if (res_tag[j]>max_tag) max_tag = res_tag[j];
+		}
+	}
+
 	// Creating index arrays for Alpha_Carbons
 	nn = 0;
-	int last = 0;
-	for (i = 0; i < n; ++i) {
-		int min = -1, jm = -1;
-		for (int j = 0; j < nall; ++j) {
-			if (i==0 && res_tag[j]<=0)
-				error->all(FLERR,"Residue index must be positive in fix qbias");
-			
-			if ( (mask[j] & groupbit) && res_tag[j]>last ) {
-				if (res_tag[j]<min || min==-1) {
-					min = res_tag[j];
-					jm = j;
-				}
-			}
-		}
-		
-		if (min==-1) break;
+	for (i = 0; i < max_tag; ++i) {
+		if (res_atom_map[i]==-1) continue;
 
-		alpha_carbons[nn] = jm;
-		res_no[nn] = min;
-		last = min;
+		alpha_carbons[nn] = res_atom_map[i];
+		res_no[nn] = i+1;
 		nn++;
 	}
 
@@ -290,6 +292,7 @@ void FixQBias::allocate()
 	alpha_carbons = new int[n];
 	xca = new double*[n];
 	res_no = new int[n];
+	res_atom_map = new int[n];
 	res_info = new int[n];
 	chain_no = new int[n];
 
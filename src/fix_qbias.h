@@ -54,6 +54,7 @@ private:
   int l;
   double **rN, **r, **q;
   int *res_no, *res_info, *chain_no;
+  int *res_atom_map;
   double **x, **f;
   double **xca;
   int *image;
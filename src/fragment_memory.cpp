@@ -31,14 +31,65 @@ int fm_se_map[] = {0, 0, 4, 3, 6, 13, 7, 8, 9, 0, 11, 10, 12, 2, 0, 14, 5, 1, 15
 // 4) HPB: Hydrophobic (CYS, ILE, LEU, MET, PHE, TRP, TYR, VAL) or (C, I, L, M, F, W, Y, V)  or {4, 9, 10, 12, 13, 17, 18, 19}
 int four_letter_map[] = {1, 3, 2, 2, 4, 2, 2, 1, 3, 4, 4, 3, 4, 4, 1, 1, 1, 4, 4, 4};
 
+// Arena holding the distance matrices of all memories. Blocks are handed out
+// from large chunks and all chunks are released with the last memory.
+#define FM_ARENA_CHUNK 1048576
+
+static float **fm_arena_chunks = NULL;
+static int fm_arena_nchunks = 0;
+static size_t fm_arena_used = 0, fm_arena_size = 0;
+static int fm_arena_users = 0;
+
+static float *fm_arena_alloc(size_t n)
+{
+  float *block;
+
+  if (fm_arena_nchunks==0 || fm_arena_used+n>fm_arena_size) {
+    fm_arena_size = (n>FM_ARENA_CHUNK ? n : FM_ARENA_CHUNK);
+    fm_arena_chunks = (float **) realloc(fm_arena_chunks, (fm_arena_nchunks+1)*sizeof(float *));
+    fm_arena_chunks[fm_arena_nchunks++] = new float[fm_arena_size];
+    fm_arena_used = 0;
+  }
+
+  block = fm_arena_chunks[fm_arena_nchunks-1] + fm_arena_used;
+  fm_arena_used += n;
+  fm_arena_users++;
+
+  return block;
+}
+
+static void fm_arena_release()
+{
+  if (--fm_arena_users>0) return;
+
+  for (int i=0;i<fm_arena_nchunks;++i) delete [] fm_arena_chunks[i];
+  free(fm_arena_chunks);
+  fm_arena_chunks = NULL;
+  fm_arena_nchunks = 0;
+  fm_arena_used = fm_arena_size = 0;
+}
+
 Fragment_Memory::Fragment_Memory(int p, int pf, int l, double w, char *fname, bool vec_fm_flag)
 {
-  int i, j, nAtoms, ires, iatom, nca=0, ncb=0;
-  double x, y, z, **xca, **xcb;
-  char buff[201], resty[6], atomty[6], ires_str[6], iatom_str[6];
+  error = ERR_NONE;
+
+  pos = p;
+  len = l;
+  mpos = p + len/2 + len%2;
+  fpos = pf;
+  weight = w;
+  vfm_flag = vec_fm_flag;
+
+  allocate();
 
-  FILE * file;
+  Fragment_Structure fs(fname);
+  if (fs.error!=ERR_NONE) { error = fs.error; return; }
 
+  build(&fs, fname);
+}
+
+Fragment_Memory::Fragment_Memory(int p, int pf, int l, double w, Fragment_Structure *fs, char *fname, bool vec_fm_flag)
+{
   error = ERR_NONE;
 
   pos = p;
@@ -48,102 +99,147 @@ Fragment_Memory::Fragment_Memory(int p, int pf, int l, double w, char *fname, bo
   weight = w;
   vfm_flag = vec_fm_flag;
 
+  allocate();
+
+  if (fs->error!=ERR_NONE) { error = fs->error; return; }
+
+  build(fs, fname);
+}
+
+Fragment_Memory::Fragment_Memory(FILE *lib)
+{
+  int hdr[4];
+
+  error = ERR_NONE;
+
+  len = 0;
+  vfm_flag = 0;
+  se = NULL;
+  data = NULL;
+  owns_data = false;
+
+  if (fread(hdr, sizeof(int), 4, lib)!=4 || fread(&weight, sizeof(double), 1, lib)!=1 || hdr[2]<=0) { error = ERR_FILE; return; }
+
+  pos = hdr[0];
+  fpos = hdr[1];
+  len = hdr[2];
+  vfm_flag = hdr[3];
+  mpos = pos + len/2 + len%2;
+
+  allocate();
+
+  if (fread(se, sizeof(char), len, lib)!=(size_t)len) { error = ERR_FILE; return; }
+  if (fread(data, sizeof(float), data_size, lib)!=data_size) { error = ERR_FILE; return; }
+}
+
+// data holds the CA-CA and CB-CB triangles (i<j), the CA-CB square and, for
+// vector FM, the upper triangle of vmf including the diagonal
+void Fragment_Memory::allocate()
+{
   se = new char[len];
-  rf[0] = new double*[len];
-  rf[1] = new double*[len];
-  if (vfm_flag) vmf = new double*[len];
-  xca = new double*[len];
-  xcb = new double*[len];
-  for (i=0;i<len;++i) {
-    rf[0][i] = new double[len];
-    rf[1][i] = new double[len];
-    if (vfm_flag) vmf[i] = new double[len];
-    xca[i] = new double[3];
-    xcb[i] = new double[3];
-  }
+  data = NULL;
+  set_layout();
+  data = fm_arena_alloc(data_size);
+  owns_data = true;
+  set_layout();
+}
 
+void Fragment_Memory::set_layout()
+{
+  size_t ntri = (size_t)len*(len-1)/2;
+
+  data_size = 2*ntri + (size_t)len*len;
+  if (vfm_flag) data_size += ntri + len;
+
+  rf_caca = data;
+  rf_cbcb = rf_caca + ntri;
+  rf_cacb = rf_cbcb + ntri;
+  vmf = (vfm_flag ? rf_cacb + (size_t)len*len : NULL);
+}
+
+// The image is the write() record with se and data padded to 8 bytes, so
+// that images can be packed back to back in one buffer
+Fragment_Memory::Fragment_Memory(char *image)
+{
+  int *hdr = (int *) image;
+
+  error = ERR_NONE;
+
+  pos = hdr[0];
+  fpos = hdr[1];
+  len = hdr[2];
+  vfm_flag = hdr[3];
+  mpos = pos + len/2 + len%2;
+  memcpy(&weight, image+4*sizeof(int), sizeof(double));
+
+  se = image + 4*sizeof(int) + sizeof(double);
+  data = (float *) (se + (len+7)/8*8);
+  owns_data = false;
+  set_layout();
+}
+
+size_t Fragment_Memory::image_size()
+{
+  return 4*sizeof(int) + sizeof(double) + (len+7)/8*8 + (data_size*sizeof(float)+7)/8*8;
+}
+
+void Fragment_Memory::write_image(char *image)
+{
+  int hdr[4];
+
+  hdr[0] = pos;
+  hdr[1] = fpos;
+  hdr[2] = len;
+  hdr[3] = vfm_flag;
+
+  memset(image, 0, image_size());
+  memcpy(image, hdr, 4*sizeof(int));
+  memcpy(image+4*sizeof(int), &weight, sizeof(double));
+  memcpy(image+4*sizeof(int)+sizeof(double), se, len);
+  memcpy(image+4*sizeof(int)+sizeof(double)+(len+7)/8*8, data, data_size*sizeof(float));
+}
+
+void Fragment_Memory::build(Fragment_Structure *fs, char *fname)
+{
+  int i, j, k, ires, nca=0, ncb=0;
+  double (*xca)[3], (*xcb)[3];
+
+  xca = new double[len][3];
+  xcb = new double[len][3];
   for (i=0;i<len;++i) {
     xca[i][0] = xca[i][1] = xca[i][2] = 0.0;
     xcb[i][0] = xcb[i][1] = xcb[i][2] = 0.0;
   }
 
-  nca = ncb = 0;
-  file = fopen(fname,"r");
-  if (!file) { error = ERR_FILE; return; }
-  fgets(buff, 200, file);
-  fscanf(file, "%d",&nAtoms);
-fgets(buff, 200, file);
-
-    // This will assign coordinates of wrong chain when reading multi-chain gro file
+  // This will assign coordinates of wrong chain when reading multi-chain gro file
   // Not applicable with AMH-Go model
-
-  for (i=0;i<nAtoms;++i) {
-     fscanf(file, "%d %s %s %d %lf %lf %lf",&ires,resty,atomty,&iatom,&x,&y,&z);
-
-     if (ires>fpos+len) break;
-
-     if (ires>fpos && ires<=fpos+len) {
-  ires -= fpos + 1;
-  x *= 10; y *= 10; z *= 10;
-  if (strcmp(atomty,"CA")==0) {
-  if (ires>=len || nca>=len) { error = ERR_ATOM_COUNT; return; }
-  se[ires] = ThreeLetterToOne(resty);
-  if (se[ires]=='-') { error = ERR_RES; return; }
-  xca[ires][0] = x;
-  xca[ires][1] = y;
-  xca[ires][2] = z;
-  nca++;
-  }
-       if (strcmp(atomty,"CB")==0) {
-  if (ires>=len || ncb>=len) { error = ERR_ATOM_COUNT; return; }
-  xcb[ires][0] = x;
-         xcb[ires][1] = y;
-         xcb[ires][2] = z;
-         ncb++;
-       }
-     }
-   }
-
-  // HaoWu copy from BinZhang's version, reads multi-chain gro file correctly
-  /*  int count=-1;
-  int old_ires=-9999;
-  for (i=0;i<nAtoms;++i) {
-    fscanf(file, "%d %s %s %d %lf %lf %lf",&ires,resty,atomty,&iatom,&x,&y,&z);
-    //if (ires>fpos && ires<=fpos+len) {
-    if(count>=len){fprintf(stderr, "nca=%d, count=%d, ires=%d, fpos=%d\n", nca, count, ires, fpos); break;} //faster than reading the whole file
-    if (ires>fpos) {
-      if(ires!=old_ires){
-    ++count;
-    old_ires=ires;
-    if(count>=len){
-        //fprintf(stderr, "nca=%d, count=%d, ires=%d, fpos=%d\n", nca, count, ires, fpos);
-        break; //faster than reading the whole file
-    }
+  for (k=0;k<fs->natoms && error==ERR_NONE;++k) {
+    ires = fs->ires[k];
+
+    if (ires>fpos+len) break;
+
+    if (ires>fpos && ires<=fpos+len) {
+      ires -= fpos + 1;
+      if (fs->type[k]==FM_CA) {
+	if (ires>=len || nca>=len) { error = ERR_ATOM_COUNT; break; }
+	se[ires] = fs->se[k];
+	if (se[ires]=='-') { error = ERR_RES; break; }
+	xca[ires][0] = fs->x[k][0];
+	xca[ires][1] = fs->x[k][1];
+	xca[ires][2] = fs->x[k][2];
+	nca++;
       }
-      //ires -= fpos + 1; //use count instead of ires
-      x *= 10; y *= 10; z *= 10;
-      if (strcmp(atomty,"CA")==0) {
-        if (count>=len || nca>=len) { error = ERR_ATOM_COUNT; fprintf(stderr, "CA atoms are problematic!\n"); return; }
-        se[count] = ThreeLetterToOne(resty);
-        if (se[count]=='-') { error = ERR_RES; return; }
-        xca[count][0] = x;
-        xca[count][1] = y;
-        xca[count][2] = z;
-        nca++;
-      }
-      if (strcmp(atomty,"CB")==0) {
-        if (count>=len || ncb>=len) { error = ERR_ATOM_COUNT; fprintf(stderr, "CB atoms are problematic!\n"); return; }
-        xcb[count][0] = x;
-        xcb[count][1] = y;
-        xcb[count][2] = z;
-        ncb++;
+      if (fs->type[k]==FM_CB) {
+	if (ires>=len || ncb>=len) { error = ERR_ATOM_COUNT; break; }
+	xcb[ires][0] = fs->x[k][0];
+	xcb[ires][1] = fs->x[k][1];
+	xcb[ires][2] = fs->x[k][2];
+	ncb++;
       }
     }
-  }*/
-
-  fclose(file);
+  }
 
-  if (nca!=len) {
+  if (error==ERR_NONE && nca!=len) {
       printf("Warning: Length mismatch for file %s! nca=%d len=%d\n", fname, nca, len);
       FILE * dout;
       dout = fopen("debug.info","w");
@@ -151,39 +247,51 @@ fgets(buff, 200, file);
       fprintf(dout, "nca=%d\n", nca);
       fprintf(dout, "len=%d\n", len);
       fclose(dout);
+      error = ERR_ATOM_COUNT;
   }
 
-  if (nca!=len) { error = ERR_ATOM_COUNT; return; }
+  if (error==ERR_NONE) {
+    for (i=0;i<len;++i) {
 
-  for (i=0;i<len;++i) {
-
-    for (j=0;j<len;++j) {
+      for (j=0;j<len;++j) {
 
-      rf[0][i][j] = ( i<j ? R(xca[i],xca[j]) : ( i>j ? R(xcb[i],xcb[j]) : 0.0 ) );
-      rf[1][i][j] = R(xca[i],xcb[j]);
+        if (i<j) {
+          rf_caca[tri(i,j)] = R(xca[i],xca[j]);
+          rf_cbcb[tri(i,j)] = R(xcb[i],xcb[j]);
+        }
+        rf_cacb[i*len+j] = R(xca[i],xcb[j]);
 
-      if (vfm_flag)
-          vmf[i][j] = VM(xca[i],xcb[i],xca[j],xcb[j]); // Multiplication (normalized) of CA-CB vectors between residue i and j
+        if (vfm_flag && i<=j)
+            vmf[tri_diag(i,j)] = VM(xca[i],xcb[i],xca[j],xcb[j]); // Multiplication (normalized) of CA-CB vectors between residue i and j
+      }
     }
   }
 
-  for (i=0;i<len;++i) {
-    delete [] xca[i];
-    delete [] xcb[i];
-  }
   delete [] xca;
   delete [] xcb;
 }
 
+bool Fragment_Memory::write(FILE *lib)
+{
+  int hdr[4];
+
+  hdr[0] = pos;
+  hdr[1] = fpos;
+  hdr[2] = len;
+  hdr[3] = vfm_flag;
+
+  if (fwrite(hdr, sizeof(int), 4, lib)!=4 || fwrite(&weight, sizeof(double), 1, lib)!=1) return false;
+  if (fwrite(se, sizeof(char), len, lib)!=(size_t)len) return false;
+  if (fwrite(data, sizeof(float), data_size, lib)!=data_size) return false;
+
+  return true;
+}
+
 Fragment_Memory::~Fragment_Memory()
 {
-  for (int i=0;i<len;++i) {
-    delete [] rf[0][i];
-    delete [] rf[1][i];
-  }
+  if (!owns_data) return;
 
-  delete [] rf[0];
-  delete [] rf[1];
+  fm_arena_release();
   delete [] se;
 }
 
@@ -193,11 +301,11 @@ double Fragment_Memory::Rf(int ires, int iatom, int jres, int jatom)
   jres -= pos;
   if (ires<0 || ires>=len || jres<0 || jres>=len) { error = ERR_CALL; return 0.0; }
   if (iatom==FM_CA && jatom==FM_CA ) {
-    return rf[0][min(ires,jres)][max(ires,jres)];
+    return (ires==jres ? 0.0 : rf_caca[tri(min(ires,jres),max(ires,jres))]);
   } else if (iatom==FM_CB && jatom==FM_CB) {
-    return rf[0][max(ires,jres)][min(ires,jres)];
+    return (ires==jres ? 0.0 : rf_cbcb[tri(min(ires,jres),max(ires,jres))]);
   } else {
-    return (iatom==FM_CA ? rf[1][ires][jres] : rf[1][jres][ires]);
+    return (iatom==FM_CA ? rf_cacb[ires*len+jres] : rf_cacb[jres*len+ires]);
   }
 }
 
@@ -208,7 +316,7 @@ double Fragment_Memory::VMf(int ires, int jres)
   if (!vfm_flag || ires<0 || ires>=len || jres<0 || jres>=len) { error = ERR_CALL; return 0.0; }
   if (se[ires]=='G' || se[jres]=='G') { error = ERR_VFM_GLY; return 0.0; }
 
-  return vmf[ires][jres];
+  return vmf[tri_diag(min(ires,jres),max(ires,jres))];
 }
 
 char Fragment_Memory::getSe(int resno)
@@ -231,6 +339,18 @@ inline int Fragment_Memory::max(int a, int b)
   return (a>b ? a : b);
 }
 
+// Index of (i, j), i<j, in a row-major upper triangle without the diagonal
+inline int Fragment_Memory::tri(int i, int j)
+{
+  return i*(len-1) - i*(i-1)/2 + (j-i-1);
+}
+
+// Index of (i, j), i<=j, in a row-major upper triangle with the diagonal
+inline int Fragment_Memory::tri_diag(int i, int j)
+{
+  return i*len - i*(i-1)/2 + (j-i);
+}
+
 inline double Fragment_Memory::R(double *r1, double *r2)
 {
   return sqrt((r1[0]-r2[0])*(r1[0]-r2[0]) + (r1[1]-r2[1])*(r1[1]-r2[1]) + (r1[2]-r2[2])*(r1[2]-r2[2]));
@@ -272,9 +392,70 @@ char Fragment_Memory::ThreeLetterToOne(char *tl_resty)
 
 // --------------------------------------------------------------------//
 
+Fragment_Structure::Fragment_Structure(char *fname)
+{
+  int i, nAtoms, resno, iatom, ty, last_resno, nmax;
+  double xx, yy, zz;
+  char buff[201], resty[6], atomty[6];
+  FILE *file;
+
+  error = Fragment_Memory::ERR_NONE;
+
+  natoms = 0;
+  ires = NULL;
+  type = NULL;
+  se = NULL;
+  x = NULL;
+
+  file = fopen(fname,"r");
+  if (!file) { error = Fragment_Memory::ERR_FILE; return; }
+  fgets(buff, 200, file);
+  fscanf(file, "%d",&nAtoms);
+  fgets(buff, 200, file);
+
+  nmax = (nAtoms>0 ? nAtoms : 0);
+  ires = new int[nmax];
+  type = new int[nmax];
+  se = new char[nmax];
+  x = new double[nmax][3];
+
+  last_resno = -1;
+  for (i=0;i<nAtoms;++i) {
+    if (fscanf(file, "%d %s %s %d %lf %lf %lf",&resno,resty,atomty,&iatom,&xx,&yy,&zz)!=7) break;
+
+    if (strcmp(atomty,"CA")==0) ty = Fragment_Memory::FM_CA;
+    else if (strcmp(atomty,"CB")==0) ty = Fragment_Memory::FM_CB;
+    else if (natoms==0 || resno!=last_resno) ty = 0;
+    else continue;
+
+    ires[natoms] = resno;
+    type[natoms] = ty;
+    se[natoms] = (ty==Fragment_Memory::FM_CA ? Fragment_Memory::ThreeLetterToOne(resty) : '?');
+    x[natoms][0] = 10*xx;
+    x[natoms][1] = 10*yy;
+    x[natoms][2] = 10*zz;
+    last_resno = resno;
+    natoms++;
+  }
+
+  fclose(file);
+}
+
+Fragment_Structure::~Fragment_Structure()
+{
+  delete [] ires;
+  delete [] type;
+  delete [] se;
+  delete [] x;
+}
+
+// --------------------------------------------------------------------//
+
 Gamma_Array::Gamma_Array(char *fname)
 {
   allocated = false;
+  sep_class = NULL;
+  gamma_flat = NULL;
 
   int i, iline, ns, nbuf, buf_len, ngamma, cl;
   char line[100] , buf[6][10], *st;
@@ -375,6 +556,8 @@ Gamma_Array::Gamma_Array(char *fname)
   }
 
   fclose(file);
+
+  build_lookup();
 }
 
 Gamma_Array::~Gamma_Array()
@@ -382,6 +565,46 @@ Gamma_Array::~Gamma_Array()
   if (allocated) {
     delete [] gamma;
   }
+  delete [] sep_class;
+  delete [] gamma_flat;
+}
+
+// Tabulate the separation classes and the gammas of every class and type
+// combination once, using getGamma() so the lookups return the same values
+void Gamma_Array::build_lookup()
+{
+  int d, cl, it, jt, ift, jft, stride;
+
+  nsep_tab = (i_sep[nseq_cl]!=-1 ? i_sep[nseq_cl]+2 : i_sep[nseq_cl-1]+1);
+  sep_class = new int[nsep_tab];
+  for (d=0;d<nsep_tab;++d) {
+    if (d<i_sep[0] || (i_sep[nseq_cl]!=-1 && d>i_sep[nseq_cl])) {
+      sep_class[d] = 0;
+    } else {
+      for (cl=1;cl<nseq_cl && d>=i_sep[cl];cl++) {}
+      sep_class[d] = cl;
+    }
+  }
+
+  stride = (frag_resty ? 160000 : 400);
+  gamma_flat = new double[(nseq_cl+1)*stride];
+  for (it=0;it<stride;++it) gamma_flat[it] = 0.0;
+
+  for (cl=1;cl<=nseq_cl;++cl) {
+    // i_sep[cl-1] is the smallest separation of class cl
+    d = i_sep[cl-1];
+    for (it=0;it<20;++it) {
+      for (jt=0;jt<20;++jt) {
+        if (!frag_resty) {
+          gamma_flat[cl*stride + it*20 + jt] = getGamma(it, jt, 0, d);
+        } else {
+          for (ift=0;ift<20;++ift)
+            for (jft=0;jft<20;++jft)
+              gamma_flat[cl*stride + ((it*20 + jt)*20 + ift)*20 + jft] = getGamma(it, jt, ift, jft, 0, d);
+        }
+      }
+    }
+  }
 }
 
 double Gamma_Array::getGamma(int ires, int jres)
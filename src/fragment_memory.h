@@ -28,10 +28,26 @@ int four_letter_map[] = {1, 3, 2, 2, 4, 2, 2, 1, 3, 4, 4, 3, 4, 4, 1, 1, 1, 4, 4
 #ifndef FRAGMENT_MEMORY_H
 #define FRAGMENT_MEMORY_H
 
+#include <stdio.h>
+
+// Compiled fragment library: this magic, the version, the number of
+// memories and the vector FM flag, then one Fragment_Memory::write() record
+// per memory
+#define FM_LIBRARY_MAGIC "AWSEMFML"
+#define FM_LIBRARY_VERSION 2
+
+class Fragment_Structure;
+
 class Fragment_Memory {
 public:
   Fragment_Memory(int p, int pf, int l, double w, char *fname, bool vec_fm_flag=false);
+  Fragment_Memory(int p, int pf, int l, double w, Fragment_Structure *fs, char *fname, bool vec_fm_flag=false);
+  Fragment_Memory(FILE *lib); // read one compiled library record
+  Fragment_Memory(char *image); // read-only view of a write_image() buffer
   ~Fragment_Memory();
+  bool write(FILE *lib); // write one compiled library record
+  size_t image_size(); // bytes used by write_image(), a multiple of 8
+  void write_image(char *image);
   int pos;    // Position of the first residue in target sequance
   int mpos;   // Middle residue position (in target)
   int fpos;   // Position of the fragment in the library protein
@@ -43,21 +59,45 @@ public:
   double Rf(int ires, int iatom, int jres, int jatom); // distance between atoms in residues i and j
   double VMf(int ires, int jres); // Angle between normalized CA->CB vectors of residues i and j
   int resType(int resno); // return type of fragment residue corresponding to resno in target
-  char ThreeLetterToOne(char *tl_resty);
+  static char ThreeLetterToOne(char *tl_resty);
   int min(int, int);
   int max(int, int);
   int error;
   enum Errors {ERR_NONE=0, ERR_FILE, ERR_ATOM_COUNT, ERR_RES, ERR_CALL, ERR_VFM_GLY};
   enum FM_AtomTypes { FM_CA=1, FM_CB };
 private:
-  // rf[0][i][j] are CA-CA (i<j) and CB-CB (i>j) distances
-  // rf[1][ica][jcb] are CA-CB distances
-  double **rf[2];
-  double **vmf;
+  // One block from a shared arena: rf_caca and rf_cbcb are upper
+  // triangles (i<j), rf_cacb[ica*len+jcb] the CA-CB square and vmf the
+  // symmetric vector FM angles as an upper triangle with the diagonal
+  float *data;
+  size_t data_size;
+  float *rf_caca, *rf_cbcb, *rf_cacb, *vmf;
+  bool owns_data;
+  void allocate();
+  void set_layout();
+  inline int tri(int i, int j);
+  inline int tri_diag(int i, int j);
+  void build(Fragment_Structure *fs, char *fname);
   inline double R(double *r1, double *r2);
   inline double VM(double *r11, double *r12, double *r21, double *r22);
 };
 
+// CA and CB atoms of a memory structure (.gro) file, parsed once and shared
+// by all memories built from that file. Other atoms are only kept as a
+// marker when they start a new residue number, which is all that the
+// residue range scan in Fragment_Memory::build() needs.
+class Fragment_Structure {
+public:
+  Fragment_Structure(char *fname);
+  ~Fragment_Structure();
+  int natoms;
+  int *ires;      // residue number in the file
+  int *type;      // Fragment_Memory::FM_CA, FM_CB or 0 for a marker
+  char *se;       // one letter residue code
+  double (*x)[3]; // coordinates in Angstrom
+  int error;
+};
+
 #endif
 
 // --------------------------------------------------------------------//
@@ -72,6 +112,14 @@ public:
   double getGamma(int ires, int jres);
   double getGamma(int ires_type, int jres_type, int ires, int jres);
   double getGamma(int ires_type, int jres_type, int ifres_type, int jfres_type, int ires, int jres);
+  // Lookups without error checks for residue types below 20 and the
+  // matching fourResTypes() mode, valid once construction succeeded
+  inline double gammaLookup(int ires_type, int jres_type, int ires, int jres) {
+    return gamma_flat[sepClass(ires-jres)*400 + ires_type*20 + jres_type];
+  }
+  inline double gammaLookup(int ires_type, int jres_type, int ifres_type, int jfres_type, int ires, int jres) {
+    return gamma_flat[sepClass(ires-jres)*160000 + ((ires_type*20 + jres_type)*20 + ifres_type)*20 + jfres_type];
+  }
   bool fourResTypes() { return frag_resty; }
   static bool isEmptyString(char *str);
   int minSep();
@@ -81,6 +129,17 @@ public:
   enum Errors {ERR_NONE=0, ERR_FILE, ERR_CLASS_DEF, ERR_GAMMA, ERR_G_CLASS, ERR_ASSIGN, ERR_CALL};
 private:
   double *gamma;
+  // sep_class[|i-j|] is the separation class, 0 outside the gamma range;
+  // separations beyond the table use its last entry. gamma_flat holds the
+  // gammas of every class over 20 residue types, class 0 being all zeros.
+  int nsep_tab;
+  int *sep_class;
+  double *gamma_flat;
+  void build_lookup();
+  inline int sepClass(int dij) {
+    dij = (dij<0 ? -dij : dij);
+    return sep_class[dij<nsep_tab ? dij : nsep_tab-1];
+  }
   int nseq_cl; // Number of sequance seperation classes
   int nres_cl; // Number of residue classes
   bool frag_resty; // True if gamma also depends on fragment residue types
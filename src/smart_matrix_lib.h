@@ -9,6 +9,10 @@ The modified density depending on zim file is included
 Last Update: 3/9/2012
 ------------------------------------------------------------------------- */
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 typedef struct WPV {
   double kappa;
   double kappa_sigma;
@@ -79,29 +83,213 @@ typedef struct ContactRestraintsPar {
 
 //=============================================================================================//
 
+// Open addressing map from a residue pair (i,j) to a dense slot number.
+// Slots are handed out in insertion order, so the owner keeps per-pair
+// values in plain arrays indexed by slot. find() never modifies the table
+// and may be called concurrently; insert() and clear() must be serial.
+class cPairIndex {
+public:
+	cPairIndex() : cap(0), npair(0), keys(NULL), slots(NULL) { rehash(64); }
+	~cPairIndex() { delete [] keys; delete [] slots; }
+
+	inline int find(int i, int j) const
+	{
+		long long key = make_key(i, j);
+		int h = hash(key);
+		while (keys[h]!=-1) {
+			if (keys[h]==key) return slots[h];
+			h = (h + 1) & (cap - 1);
+		}
+		return -1;
+	}
+
+	inline int insert(int i, int j)
+	{
+		long long key = make_key(i, j);
+		int h;
+		if (2*(npair+1)>cap) rehash(2*cap);
+		h = hash(key);
+		while (keys[h]!=-1) {
+			if (keys[h]==key) return slots[h];
+			h = (h + 1) & (cap - 1);
+		}
+		keys[h] = key;
+		slots[h] = npair;
+		return npair++;
+	}
+
+	inline void clear()
+	{
+		for (int h=0;h<cap;++h) keys[h] = -1;
+		npair = 0;
+	}
+
+	inline int size() const { return npair; }
+
+private:
+	int cap, npair;
+	long long *keys;
+	int *slots;
+
+	static inline long long make_key(int i, int j) { return ((long long)i << 32) | (unsigned int)j; }
+	inline int hash(long long key) const { return (int)(((unsigned long long)key*0x9E3779B97F4A7C15ULL) >> 32) & (cap - 1); }
+
+	inline void rehash(int new_cap)
+	{
+		int h, k, old_cap = cap;
+		long long *old_keys = keys;
+		int *old_slots = slots;
+
+		cap = new_cap;
+		keys = new long long[cap];
+		slots = new int[cap];
+		for (h=0;h<cap;++h) keys[h] = -1;
+
+		for (k=0;k<old_cap;++k) {
+			if (old_keys[k]==-1) continue;
+			h = hash(old_keys[k]);
+			while (keys[h]!=-1) h = (h + 1) & (cap - 1);
+			keys[h] = old_keys[k];
+			slots[h] = old_slots[k];
+		}
+
+		delete [] old_keys;
+		delete [] old_slots;
+	}
+};
+
+//=============================================================================================//
+
+// Per-pair cache of nv values with nv timestep stamps, stored in the slots
+// of a cPairIndex. Memory grows with the number of pairs seen instead of
+// with n*m. The cache is only written outside of OpenMP parallel regions;
+// inside them slot() returns -1 for a pair that is not cached yet and
+// writable() is false, so the caller computes a missing or stale value
+// without storing it.
+template <typename T>
+class cPairCache {
+public:
+	cPairCache(int nvals);
+	~cPairCache();
+
+	inline int slot(int i, int j);
+	inline bool writable() const;
+	int add(int i, int j);
+	void clear() { pairs.clear(); }
+	void reset();
+
+	inline T &val(int s, int k) { return v[s*nv+k]; }
+	inline int &stamp(int s, int k) { return g[s*nv+k]; }
+
+private:
+	int nv, max_pairs;
+	cPairIndex pairs;
+	T *v;
+	int *g;
+
+	void grow(int new_max);
+};
+
+template <typename T>
+cPairCache<T>::cPairCache(int nvals)
+{
+	nv = nvals;
+	max_pairs = 0;
+	v = NULL;
+	g = NULL;
+	grow(1024);
+}
+
+template <typename T>
+cPairCache<T>::~cPairCache()
+{
+	delete [] v;
+	delete [] g;
+}
+
+template <typename T>
+void cPairCache<T>::grow(int new_max)
+{
+	int i;
+	T *tv = new T[new_max*nv];
+	int *tg = new int[new_max*nv];
+
+	for (i=0;i<max_pairs*nv;++i) {
+		tv[i] = v[i];
+		tg[i] = g[i];
+	}
+	for (i=max_pairs*nv;i<new_max*nv;++i) tg[i] = -1;
+
+	delete [] v;
+	delete [] g;
+	v = tv;
+	g = tg;
+	max_pairs = new_max;
+}
+
+template <typename T>
+void cPairCache<T>::reset()
+{
+	for (int i=0;i<pairs.size()*nv;++i) g[i] = -1;
+}
+
+template <typename T>
+int cPairCache<T>::add(int i, int j)
+{
+	int s = pairs.size();
+	int t = pairs.insert(i, j);
+	if (t!=s) return t;
+	if (s>=max_pairs) grow(2*max_pairs);
+	for (int k=0;k<nv;++k) g[s*nv+k] = -1;
+	return s;
+}
+
+template <typename T>
+inline bool cPairCache<T>::writable() const
+{
+#if defined(_OPENMP)
+	return !omp_in_parallel();
+#else
+	return true;
+#endif
+}
+
+template <typename T>
+inline int cPairCache<T>::slot(int i, int j)
+{
+	int s = pairs.find(i, j);
+	if (s!=-1) return s;
+#if defined(_OPENMP)
+	if (omp_in_parallel()) return -1;
+#endif
+	return add(i, j);
+}
+
+//=============================================================================================//
+
 template <typename T, typename U>
 class cP_AP {
 public:
 	cP_AP(int n, int m, int *indicator, U *lclass);
 	~cP_AP();
 	
-	inline T &nu(int i, int j);
-	inline T &prd_nu(int i, int j);
-	void compute(int i, int j);
+	inline T nu(int i, int j);
+	inline T prd_nu(int i, int j);
+	void compute(int i, int j, T &v_nu, T &v_prd_nu);
 	void reset();
 private:
 	int n, m;
-	T **v_nu;
-	T **v_prd_nu;
-	int **g;
+	cPairCache<T> cache;	// values: nu, prd_nu
 	int *ind;
 	U *lc;
 	double drmax, drmin;
 	double drmax_sq, drmin_sq;
+
+	inline int lookup(int i, int j, T &v_nu, T &v_prd_nu);
 };
 
 template <typename T, typename U>
-cP_AP<T, U>::cP_AP(int nn, int mm, int *indicator, U *lclass)
+cP_AP<T, U>::cP_AP(int nn, int mm, int *indicator, U *lclass) : cache(2)
 {
 	n = nn;
 	m = mm;
@@ -113,67 +301,63 @@ cP_AP<T, U>::cP_AP(int nn, int mm, int *indicator, U *lclass)
 
 	drmax_sq = drmax*drmax;
 	drmin_sq = drmin*drmin;
-
-	v_nu = new T*[n];
-	v_prd_nu = new T*[n];
-	g = new int*[n];
-
-	for (int i=0;i<n;++i) {
-		v_nu[i] = new T[m];
-		v_prd_nu[i] = new T[m];
-		g[i] = new int[m];
-		for (int j=0;j<m;++j) g[i][j] = -1;
-	}
 }
 
+// Pairs are keyed by local residue indices, which change with reneighboring
 template <typename T, typename U>
 void cP_AP<T, U>::reset()
 {
-	for (int i=0;i<n;++i) {
-		for (int j=0;j<m;++j) g[i][j] = -1;
-	}
+	cache.clear();
 }
 
 template <typename T, typename U>
 cP_AP<T, U>::~cP_AP()
 {
-	for (int i=0;i<n;++i) {
-		delete [] v_nu[i];
-		delete [] v_prd_nu[i];
-		delete [] g[i];
-	}
-
-	delete [] v_nu;
-	delete [] v_prd_nu;
-	delete [] g;
 }
 
 template <typename T, typename U>
-inline T &cP_AP<T, U>::nu(int i, int j)
+inline int cP_AP<T, U>::lookup(int i, int j, T &v_nu, T &v_prd_nu)
 {
-	if ( (ind && g[i][j]!=*ind) || (!ind && g[i][j]!=1) ) {
-		compute(i, j);
-		if (ind) g[i][j] = *ind;
-		else g[i][j] = 1;
+	int s = cache.slot(i, j);
+	int st = ind ? *ind : 1;
+
+	if (s==-1) {
+		compute(i, j, v_nu, v_prd_nu);
+		return s;
 	}
 
-	return v_nu[i][j];
+	if (cache.stamp(s, 0)!=st) {
+		if (!cache.writable()) {
+			compute(i, j, v_nu, v_prd_nu);
+			return s;
+		}
+		compute(i, j, cache.val(s, 0), cache.val(s, 1));
+		cache.stamp(s, 0) = st;
+	}
+	v_nu = cache.val(s, 0);
+	v_prd_nu = cache.val(s, 1);
+
+	return s;
 }
 
 template <typename T, typename U>
-inline T &cP_AP<T, U>::prd_nu(int i, int j)
+inline T cP_AP<T, U>::nu(int i, int j)
 {
-	if ( (ind && g[i][j]!=*ind) || (!ind && g[i][j]!=1) ) {
-		compute(i, j);
-		if (ind) g[i][j] = *ind;
-		else g[i][j] = 1;
-	}
+	T v_nu, v_prd_nu;
+	lookup(i, j, v_nu, v_prd_nu);
+	return v_nu;
+}
 
-	return v_prd_nu[i][j];
+template <typename T, typename U>
+inline T cP_AP<T, U>::prd_nu(int i, int j)
+{
+	T v_nu, v_prd_nu;
+	lookup(i, j, v_nu, v_prd_nu);
+	return v_prd_nu;
 }
 
 template <typename T, typename U>
-void cP_AP<T, U>::compute(int i, int j)
+void cP_AP<T, U>::compute(int i, int j, T &v_nu, T &v_prd_nu)
 {
 	T dx[3], dr, drsq, th;
 
@@ -184,21 +368,21 @@ void cP_AP<T, U>::compute(int i, int j)
 	drsq = pow(dx[0],2) + pow(dx[1],2) + pow(dx[2],2);
 
 	if (drsq>drmax_sq) {
-		v_nu[i][j] = 0.0;
+		v_nu = 0.0;
 
-		v_prd_nu[i][j] = 0.0;
+		v_prd_nu = 0.0;
 	} else if(drsq<drmin_sq) {
-		v_nu[i][j] = 1.0;
+		v_nu = 1.0;
 
-		v_prd_nu[i][j] = 0.0;
+		v_prd_nu = 0.0;
 	} else {
 		dr = sqrt(drsq);
 
-		th = tanh(lc->P_AP_pref*(lc->P_AP_cut - dr));
+		th = lc->math_tanh(lc->P_AP_pref*(lc->P_AP_cut - dr));
 
-		v_nu[i][j] = 0.5*(1+th);
+		v_nu = 0.5*(1+th);
 
-		v_prd_nu[i][j] = 0.5*lc->P_AP_pref*(1-pow(th,2))/dr;
+		v_prd_nu = 0.5*lc->P_AP_pref*(1-pow(th,2))/dr;
 	}
 }
 
@@ -210,94 +394,89 @@ public:
 	cR(int n, int m, int *indicator, U *lclass);
 	~cR();
 	
-	inline T &rNO(int i, int j);
-	inline T &rHO(int i, int j);
+	inline T rNO(int i, int j);
+	inline T rHO(int i, int j);
 
 	void reset();
 private:
 	int n, m;
-	T **v_rNO;
-	T **v_rHO;
-	int **gNO;
-	int **gHO;
+	cPairCache<T> cache;	// values: rNO, rHO
 	int *ind;
 	U *lc;
+
+	inline T compute_rNO(int i, int j);
+	inline T compute_rHO(int i, int j);
 };
 
 template <typename T, typename U>
-cR<T, U>::cR(int nn, int mm, int *indicator, U *lclass)
+cR<T, U>::cR(int nn, int mm, int *indicator, U *lclass) : cache(2)
 {
 	n = nn;
 	m = mm;
 	ind = indicator;
 	lc = lclass;
-
-	v_rNO = new T*[n];
-	v_rHO = new T*[n];
-	gNO = new int*[n];
-	gHO = new int*[n];
-
-	for (int i=0;i<n;++i) {
-		v_rNO[i] = new T[m];
-		v_rHO[i] = new T[m];
-		gNO[i] = new int[m];
-		gHO[i] = new int[m];
-		for (int j=0;j<m;++j) { gNO[i][j] = -1; gHO[i][j] = -1; }
-	}
 }
 
+// Pairs are keyed by local residue indices, which change with reneighboring
 template <typename T, typename U>
 void cR<T, U>::reset()
 {
-	for (int i=0;i<n;++i) {
-		for (int j=0;j<m;++j) { gNO[i][j] = -1; gHO[i][j] = -1; }
-	}
+	cache.clear();
 }
 
 template <typename T, typename U>
 cR<T, U>::~cR()
 {
-	for (int i=0;i<n;++i) {
-		delete [] v_rNO[i];
-		delete [] v_rHO[i];
-		delete [] gNO[i];
-		delete [] gHO[i];
-	}
+}
 
-	delete [] v_rNO;
-	delete [] v_rHO;
-	delete [] gNO;
-	delete [] gHO;
+template <typename T, typename U>
+inline T cR<T, U>::compute_rNO(int i, int j)
+{
+	return sqrt( pow(lc->xo[i][0] - lc->xn[j][0], 2) +
+		     pow(lc->xo[i][1] - lc->xn[j][1], 2) +
+		     pow(lc->xo[i][2] - lc->xn[j][2], 2) );
+}
+
+template <typename T, typename U>
+inline T cR<T, U>::compute_rHO(int i, int j)
+{
+	return sqrt( pow(lc->xo[i][0] - lc->xh[j][0], 2) +
+		     pow(lc->xo[i][1] - lc->xh[j][1], 2) +
+		     pow(lc->xo[i][2] - lc->xh[j][2], 2) );
 }
 
 template <typename T, typename U>
-inline T &cR<T, U>::rNO(int i, int j)
+inline T cR<T, U>::rNO(int i, int j)
 {
-	if ( (ind && gNO[i][j]!=*ind) || (!ind && gNO[i][j]!=1) ) {
-		v_rNO[i][j] = sqrt( pow(lc->xo[i][0] - lc->xn[j][0], 2) +
-				    pow(lc->xo[i][1] - lc->xn[j][1], 2) +
-				    pow(lc->xo[i][2] - lc->xn[j][2], 2) );
+	int s = cache.slot(i, j);
+	int st = ind ? *ind : 1;
+
+	if (s==-1) return compute_rNO(i, j);
 
-		if (ind) gNO[i][j] = *ind;
-		else gNO[i][j] = 1;
+	if (cache.stamp(s, 0)!=st) {
+		if (!cache.writable()) return compute_rNO(i, j);
+		cache.val(s, 0) = compute_rNO(i, j);
+		cache.stamp(s, 0) = st;
 	}
 
-	return v_rNO[i][j];
+	return cache.val(s, 0);
 }
 
 template <typename T, typename U>
-inline T &cR<T, U>::rHO(int i, int j)
+inline T cR<T, U>::rHO(int i, int j)
 {
-	if ( (ind && gHO[i][j]!=*ind) || (!ind && gHO[i][j]!=1) ) {
-		v_rHO[i][j] = sqrt( pow(lc->xo[i][0] - lc->xh[j][0], 2) +
-			  	    pow(lc->xo[i][1] - lc->xh[j][1], 2) +
-			  	    pow(lc->xo[i][2] - lc->xh[j][2], 2) );
+	int s = cache.slot(i, j);
+	int st = ind ? *ind : 1;
+
+	if (s==-1) return compute_rHO(i, j);
 
-		if (ind) gHO[i][j] = *ind;
-		else gHO[i][j] = 1;
+	if (cache.stamp(s, 1)!=st) {
+		if (!cache.writable()) return compute_rHO(i, j);
+		cache.val(s, 1) = compute_rHO(i, j);
+		cache.stamp(s, 1) = st;
 	}
 
-	return v_rHO[i][j];
+	return cache.val(s, 1);
 }
 
 //=============================================================================================//
@@ -308,36 +487,32 @@ public:
 	cWell(int n, int m, int nw, const WPV &par, int *indicator, U *lclass);
 	~cWell();
 	
-	inline T &theta(int i, int j, int i_well);
-	inline T &prd_theta(int i, int j, int i_well);
-	inline T &theta_pair(int i, int j, int i_well, T rij);
-	inline T &prd_theta_pair(int i, int j, int i_well, T rij);
-	inline T &sigma(int i, int j);
-	inline T &H(int i);
-	inline T &prd_H(int i);
-	inline T &ro(int i);
+	inline T theta(int i, int j, int i_well);
+	inline T prd_theta(int i, int j, int i_well);
+	inline T sigma(int i, int j);
+	inline T H(int i);
+	inline T prd_H(int i);
+	inline T ro(int i);
 	
-	void compute_theta(int i, int j, int i_well);
-	void compute_theta_pair(int i, int j, int i_well, T rij);
-	void compute_sigma(int i, int j);
+	void compute_theta(int i, int j, int i_well, T &th, T &prd_th);
+	void compute_theta_pair(T rij, int i_well, T &th, T &prd_th);
+	void compute_theta_wells(T rij, T *th, T *prd_th);
 	void compute_H(int i);
 	void compute_ro(int i);
 	WPV par;
 
 	T *rmin_theta, *rmax_theta;
 	T *rmin_theta_sq, *rmax_theta_sq;
+	T rmax_theta_all;
+	bool fused_ok;
+	T *exp_r_min, *exp_r_max;	// exp(-2*kappa*well_r_min), exp(2*kappa*well_r_max)
 
 	void reset();
 private:
 	int n, m, nw;
-	T ***v_theta;
-	T ***v_prd_theta;
-	T **v_sigma;
 	T *v_H;
 	T *v_prd_H;
 	T *v_ro;
-	int ***gTheta;
-	int **gSigma;
 	int *gH;
 	int *gRo;
 	int *ind;
@@ -347,7 +522,7 @@ private:
 template <typename T, typename U>
 cWell<T, U>::cWell(int nn, int mm, int ww, const WPV &p, int *indicator, U *lclass)
 {
-	int i,j,k;
+	int i,k;
 	n = nn;
 	m = mm;
 	nw = ww;
@@ -367,41 +542,27 @@ cWell<T, U>::cWell(int nn, int mm, int ww, const WPV &p, int *indicator, U *lcla
 		rmax_theta_sq[k] = rmax_theta[k]*rmax_theta[k];
 	}
 
-	v_sigma = new T*[n];
+	// all wells share kappa, so compute_theta_wells() needs one exp(2*kappa*r) per pair
+	exp_r_min = new T[nw];
+	exp_r_max = new T[nw];
+	rmax_theta_all = 0.0;
+	fused_ok = true;
+	for (k=0;k<nw;++k) {
+		if (2.0*par.kappa*par.well_r_max[k]>300.0) fused_ok = false;
+		exp_r_min[k] = exp(-2.0*par.kappa*par.well_r_min[k]);
+		exp_r_max[k] = exp(2.0*par.kappa*par.well_r_max[k]);
+		if (rmax_theta[k]>rmax_theta_all) rmax_theta_all = rmax_theta[k];
+	}
+
 	v_H = new T[n];
 	v_prd_H = new T[n];
 	v_ro = new T[n];
-	gSigma = new int*[n];
 	gH = new int[n];
 	gRo = new int[n];
 
 	for (i=0;i<n;++i) {
 		gH[i] = -1;
 		gRo[i] = -1;
-		
-		v_sigma[i] = new T[m];
-		gSigma[i] = new int[m];
-
-		for (j=0;j<m;++j) {
-			gSigma[i][j] = -1;
-		}
-	}
-
-	v_theta = new T**[nw];
-	v_prd_theta = new T**[nw];
-	gTheta = new int**[nw];
-
-	for (k=0;k<nw;++k) {
-		v_theta[k] = new T*[n];
-		v_prd_theta[k] = new T*[n];
-		gTheta[k] = new int*[n];
-
-		for (i=0;i<n;++i) {
-			v_theta[k][i] = new T[m];
-			v_prd_theta[k][i] = new T[m];
-			gTheta[k][i] = new int[m];
-			for (j=0;j<m;++j) gTheta[k][i][j] = -1;
-		}
 	}
 }
 
@@ -411,117 +572,52 @@ void cWell<T, U>::reset()
 	for (int i=0;i<n;++i) {
 		gH[i] = -1;
 		gRo[i] = -1;
-		for (int j=0;j<m;++j) {
-			gSigma[i][j] = -1;
-		}
-	}
-
-
-	for (int k=0;k<nw;++k) {
-		for (int i=0;i<n;++i) {
-			for (int j=0;j<m;++j) gTheta[k][i][j] = -1;
-		}
 	}
 } 
 
 template <typename T, typename U>
 cWell<T, U>::~cWell()
 {
-	for (int k=0;k<nw;++k) {
-		for (int i=0;i<n;++i) {
-			delete [] v_theta[k][i];
-			delete [] v_prd_theta[k][i];
-			delete [] gTheta[k][i];
-		}
-
-		delete [] v_theta[k];
-		delete [] v_prd_theta[k];
-		delete [] gTheta[k];
-	}
-
-	for (int i=0;i<n;++i) {
-		delete [] v_sigma[i];
-		delete [] gSigma[i];
-	}
-
-	delete [] v_theta;
-	delete [] v_prd_theta;
-	delete [] v_sigma;
 	delete [] v_H;
 	delete [] v_prd_H;
 	delete [] v_ro;
-	delete [] gTheta;
-	delete [] gSigma;
 	delete [] gH;
 	delete [] gRo;
 	delete [] rmin_theta;
 	delete [] rmax_theta;
 	delete [] rmin_theta_sq;
 	delete [] rmax_theta_sq;
+	delete [] exp_r_min;
+	delete [] exp_r_max;
 }
 
+// theta, prd_theta and sigma are only read by the per-residue paths
+// (water/helix without the neighbor list, burial, debug output), the
+// neighbor list path gets them from the active pair buffer
 template <typename T, typename U>
-inline T &cWell<T, U>::theta(int i, int j, int i_well)
+inline T cWell<T, U>::theta(int i, int j, int i_well)
 {
-	if ( (ind && gTheta[i_well][i][j]!=*ind) || (!ind && gTheta[i_well][i][j]!=1) ) {
-		compute_theta(i, j, i_well);
-		if (ind) gTheta[i_well][i][j] = gTheta[i_well][j][i] = *ind;
-		else gTheta[i_well][i][j] = gTheta[i_well][j][i] = 1;
-	}
-
-	return v_theta[i_well][i][j];
+	T th, prd_th;
+	compute_theta(i, j, i_well, th, prd_th);
+	return th;
 }
 
 template <typename T, typename U>
-inline T &cWell<T, U>::theta_pair(int i, int j, int i_well, T rij)
+inline T cWell<T, U>::prd_theta(int i, int j, int i_well)
 {
-        if ( (ind && gTheta[i_well][i][j]!=*ind) || (!ind && gTheta[i_well][i][j]!=1) ) {
-                compute_theta_pair(i, j, i_well, rij);
-                if (ind) gTheta[i_well][i][j] = gTheta[i_well][j][i] = *ind;
-                else gTheta[i_well][i][j] = gTheta[i_well][j][i] = 1;
-        }
-
-        return v_theta[i_well][i][j];
+	T th, prd_th;
+	compute_theta(i, j, i_well, th, prd_th);
+	return prd_th;
 }
 
 template <typename T, typename U>
-inline T &cWell<T, U>::prd_theta(int i, int j, int i_well)
+inline T cWell<T, U>::sigma(int i, int j)
 {
-	if ( (ind && gTheta[i_well][i][j]!=*ind) || (!ind && gTheta[i_well][i][j]!=1) ) {
-		compute_theta(i, j, i_well);
-		if (ind) gTheta[i_well][i][j] = gTheta[i_well][j][i] = *ind;
-		else gTheta[i_well][i][j] = gTheta[i_well][j][i] = 1;
-	}
-
-	return v_prd_theta[i_well][i][j];
+	return H(i)*H(j);
 }
 
 template <typename T, typename U>
-inline T &cWell<T, U>::prd_theta_pair(int i, int j, int i_well, T rij)
-{
-        if ( (ind && gTheta[i_well][i][j]!=*ind) || (!ind && gTheta[i_well][i][j]!=1) ) {
-                compute_theta_pair(i, j, i_well, rij);
-                if (ind) gTheta[i_well][i][j] = gTheta[i_well][j][i] = *ind;
-                else gTheta[i_well][i][j] = gTheta[i_well][j][i] = 1;
-        }
-
-        return v_prd_theta[i_well][i][j];
-}
-
-template <typename T, typename U>
-inline T &cWell<T, U>::sigma(int i, int j)
-{
-	if ( (ind && gSigma[i][j]!=*ind) || (!ind && gSigma[i][j]!=1) ) {
-		compute_sigma(i, j);
-		if (ind) gSigma[i][j] = gSigma[j][i] = *ind;
-		else gSigma[i][j] = gSigma[j][i] = 1;
-	}
-
-	return v_sigma[i][j];
-}
-
-template <typename T, typename U>
-inline T &cWell<T, U>::H(int i)
+inline T cWell<T, U>::H(int i)
 {
 	if ( (ind && gH[i]!=*ind) || (!ind && gH[i]!=1) ) {
 		compute_H(i);
@@ -533,7 +629,7 @@ inline T &cWell<T, U>::H(int i)
 }
 
 template <typename T, typename U>
-inline T &cWell<T, U>::prd_H(int i)
+inline T cWell<T, U>::prd_H(int i)
 {
 	if ( (ind && gH[i]!=*ind) || (!ind && gH[i]!=1) ) {
 		compute_H(i);
@@ -545,7 +641,7 @@ inline T &cWell<T, U>::prd_H(int i)
 }
 
 template <typename T, typename U>
-inline T &cWell<T, U>::ro(int i)
+inline T cWell<T, U>::ro(int i)
 {
 	if ( (ind && gRo[i]!=*ind) || (!ind && gRo[i]!=1) ) {
 		compute_ro(i);
@@ -557,7 +653,7 @@ inline T &cWell<T, U>::ro(int i)
 }
 
 template <typename T, typename U>
-void cWell<T, U>::compute_theta(int i, int j, int i_well)
+void cWell<T, U>::compute_theta(int i, int j, int i_well, T &th, T &prd_th)
 {
 	T dx[3], rij, rij_sq, t_min, t_max;
 	T *xi, *xj;
@@ -577,42 +673,64 @@ void cWell<T, U>::compute_theta(int i, int j, int i_well)
 	rij_sq = pow(dx[0],2) + pow(dx[1],2) + pow(dx[2],2);
 
 	if (rij_sq<rmin_theta_sq[i_well] || rij_sq>rmax_theta_sq[i_well]) {
-		v_theta[i_well][i][j] = v_theta[i_well][j][i] = 0.0;
-		v_prd_theta[i_well][i][j] = v_prd_theta[i_well][j][i] = 0.0;
+		th = 0.0;
+		prd_th = 0.0;
 	} else {
 		rij = sqrt(rij_sq);
 	
-		t_min = tanh( par.kappa*(rij - par.well_r_min[i_well]) );
-		t_max = tanh( par.kappa*(par.well_r_max[i_well] - rij) );
-		v_theta[i_well][i][j] = 0.25*(1.0 + t_min)*(1.0 + t_max);
-		v_theta[i_well][j][i] = v_theta[i_well][i][j];
-		v_prd_theta[i_well][i][j] = par.kappa*v_theta[i_well][i][j]*(t_max - t_min)/rij;
-		v_prd_theta[i_well][j][i] = v_prd_theta[i_well][i][j];
+		t_min = lc->math_tanh( par.kappa*(rij - par.well_r_min[i_well]) );
+		t_max = lc->math_tanh( par.kappa*(par.well_r_max[i_well] - rij) );
+		th = 0.25*(1.0 + t_min)*(1.0 + t_max);
+		prd_th = par.kappa*th*(t_max - t_min)/rij;
 	}
 }
 
 template <typename T, typename U>
-void cWell<T, U>::compute_theta_pair(int i, int j, int i_well, T rij)
+void cWell<T, U>::compute_theta_pair(T rij, int i_well, T &th, T &prd_th)
 {
         T t_min, t_max;
 
         if (rij<rmin_theta[i_well] || rij>rmax_theta[i_well]) {
-                v_theta[i_well][i][j] = v_theta[i_well][j][i] = 0.0;
-                v_prd_theta[i_well][i][j] = v_prd_theta[i_well][j][i] = 0.0;
+                th = 0.0;
+                prd_th = 0.0;
         } else {
-                t_min = tanh( par.kappa*(rij - par.well_r_min[i_well]) );
-                t_max = tanh( par.kappa*(par.well_r_max[i_well] - rij) );
-                v_theta[i_well][i][j] = 0.25*(1.0 + t_min)*(1.0 + t_max);
-                v_theta[i_well][j][i] = v_theta[i_well][i][j];
-                v_prd_theta[i_well][i][j] = par.kappa*v_theta[i_well][i][j]*(t_max - t_min)/rij;
-                v_prd_theta[i_well][j][i] = v_prd_theta[i_well][i][j];
+                t_min = lc->math_tanh( par.kappa*(rij - par.well_r_min[i_well]) );
+                t_max = lc->math_tanh( par.kappa*(par.well_r_max[i_well] - rij) );
+                th = 0.25*(1.0 + t_min)*(1.0 + t_max);
+                prd_th = par.kappa*th*(t_max - t_min)/rij;
         }
 }
 
+// theta and prd_theta of every well at once. With x = exp(2*kappa*r),
+// a = exp(-2*kappa*r_min) and b = exp(2*kappa*r_max):
+//   1 + tanh(kappa*(r - r_min)) = 2*a*x/(a*x + 1)
+//   1 + tanh(kappa*(r_max - r)) = 2*b/(b + x)
 template <typename T, typename U>
-void cWell<T, U>::compute_sigma(int i, int j)
-{	
-	v_sigma[i][j] = v_sigma[j][i] = H(i)*H(j);
+void cWell<T, U>::compute_theta_wells(T rij, T *th, T *prd_th)
+{
+	int k;
+	T x, ax, t_min, t_max;
+
+	if (!fused_ok || rij>rmax_theta_all || 2.0*par.kappa*rij>300.0) {
+		for (k=0;k<nw;++k) compute_theta_pair(rij, k, th[k], prd_th[k]);
+		return;
+	}
+
+	x = lc->math_exp(2.0*par.kappa*rij);
+
+	for (k=0;k<nw;++k) {
+		if (rij<rmin_theta[k] || rij>rmax_theta[k]) {
+			th[k] = 0.0;
+			prd_th[k] = 0.0;
+			continue;
+		}
+
+		ax = exp_r_min[k]*x;
+		t_min = (ax - 1.0)/(ax + 1.0);
+		t_max = (exp_r_max[k] - x)/(exp_r_max[k] + x);
+		th[k] = ax*exp_r_max[k]/((ax + 1.0)*(exp_r_max[k] + x));
+		prd_th[k] = par.kappa*th[k]*(t_max - t_min)/rij;
+	}
 }
 
 template <typename T, typename U>
@@ -621,7 +739,7 @@ void cWell<T, U>::compute_H(int i)
 	T g, th;
 	
 	g = par.kappa_sigma*(ro(i) - par.treshold);
-	th = tanh(g);
+	th = lc->math_tanh(g);
 	v_H[i] = 0.5*( 1.0 -  th);
 	v_prd_H[i] = -0.5*par.kappa_sigma*( 1.0 - th*th );
 }
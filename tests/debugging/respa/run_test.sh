@@ -0,0 +1,56 @@
+#!/bin/bash
+# Runs respa.in with rRESPA and with verlet and compares the final
+# coordinates, forces and fix backbone energies. LMP selects the LAMMPS
+# binary, TOL the relative tolerance. Prints PASSED and exits with 0 when
+# every value agrees within TOL, prints FAILED and exits with 1 otherwise.
+
+LMP=${LMP:-lmp_serial}
+TOL=${TOL:-1e-6}
+HERE=$(cd "$(dirname "$0")" && pwd)
+EXAMPLE=$HERE/../../../examples/examples_new/1CTA_Dimer_Binding
+WORK=$(mktemp -d)
+
+for f in anti_HB anti_NHB anti_one para_HB para_one burial_gamma.dat gamma.dat ssweight data.1ctaDimer 1ctaDimer.seq; do
+  cp "$EXAMPLE/$f" "$WORK/" || exit 1
+done
+cp "$HERE/respa.in" "$HERE/fix_backbone_coeff.data" "$WORK/"
+cd "$WORK" || exit 1
+
+for mode in respa verlet; do
+  if ! $LMP -in respa.in -var mode $mode -log log.$mode > screen.$mode 2>&1; then
+    echo "FAILED: $mode run, see $WORK/log.$mode"
+    exit 1
+  fi
+  mv energy.log energy.$mode
+done
+
+# last snapshot of each dump, fields id x y z fx fy fz
+last() { awk '/^ITEM: ATOMS/ { n=0; delete a; atoms=1; next } /^ITEM:/ { atoms=0 } atoms { a[++n]=$0 } END { for (i=1;i<=n;++i) print a[i] }' "$1"; }
+last forces_respa.dump > respa.txt
+last forces_verlet.dump > verlet.txt
+
+if ! paste respa.txt verlet.txt | awk -v tol=$TOL '
+  { for (k=2;k<=7;++k) { a=$k; b=$(k+7); d=(a>b ? a-b : b-a); s=(a<0 ? -a : a)+(b<0 ? -b : b)+1.0;
+      if (d>tol*s) { printf("atom %d field %d: respa %s verlet %s\n", $1, k, a, b); bad=1 } } }
+  END { exit bad }'; then
+  echo "FAILED: rRESPA and verlet disagree, see $WORK"
+  exit 1
+fi
+
+# last line of energy.log, the terms after the step column; energy.log
+# prints 6 decimals, hence the absolute floor of 1e-5
+if ! paste <(tail -n 1 energy.respa) <(tail -n 1 energy.verlet) | awk -F'\t' -v tol=$TOL '
+  { n=NF/2; for (k=2;k<=n;++k) { a=$k; b=$(k+n); d=(a>b ? a-b : b-a); s=(a<0 ? -a : a)+(b<0 ? -b : b);
+      if (d>tol*s && d>1e-5) { printf("energy term %d: respa %s verlet %s\n", k-1, a, b); bad=1 } } }
+  END { exit bad }'; then
+  echo "FAILED: rRESPA and verlet energies disagree, see $WORK"
+  exit 1
+fi
+
+if [ ! -s respa.txt ]; then
+  echo "FAILED: no forces dumped, see $WORK"
+  exit 1
+fi
+
+echo "PASSED"
+rm -rf "$WORK"
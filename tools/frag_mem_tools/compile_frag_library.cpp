@@ -0,0 +1,130 @@
+// Compile a fragment memory file (.mem) and the structure (.gro) files it
+// references into a single binary library that fix backbone loads in one
+// sequential pass. The library can be used anywhere a .mem file is expected.
+//
+// Build:  g++ -O2 -I../../src -o compile_frag_library compile_frag_library.cpp ../../src/fragment_memory.cpp
+// Usage:  compile_frag_library fragsLAMW.mem fragsLAMW.fml [-v]
+//         -v also stores the data needed by Vector_Fragment_Memory
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "fragment_memory.h"
+
+char *trim(char *s)
+{
+	char *e;
+
+	while (isspace(*s)) s++;
+	e = s + strlen(s);
+	while (e>s && isspace(*(e-1))) e--;
+	*e = '\0';
+
+	return s;
+}
+
+int main(int argc, char **argv)
+{
+	int i, nstr, tpos, fpos, len, in_mems, hdr[3];
+	double weight;
+	char ln[500], *line, *str[10];
+	bool vfm_flag;
+	FILE *file, *out;
+	Fragment_Memory *mem;
+	Fragment_Structure *fs;
+	std::vector<Fragment_Memory *> mems;
+	std::map<std::string, Fragment_Structure *> fs_cache;
+	std::map<std::string, Fragment_Structure *>::iterator it;
+
+	if (argc!=3 && argc!=4) {
+		printf("Usage: %s mem_file library_file [-v]\n", argv[0]);
+		return 1;
+	}
+	vfm_flag = (argc==4 && strcmp(argv[3], "-v")==0);
+
+	file = fopen(argv[1], "r");
+	if (!file) {
+		printf("Cannot open %s\n", argv[1]);
+		return 1;
+	}
+
+	in_mems = 0;
+	while (fgets(ln, sizeof ln, file)!=NULL) {
+		line = trim(ln);
+
+		if (line[0]=='#') continue;
+		if (line[0]=='\0') { in_mems = 0; continue; }
+		if (line[0]=='[') {
+			in_mems = (strcmp(line, "[Memories]")==0);
+			continue;
+		}
+		if (!in_mems) continue;
+
+		nstr = 0;
+		str[nstr] = strtok(line, " \t\n");
+		while (str[nstr]!=NULL) {
+			nstr++;
+			if (nstr>5) break;
+			str[nstr] = strtok(NULL, " \t\n");
+		}
+		if (nstr!=5) {
+			printf("Error reading %s: %s\n", argv[1], line);
+			return 1;
+		}
+
+		tpos = atoi(str[1])-1;
+		fpos = atoi(str[2])-1;
+		len = atoi(str[3]);
+		weight = atof(str[4]);
+
+		it = fs_cache.find(str[0]);
+		if (it!=fs_cache.end()) {
+			fs = it->second;
+		} else {
+			fs = new Fragment_Structure(str[0]);
+			fs_cache[str[0]] = fs;
+		}
+
+		mem = new Fragment_Memory(tpos, fpos, len, weight, fs, str[0], vfm_flag);
+		if (mem->error!=Fragment_Memory::ERR_NONE) {
+			printf("Error reading %s file!\n", str[0]);
+			return 1;
+		}
+		mems.push_back(mem);
+	}
+	fclose(file);
+
+	out = fopen(argv[2], "wb");
+	if (!out) {
+		printf("Cannot open %s\n", argv[2]);
+		return 1;
+	}
+
+	hdr[0] = FM_LIBRARY_VERSION;
+	hdr[1] = (int)mems.size();
+	hdr[2] = vfm_flag;
+	if (fwrite(FM_LIBRARY_MAGIC, sizeof(char), 8, out)!=8 || fwrite(hdr, sizeof(int), 3, out)!=3) {
+		printf("Error writing %s\n", argv[2]);
+		return 1;
+	}
+	for (i=0;i<(int)mems.size();++i) {
+		if (!mems[i]->write(out)) {
+			printf("Error writing %s\n", argv[2]);
+			return 1;
+		}
+	}
+	fclose(out);
+
+	printf("%d memories from %d structure files written to %s\n", (int)mems.size(), (int)fs_cache.size(), argv[2]);
+
+	for (i=0;i<(int)mems.size();++i) delete mems[i];
+	for (it=fs_cache.begin();it!=fs_cache.end();++it) delete it->second;
+
+	return 0;
+}